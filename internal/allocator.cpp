@@ -0,0 +1,179 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "allocator.h"
+using namespace std;
+
+FrameArena::FrameArena(size_t block_size)
+{
+    m_block_size = block_size > 0 ? block_size : 1;
+    m_current = 0;
+    m_offset = 0;
+    m_used = 0;
+    m_peak = 0;
+}
+
+FrameArena::~FrameArena()
+{
+    release();
+}
+
+void *FrameArena::allocate_slow(size_t size, size_t alignment)
+{
+    // 当前块放不下，在之后已有的块中找一个足够大的；都不够时申请新块。
+    // 当前块之后的块都是空的，调整它们的顺序不影响已经分配的内存
+    size_t needed = size + alignment - 1;
+    size_t next = m_blocks.empty() ? 0 : m_current + 1;
+    size_t found = next;
+    while (found < m_blocks.size() && m_blocks[found].size < needed)
+        ++found;
+
+    if (found < m_blocks.size())
+        swap(m_blocks[found], m_blocks[next]);
+    else
+    {
+        Block block;
+        block.size = needed > m_block_size ? needed : m_block_size;
+        block.data = static_cast<char*>(::operator new(block.size));
+        m_blocks.insert(m_blocks.begin() + next, block);
+    }
+
+    // 上一块末尾剩余的空间也算作已使用，保证rewind()和bytes_used()一致
+    if (next != m_current)
+        m_used += m_blocks[m_current].size - m_offset;
+    m_current = next;
+    m_offset = 0;
+    return allocate(size, alignment);
+}
+
+FrameArena::Marker FrameArena::mark() const
+{
+    Marker marker;
+    marker.block = m_current;
+    marker.offset = m_offset;
+    marker.used = m_used;
+    return marker;
+}
+
+void FrameArena::rewind(const Marker &marker)
+{
+    if (m_used > m_peak)
+        m_peak = m_used;
+    m_current = marker.block;
+    m_offset = marker.offset;
+    m_used = marker.used;
+}
+
+void FrameArena::reset()
+{
+    if (m_used > m_peak)
+        m_peak = m_used;
+    m_current = 0;
+    m_offset = 0;
+    m_used = 0;
+}
+
+void FrameArena::release()
+{
+    for (size_t i = 0; i < m_blocks.size(); i++)
+        ::operator delete(m_blocks[i].data);
+    m_blocks.clear();
+    m_current = 0;
+    m_offset = 0;
+    m_used = 0;
+    m_peak = 0;
+}
+
+size_t FrameArena::capacity() const
+{
+    size_t total = 0;
+    for (size_t i = 0; i < m_blocks.size(); i++)
+        total += m_blocks[i].size;
+    return total;
+}
+
+FixedSizePool::FixedSizePool(size_t slot_size, size_t slots_per_chunk)
+{
+    // 空闲的格子要存放链表指针，格子大小还要保证下一个格子对齐
+    const size_t alignment = alignof(max_align_t);
+    if (slot_size < sizeof(FreeSlot))
+        slot_size = sizeof(FreeSlot);
+    m_slot_size = (slot_size + alignment - 1) & ~(alignment - 1);
+    m_slots_per_chunk = slots_per_chunk > 0 ? slots_per_chunk : 1;
+    m_free = NULL;
+    m_live = 0;
+}
+
+FixedSizePool::~FixedSizePool()
+{
+    for (size_t i = 0; i < m_chunks.size(); i++)
+        ::operator delete(m_chunks[i]);
+}
+
+void *FixedSizePool::allocate_slow()
+{
+    char *chunk = static_cast<char*>(::operator new(m_slot_size * m_slots_per_chunk));
+    m_chunks.push_back(chunk);
+
+    // 把新块中的格子按地址顺序串进空闲链表，顺序分配时访问是连续的
+    for (size_t i = m_slots_per_chunk; i > 0; i--)
+    {
+        FreeSlot *slot = reinterpret_cast<FreeSlot*>(chunk + (i - 1) * m_slot_size);
+        slot->next = m_free;
+        m_free = slot;
+    }
+    return allocate();
+}
+
+PoolResource::PoolResource(size_t slots_per_chunk)
+{
+    m_slots_per_chunk = slots_per_chunk;
+    for (size_t i = 0; i < class_count; i++)
+        m_pools[i] = NULL;
+}
+
+PoolResource::~PoolResource()
+{
+    for (size_t i = 0; i < class_count; i++)
+        delete m_pools[i];
+}
+
+void *PoolResource::allocate(size_t size)
+{
+    if (size == 0)
+        size = 1;
+    if (size > max_pooled_size)
+        return ::operator new(size);
+
+    size_t index = (size - 1) / granularity;
+    if (m_pools[index] == NULL)
+        m_pools[index] = new FixedSizePool((index + 1) * granularity, m_slots_per_chunk);
+    return m_pools[index]->allocate();
+}
+
+void PoolResource::deallocate(void *pointer, size_t size)
+{
+    if (pointer == NULL)
+        return;
+    if (size == 0)
+        size = 1;
+    if (size > max_pooled_size)
+        ::operator delete(pointer);
+    else
+        m_pools[(size - 1) / granularity]->deallocate(pointer);
+}
@@ -0,0 +1,308 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * 文件名: allocator.h
+ * 作用: 帧内存池(每个tick重置)、定长对象池，以及供STL容器使用的分配器
+ *
+ * 这些分配器都不是线程安全的，每个线程应当使用自己的实例。
+ */
+
+#ifndef _ALLOCATOR_H_
+#define _ALLOCATOR_H_
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include "fundamental_types.h"
+
+// 帧内存池: 只移动指针的分配，不能单独释放，每个tick结束时用reset()一次性回收。
+// 内存按块向系统申请，reset()后保留所有块，稳定状态下不再调用new。
+//     FrameArena arena;
+//     while (running)
+//     {
+//         int *visible = arena.allocate_array<int>(count);
+//         ...
+//         arena.reset();
+//     }
+class FrameArena
+{
+private:
+    struct Block
+    {
+        char *data;
+        size_t size;
+    };
+
+    std::vector<Block> m_blocks;
+    size_t m_block_size;
+    size_t m_current; // 正在使用的块
+    size_t m_offset;  // 当前块中已经分配的字节数
+    size_t m_used;    // 所有块中已经分配的字节数(包括对齐的空隙)
+    size_t m_peak;
+
+    void *allocate_slow(size_t size, size_t alignment);
+
+public:
+    // 内存池中的一个位置，rewind()可以回到这里，释放之后分配的所有内存
+    struct Marker
+    {
+        size_t block;
+        size_t offset;
+        size_t used;
+    };
+
+    // block_size为每次向系统申请的字节数，超过它的分配单独申请一块
+    explicit FrameArena(size_t block_size = 1 << 20);
+    ~FrameArena();
+
+    // alignment必须是2的幂
+    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+    {
+        if (m_current < m_blocks.size())
+        {
+            const Block &block = m_blocks[m_current];
+            size_t address = reinterpret_cast<size_t>(block.data) + m_offset;
+            size_t padding = (alignment - (address & (alignment - 1))) & (alignment - 1);
+            if (m_offset + padding + size <= block.size)
+            {
+                m_offset += padding + size;
+                m_used += padding + size;
+                return reinterpret_cast<void*>(address + padding);
+            }
+        }
+        return allocate_slow(size, alignment);
+    }
+
+    template <typename T>
+    T *allocate_array(size_t count)
+    {
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    // 在内存池中构造对象。内存池不会调用析构函数，所以只能用于可平凡析构的类型
+    template <typename T, typename... Args>
+    T *create(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "FrameArena never runs destructors");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    Marker mark() const;
+    void rewind(const Marker &marker);
+
+    // 回收所有分配，保留已经申请的块
+    void reset();
+    // 释放所有块，下次分配时重新申请
+    void release();
+
+    size_t bytes_used() const { return m_used; }
+    // 自创建或上次release()以来bytes_used()的最大值，可以用来调整block_size
+    size_t peak_bytes_used() const { return m_peak > m_used ? m_peak : m_used; }
+    size_t capacity() const;
+};
+
+// 定长内存池: 每次分配slot_size字节，释放的格子放入空闲链表，下次分配优先使用。
+// 按每次slots_per_chunk个格子向系统申请，申请的内存直到内存池析构才释放。
+class FixedSizePool
+{
+private:
+    struct FreeSlot
+    {
+        FreeSlot *next;
+    };
+
+    size_t m_slot_size;
+    size_t m_slots_per_chunk;
+    FreeSlot *m_free;
+    std::vector<char*> m_chunks;
+    size_t m_live;
+
+    void *allocate_slow();
+
+public:
+    // 格子按alignof(std::max_align_t)对齐，不支持更大的对齐要求
+    FixedSizePool(size_t slot_size, size_t slots_per_chunk = 256);
+    ~FixedSizePool();
+
+    void *allocate()
+    {
+        if (m_free == NULL)
+            return allocate_slow();
+        FreeSlot *slot = m_free;
+        m_free = slot->next;
+        ++m_live;
+        return slot;
+    }
+
+    // pointer必须来自这个内存池的allocate()
+    void deallocate(void *pointer)
+    {
+        FreeSlot *slot = static_cast<FreeSlot*>(pointer);
+        slot->next = m_free;
+        m_free = slot;
+        --m_live;
+    }
+
+    size_t slot_size() const { return m_slot_size; }
+    // 尚未释放的格子数
+    size_t live_count() const { return m_live; }
+    size_t capacity() const { return m_chunks.size() * m_slots_per_chunk; }
+};
+
+// 定长对象池，例如区块的section和实体
+//     ObjectPool<Entity> entities;
+//     Entity *entity = entities.create(id, position);
+//     ...
+//     entities.destroy(entity);
+// 对象池析构时不会调用尚未destroy()的对象的析构函数
+template <typename T>
+class ObjectPool
+{
+private:
+    FixedSizePool m_pool;
+
+public:
+    static_assert(alignof(T) <= alignof(std::max_align_t), "ObjectPool does not support over-aligned types");
+
+    explicit ObjectPool(size_t objects_per_chunk = 256) : m_pool(sizeof(T), objects_per_chunk) { }
+
+    template <typename... Args>
+    T *create(Args&&... args)
+    {
+        return new (m_pool.allocate()) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T *object)
+    {
+        if (object == NULL)
+            return;
+        object->~T();
+        m_pool.deallocate(object);
+    }
+
+    size_t live_count() const { return m_pool.live_count(); }
+};
+
+// 按大小分级的内存池，供PoolAllocator使用
+// 不超过max_pooled_size的请求向上取整到16字节的倍数，由对应的FixedSizePool分配，
+// 更大的请求直接使用new
+class PoolResource
+{
+private:
+    static const size_t granularity = 16;
+    static const size_t max_pooled_size = 256;
+    static const size_t class_count = max_pooled_size / granularity;
+
+    FixedSizePool *m_pools[class_count];
+    size_t m_slots_per_chunk;
+
+public:
+    explicit PoolResource(size_t slots_per_chunk = 256);
+    ~PoolResource();
+
+    void *allocate(size_t size);
+    // size必须与allocate()时相同
+    void deallocate(void *pointer, size_t size);
+};
+
+// STL分配器，从FrameArena分配，deallocate()不做任何事，
+// 适合只在一个tick内使用的临时容器
+//     std::vector<int, ArenaAllocator<int> > list((ArenaAllocator<int>(&arena)));
+template <typename T>
+class ArenaAllocator
+{
+private:
+    FrameArena *m_arena;
+
+public:
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef ArenaAllocator<U> other;
+    };
+
+    explicit ArenaAllocator(FrameArena *arena) : m_arena(arena) { }
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : m_arena(other.arena()) { }
+
+    T *allocate(size_t n) { return m_arena->allocate_array<T>(n); }
+    void deallocate(T*, size_t) { }
+
+    FrameArena *arena() const { return m_arena; }
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+    return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+    return a.arena() != b.arena();
+}
+
+// STL分配器，从PoolResource分配，适合std::list、std::map等逐个分配节点的容器
+//     typedef PoolAllocator<std::pair<const int, Chunk*> > ChunkMapAllocator;
+//     PoolResource resource;
+//     ChunkMapAllocator allocator(&resource);
+//     std::map<int, Chunk*, std::less<int>, ChunkMapAllocator> chunks(std::less<int>(), allocator);
+template <typename T>
+class PoolAllocator
+{
+private:
+    PoolResource *m_resource;
+
+public:
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef PoolAllocator<U> other;
+    };
+
+    explicit PoolAllocator(PoolResource *resource) : m_resource(resource) { }
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &other) : m_resource(other.resource()) { }
+
+    T *allocate(size_t n) { return static_cast<T*>(m_resource->allocate(sizeof(T) * n)); }
+    void deallocate(T *pointer, size_t n) { m_resource->deallocate(pointer, sizeof(T) * n); }
+
+    PoolResource *resource() const { return m_resource; }
+};
+
+template <typename T, typename U>
+inline bool operator==(const PoolAllocator<T> &a, const PoolAllocator<U> &b)
+{
+    return a.resource() == b.resource();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const PoolAllocator<T> &a, const PoolAllocator<U> &b)
+{
+    return a.resource() != b.resource();
+}
+
+#endif
@@ -0,0 +1,427 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "binary_log.h"
+#include "fundamental_utility.h"
+#include <ctime>
+using namespace std;
+
+static const char binary_log_magic[8] = { 'N', 'G', 'W', 'B', 'L', 'O', 'G', '1' };
+static const u8 binary_log_preformatted_level = 0xFF;
+// 格式编号从1开始连续分配，超过这个值的编号只能来自损坏的文件
+static const u32 binary_log_max_format_id = 1 << 20;
+
+static thread_local BinaryLogArgs thread_args_buffer;
+
+void BinaryLogArgs::append(u8 type, const void *value, size_t n)
+{
+    if (count == 0xFF || length + 1 + n > capacity)
+        return;
+    data[length++] = static_cast<char>(type);
+    memcpy(data + length, value, n);
+    length += n;
+    ++count;
+}
+
+static void binary_log_integer(BinaryLogArgs &args, long long value)
+{
+    args.append(BINARY_LOG_INT, &value, sizeof(value));
+}
+
+static void binary_log_unsigned(BinaryLogArgs &args, unsigned long long value)
+{
+    args.append(BINARY_LOG_UINT, &value, sizeof(value));
+}
+
+static void binary_log_string(BinaryLogArgs &args, const char *value, size_t size)
+{
+    // 字符串带上u32长度，放不下时截断
+    if (args.count == 0xFF || args.length + 1 + sizeof(u32) > BinaryLogArgs::capacity)
+        return;
+    if (size > BinaryLogArgs::capacity - args.length - 1 - sizeof(u32))
+        size = BinaryLogArgs::capacity - args.length - 1 - sizeof(u32);
+    u32 length = static_cast<u32>(size);
+    args.append(BINARY_LOG_STRING, &length, sizeof(length));
+    memcpy(args.data + args.length, value, length);
+    args.length += length;
+}
+
+void binary_log_value(BinaryLogArgs &args, const char *value)
+{
+    if (value == NULL)
+        value = "(null)";
+    binary_log_string(args, value, strlen(value));
+}
+
+void binary_log_value(BinaryLogArgs &args, const std::string &value)
+{
+    binary_log_string(args, value.data(), value.size());
+}
+
+void binary_log_value(BinaryLogArgs &args, char value)
+{
+    args.append(BINARY_LOG_CHAR, &value, 1);
+}
+
+void binary_log_value(BinaryLogArgs &args, bool value)
+{
+    u8 byte = value ? 1 : 0;
+    args.append(BINARY_LOG_BOOL, &byte, 1);
+}
+
+void binary_log_value(BinaryLogArgs &args, int value)
+{
+    binary_log_integer(args, value);
+}
+
+void binary_log_value(BinaryLogArgs &args, unsigned int value)
+{
+    binary_log_unsigned(args, value);
+}
+
+void binary_log_value(BinaryLogArgs &args, long value)
+{
+    binary_log_integer(args, value);
+}
+
+void binary_log_value(BinaryLogArgs &args, unsigned long value)
+{
+    binary_log_unsigned(args, value);
+}
+
+void binary_log_value(BinaryLogArgs &args, long long value)
+{
+    binary_log_integer(args, value);
+}
+
+void binary_log_value(BinaryLogArgs &args, unsigned long long value)
+{
+    binary_log_unsigned(args, value);
+}
+
+void binary_log_value(BinaryLogArgs &args, double value)
+{
+    args.append(BINARY_LOG_DOUBLE, &value, sizeof(value));
+}
+
+void binary_log_value(BinaryLogArgs &args, const void *value)
+{
+    unsigned long long address = reinterpret_cast<unsigned long long>(value);
+    args.append(BINARY_LOG_POINTER, &address, sizeof(address));
+}
+
+LoggerForwarderBinary::LoggerForwarderBinary(const string &file_name)
+{
+    m_file = fopen(file_name.c_str(), "wb");
+    m_next_format_id = 1;
+    m_start_time = OSLayer::fast_ns();
+    m_buffer.reserve(flush_threshold * 2);
+
+    u64 wall_time = static_cast<u64>(time(NULL));
+    append_bytes(binary_log_magic, sizeof(binary_log_magic));
+    append_bytes(&wall_time, sizeof(wall_time));
+}
+
+LoggerForwarderBinary::~LoggerForwarderBinary()
+{
+    flush();
+    if (m_file != NULL)
+        fclose(m_file);
+}
+
+BinaryLogArgs &LoggerForwarderBinary::get_args_buffer()
+{
+    return thread_args_buffer;
+}
+
+void LoggerForwarderBinary::append_bytes(const void *data, size_t n)
+{
+    const char *p = static_cast<const char*>(data);
+    m_buffer.insert(m_buffer.end(), p, p + n);
+}
+
+void LoggerForwarderBinary::write_buffer()
+{
+    if (m_file != NULL && !m_buffer.empty())
+        fwrite(&m_buffer[0], 1, m_buffer.size(), m_file);
+    m_buffer.clear();
+}
+
+void LoggerForwarderBinary::append_record(LOG_LEVEL level, const char *format, const BinaryLogArgs &args)
+{
+    u64 timestamp = OSLayer::fast_ns() - m_start_time;
+    u8 level_byte = static_cast<u8>(level);
+    lock_guard<mutex> guard(m_lock);
+
+    u32 id;
+    if (format == NULL)
+    {
+        id = 0;
+        level_byte = binary_log_preformatted_level;
+    }
+    else
+    {
+        unordered_map<const char*, u32>::iterator it = m_format_ids.find(format);
+        if (it == m_format_ids.end())
+        {
+            // 第一次出现的格式字符串，先写入定义
+            id = m_next_format_id++;
+            m_format_ids[format] = id;
+            u32 length = static_cast<u32>(strlen(format));
+            m_buffer.push_back('F');
+            append_bytes(&id, sizeof(id));
+            append_bytes(&length, sizeof(length));
+            append_bytes(format, length);
+        }
+        else
+        {
+            id = it->second;
+        }
+    }
+
+    m_buffer.push_back('R');
+    append_bytes(&id, sizeof(id));
+    m_buffer.push_back(static_cast<char>(level_byte));
+    append_bytes(&timestamp, sizeof(timestamp));
+    m_buffer.push_back(static_cast<char>(args.count));
+    append_bytes(args.data, args.length);
+
+    if (m_buffer.size() >= flush_threshold)
+        write_buffer();
+}
+
+void LoggerForwarderBinary::forward_log(const std::string &str)
+{
+    BinaryLogArgs &buffer = get_args_buffer();
+    buffer.length = 0;
+    buffer.count = 0;
+    binary_log_value(buffer, str);
+    append_record(LOG_LEVEL_VERBOSE, NULL, buffer);
+}
+
+void LoggerForwarderBinary::flush()
+{
+    lock_guard<mutex> guard(m_lock);
+    write_buffer();
+    if (m_file != NULL)
+        fflush(m_file);
+}
+
+// 解码
+
+static bool read_bytes(FILE *in, void *data, size_t n)
+{
+    return fread(data, 1, n, in) == n;
+}
+
+// 读取一个参数并按照文本日志的规则格式化
+static bool decode_value(FILE *in, LogFormatBuffer &buffer)
+{
+    u8 type;
+    if (!read_bytes(in, &type, 1))
+        return false;
+
+    switch (type)
+    {
+    case BINARY_LOG_INT:
+    {
+        long long value;
+        if (!read_bytes(in, &value, sizeof(value)))
+            return false;
+        log_format_value(buffer, value);
+        return true;
+    }
+    case BINARY_LOG_UINT:
+    {
+        unsigned long long value;
+        if (!read_bytes(in, &value, sizeof(value)))
+            return false;
+        log_format_value(buffer, value);
+        return true;
+    }
+    case BINARY_LOG_DOUBLE:
+    {
+        double value;
+        if (!read_bytes(in, &value, sizeof(value)))
+            return false;
+        log_format_value(buffer, value);
+        return true;
+    }
+    case BINARY_LOG_BOOL:
+    {
+        u8 value;
+        if (!read_bytes(in, &value, 1))
+            return false;
+        log_format_value(buffer, value != 0);
+        return true;
+    }
+    case BINARY_LOG_CHAR:
+    {
+        char value;
+        if (!read_bytes(in, &value, 1))
+            return false;
+        log_format_value(buffer, value);
+        return true;
+    }
+    case BINARY_LOG_STRING:
+    {
+        u32 length;
+        char text[BinaryLogArgs::capacity];
+        if (!read_bytes(in, &length, sizeof(length)) || length > sizeof(text) || !read_bytes(in, text, length))
+            return false;
+        buffer.append(text, length);
+        return true;
+    }
+    case BINARY_LOG_POINTER:
+    {
+        unsigned long long value;
+        if (!read_bytes(in, &value, sizeof(value)))
+            return false;
+        log_format_value(buffer, reinterpret_cast<const void*>(value));
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// 解码失败时记录原因和出错的位置
+static bool decode_error(string *error, FILE *in, const char *reason)
+{
+    if (error != NULL)
+    {
+        char text[128];
+        snprintf(text, sizeof(text), "%s at offset %ld", reason, ftell(in));
+        *error = text;
+    }
+    return false;
+}
+
+bool decode_binary_log(const string &in_file, FILE *out, string *error)
+{
+    FILE *in = fopen(in_file.c_str(), "rb");
+    if (in == NULL)
+    {
+        if (error != NULL)
+            *error = "cannot open file";
+        return false;
+    }
+
+    // 文件长度，用于检查记录中的长度字段，避免损坏的文件导致巨大的内存分配
+    long file_size = -1;
+    if (fseek(in, 0, SEEK_END) == 0)
+        file_size = ftell(in);
+    rewind(in);
+
+    char magic[sizeof(binary_log_magic)];
+    u64 wall_time;
+    if (!read_bytes(in, magic, sizeof(magic)) || memcmp(magic, binary_log_magic, sizeof(magic)) != 0 ||
+        !read_bytes(in, &wall_time, sizeof(wall_time)))
+    {
+        decode_error(error, in, "not a binary log file");
+        fclose(in);
+        return false;
+    }
+
+    time_t start = static_cast<time_t>(wall_time);
+    fprintf(out, "NGWorld binary log started at %s", ctime(&start));
+
+    vector<string> formats(1);
+    LogFormatBuffer buffer;
+    bool ok = true;
+    int type;
+    u32 id, length;
+    u8 level, count;
+    u64 timestamp;
+
+    while (ok && (type = fgetc(in)) != EOF)
+    {
+        if (type == 'F')
+        {
+            if (!read_bytes(in, &id, sizeof(id)) || !read_bytes(in, &length, sizeof(length)))
+                ok = decode_error(error, in, "truncated format record");
+            else if (id == 0 || id > binary_log_max_format_id)
+                ok = decode_error(error, in, "invalid format id");
+            else if (file_size >= 0 && length > static_cast<u64>(file_size - ftell(in)))
+                ok = decode_error(error, in, "format length exceeds file size");
+            if (!ok)
+                break;
+            if (id >= formats.size())
+                formats.resize(id + 1);
+            formats[id].resize(length);
+            if (length > 0 && !read_bytes(in, &formats[id][0], length))
+                ok = decode_error(error, in, "truncated format string");
+        }
+        else if (type == 'R')
+        {
+            if (!read_bytes(in, &id, sizeof(id)) || !read_bytes(in, &level, 1) ||
+                !read_bytes(in, &timestamp, sizeof(timestamp)) || !read_bytes(in, &count, 1))
+                ok = decode_error(error, in, "truncated log record");
+            else if (id >= formats.size())
+                ok = decode_error(error, in, "undefined format id");
+            if (!ok)
+                break;
+
+            buffer.length = 0;
+            if (level == binary_log_preformatted_level)
+            {
+                // 已经格式化好的文本，原样输出
+                for (u8 i = 0; ok && i < count; i++)
+                    ok = decode_value(in, buffer);
+                if (!ok)
+                    ok = decode_error(error, in, "invalid argument");
+                fwrite(buffer.data, 1, buffer.length, out);
+                continue;
+            }
+
+            // 依次用参数替换"{}"，与log_format_args()的规则相同
+            const char *p = formats[id].c_str(), *q;
+            for (u8 i = 0; ok && i < count; i++)
+            {
+                q = strstr(p, "{}");
+                if (q == NULL)
+                {
+                    // 占位符不够，跳过多余的参数
+                    LogFormatBuffer ignored;
+                    ok = decode_value(in, ignored);
+                    continue;
+                }
+                buffer.append(p, q - p);
+                ok = decode_value(in, buffer);
+                p = q + 2;
+            }
+            if (!ok)
+            {
+                decode_error(error, in, "invalid argument");
+                break;
+            }
+            buffer.append(p, strlen(p));
+
+            fprintf(out, "[%.6lf] %s ", timestamp / 1e9, level < LOG_LEVLE_COUNT ? log_level_string[level] : "(?\?)");
+            fwrite(buffer.data, 1, buffer.length, out);
+            fputc('\n', out);
+        }
+        else
+        {
+            ok = decode_error(error, in, "unknown record type");
+        }
+    }
+
+    fclose(in);
+    return ok;
+}
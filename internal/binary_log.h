@@ -0,0 +1,138 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * 二进制日志格式
+ *
+ * 文件头: 8字节魔数"NGWBLOG1"，8字节写入开始时的UNIX时间戳
+ * 之后是若干条记录，第一个字节表示记录类型:
+ *   'F' 格式字符串定义: u32编号, u32长度, 字符串内容
+ *   'R' 日志记录: u32格式编号, u8级别, u64时间(纳秒，相对于文件头的时间), u8参数个数,
+ *       每个参数为u8类型标记加上原始字节
+ * 编号0保留给已经格式化好的文本，它只有一个字符串参数。
+ * 所有整数按本机字节序存放，解码需要在同样字节序的机器上进行。
+ */
+
+#ifndef _BINARY_LOG_H_
+#define _BINARY_LOG_H_
+
+#include "logger.h"
+#include "fundamental_types.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+enum BINARY_LOG_TYPE
+{
+    BINARY_LOG_INT = 1,
+    BINARY_LOG_UINT,
+    BINARY_LOG_DOUBLE,
+    BINARY_LOG_BOOL,
+    BINARY_LOG_CHAR,
+    BINARY_LOG_STRING,
+    BINARY_LOG_POINTER,
+};
+
+// 编码后的参数，长度固定，超出的部分被丢弃
+struct BinaryLogArgs
+{
+    static const size_t capacity = 1024;
+    char data[capacity];
+    size_t length;
+    u8 count;
+
+    BinaryLogArgs() : length(0), count(0) { }
+    void append(u8 type, const void *value, size_t n);
+};
+
+void binary_log_value(BinaryLogArgs &args, const char *value);
+void binary_log_value(BinaryLogArgs &args, const std::string &value);
+void binary_log_value(BinaryLogArgs &args, char value);
+void binary_log_value(BinaryLogArgs &args, bool value);
+void binary_log_value(BinaryLogArgs &args, int value);
+void binary_log_value(BinaryLogArgs &args, unsigned int value);
+void binary_log_value(BinaryLogArgs &args, long value);
+void binary_log_value(BinaryLogArgs &args, unsigned long value);
+void binary_log_value(BinaryLogArgs &args, long long value);
+void binary_log_value(BinaryLogArgs &args, unsigned long long value);
+void binary_log_value(BinaryLogArgs &args, double value);
+void binary_log_value(BinaryLogArgs &args, const void *value);
+
+inline void binary_log_args(BinaryLogArgs &args)
+{
+}
+
+template <typename T, typename... Args>
+void binary_log_args(BinaryLogArgs &args, const T &value, const Args&... rest)
+{
+    binary_log_value(args, value);
+    binary_log_args(args, rest...);
+}
+
+// 二进制日志转发器
+// 作为普通的转发器使用时，收到的是已经格式化好的文本；
+// 高频事件应当直接调用write()，只记录格式字符串的编号和参数的原始字节，
+// 文本化留给离线的解码工具(LogDecoder)去做。
+class LoggerForwarderBinary : public LoggerForwarder
+{
+private:
+    // 缓存超过这个大小时写入文件
+    static const size_t flush_threshold = 1 << 16;
+
+    FILE *m_file;
+    std::mutex m_lock;
+    std::vector<char> m_buffer;
+    // 格式字符串按地址区分，通常都是字符串常量
+    std::unordered_map<const char*, u32> m_format_ids;
+    u32 m_next_format_id;
+    u64 m_start_time;
+
+    static BinaryLogArgs &get_args_buffer();
+    void append_bytes(const void *data, size_t n);
+    void append_record(LOG_LEVEL level, const char *format, const BinaryLogArgs &args);
+    void write_buffer();
+
+public:
+    LoggerForwarderBinary(const std::string &file_name = "ngworld.blog");
+    ~LoggerForwarderBinary();
+
+    void forward_log(const std::string &str);
+
+    // 可以在任意线程中调用，格式与Logger::logf()相同
+    template <typename... Args>
+    void write(LOG_LEVEL level, const char *format, const Args&... args)
+    {
+        BinaryLogArgs &buffer = get_args_buffer();
+        buffer.length = 0;
+        buffer.count = 0;
+        binary_log_args(buffer, args...);
+        append_record(level, format, buffer);
+    }
+
+    // 把缓存中的记录写入文件
+    void flush();
+};
+
+// 把二进制日志in_file解码成文本写入out，格式与文本日志相同
+// 文件损坏时返回false，error不为NULL时写入原因和出错的位置
+bool decode_binary_log(const std::string &in_file, FILE *out, std::string *error = NULL);
+
+#endif
@@ -17,23 +17,55 @@
  */
 
 #include "compress.h"
+#include "metrics.h"
+#include "trace.h"
 #include <quicklz.h>
 #include <cstdlib>
 #include <cstring>
 using namespace std;
 
+// 压缩吞吐量: 处理的字节数和每次调用的耗时
+static MetricCounter *compress_bytes_in = metrics().counter("compress.bytes_in");
+static MetricCounter *compress_bytes_out = metrics().counter("compress.bytes_out");
+static MetricHistogram *compress_time = metrics().histogram("compress.time_ns");
+static MetricCounter *decompress_bytes_out = metrics().counter("decompress.bytes_out");
+static MetricHistogram *decompress_time = metrics().histogram("decompress.time_ns");
+
+// QuickLZ的状态较大，每个线程保留一份重复使用，qlz_compress()和qlz_decompress()每次都会重新初始化
+struct ThreadQuickLZSlot
+{
+    QuickLZ::qlz_state_compress *compress_state;
+    QuickLZ::qlz_state_decompress *decompress_state;
+
+    ThreadQuickLZSlot() : compress_state(NULL), decompress_state(NULL) { }
+    ~ThreadQuickLZSlot()
+    {
+        delete compress_state;
+        delete decompress_state;
+    }
+};
+
+static thread_local ThreadQuickLZSlot quicklz_slot;
+
 size_t compress(const char *src, char *dest, size_t size)
 {
-    QuickLZ::qlz_state_compress *state = new QuickLZ::qlz_state_compress;
-    size_t compressed_size = QuickLZ::qlz_compress(src, dest, size, state);
-    delete state;
+    NGW_TRACE_SCOPE("compress");
+    MetricTimer timer(compress_time);
+    if (quicklz_slot.compress_state == NULL)
+        quicklz_slot.compress_state = new QuickLZ::qlz_state_compress;
+    size_t compressed_size = QuickLZ::qlz_compress(src, dest, size, quicklz_slot.compress_state);
+    compress_bytes_in->add(size);
+    compress_bytes_out->add(compressed_size);
     return compressed_size;
 }
 
 size_t decompress(const char *src, char *dest)
 {
-    QuickLZ::qlz_state_decompress *state = new QuickLZ::qlz_state_decompress;
-    size_t decompressed_size = QuickLZ::qlz_decompress(src, dest, state);
-    delete state;
+    NGW_TRACE_SCOPE("decompress");
+    MetricTimer timer(decompress_time);
+    if (quicklz_slot.decompress_state == NULL)
+        quicklz_slot.decompress_state = new QuickLZ::qlz_state_decompress;
+    size_t decompressed_size = QuickLZ::qlz_decompress(src, dest, quicklz_slot.decompress_state);
+    decompress_bytes_out->add(decompressed_size);
     return decompressed_size;
 }
@@ -0,0 +1,265 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpu_features.h"
+#include <vector>
+#include <mutex>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef NGWORLD_X86
+#include <cpuid.h>
+#endif
+
+using namespace std;
+
+static const char *cpu_feature_names[CPU_FEATURE_COUNT] =
+{
+    "sse2",          // CPU_FEATURE_SSE2
+    "sse3",          // CPU_FEATURE_SSE3
+    "ssse3",         // CPU_FEATURE_SSSE3
+    "sse4.1",        // CPU_FEATURE_SSE41
+    "sse4.2",        // CPU_FEATURE_SSE42
+    "popcnt",        // CPU_FEATURE_POPCNT
+    "aes",           // CPU_FEATURE_AES
+    "pclmul",        // CPU_FEATURE_PCLMUL
+    "avx",           // CPU_FEATURE_AVX
+    "fma",           // CPU_FEATURE_FMA
+    "f16c",          // CPU_FEATURE_F16C
+    "avx2",          // CPU_FEATURE_AVX2
+    "bmi",           // CPU_FEATURE_BMI1
+    "bmi2",          // CPU_FEATURE_BMI2
+    "avx512f",       // CPU_FEATURE_AVX512F
+    "avx512bw",      // CPU_FEATURE_AVX512BW
+    "avx512vl",      // CPU_FEATURE_AVX512VL
+    "sha",           // CPU_FEATURE_SHA
+    "rdrnd",         // CPU_FEATURE_RDRAND
+    "rdseed",        // CPU_FEATURE_RDSEED
+    "invariant-tsc", // CPU_FEATURE_INVARIANT_TSC
+};
+
+const char *cpu_feature_name(CPU_FEATURE feature)
+{
+    return feature < CPU_FEATURE_COUNT ? cpu_feature_names[feature] : "unknown";
+}
+
+string CPUFeatures::to_string() const
+{
+    string result;
+    for (int i = 0; i < CPU_FEATURE_COUNT; i++)
+    {
+        if (!has(static_cast<CPU_FEATURE>(i)))
+            continue;
+        if (!result.empty())
+            result += ' ';
+        result += cpu_feature_names[i];
+    }
+    return result;
+}
+
+#ifdef NGWORLD_X86
+// 操作系统允许使用的扩展寄存器状态(XCR0)
+static u64 read_xcr0()
+{
+    unsigned int eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<u64>(edx) << 32) | eax;
+}
+
+static void detect_x86(CPUFeatures &features)
+{
+    unsigned int eax, ebx, ecx, edx, max_leaf, max_extended_leaf;
+    u64 mask = 0;
+
+    if (!__get_cpuid(0, &max_leaf, &ebx, &ecx, &edx))
+        return;
+    char vendor[13];
+    memcpy(vendor, &ebx, 4);
+    memcpy(vendor + 4, &edx, 4);
+    memcpy(vendor + 8, &ecx, 4);
+    vendor[12] = '\0';
+    features.vendor = vendor;
+
+    bool os_avx = false, os_avx512 = false;
+    if (max_leaf >= 1)
+    {
+        __cpuid(1, eax, ebx, ecx, edx);
+        if (edx & (1U << 26)) mask |= cpu_feature_mask(CPU_FEATURE_SSE2);
+        if (ecx & (1U << 0))  mask |= cpu_feature_mask(CPU_FEATURE_SSE3);
+        if (ecx & (1U << 1))  mask |= cpu_feature_mask(CPU_FEATURE_PCLMUL);
+        if (ecx & (1U << 9))  mask |= cpu_feature_mask(CPU_FEATURE_SSSE3);
+        if (ecx & (1U << 19)) mask |= cpu_feature_mask(CPU_FEATURE_SSE41);
+        if (ecx & (1U << 20)) mask |= cpu_feature_mask(CPU_FEATURE_SSE42);
+        if (ecx & (1U << 23)) mask |= cpu_feature_mask(CPU_FEATURE_POPCNT);
+        if (ecx & (1U << 25)) mask |= cpu_feature_mask(CPU_FEATURE_AES);
+        if (ecx & (1U << 30)) mask |= cpu_feature_mask(CPU_FEATURE_RDRAND);
+
+        // AVX的寄存器需要操作系统在上下文切换时保存(OSXSAVE，XCR0的第1、2位)
+        if (ecx & (1U << 27))
+        {
+            u64 xcr0 = read_xcr0();
+            os_avx = (xcr0 & 0x6) == 0x6;
+            os_avx512 = (xcr0 & 0xE6) == 0xE6;
+        }
+        if (os_avx)
+        {
+            if (ecx & (1U << 28)) mask |= cpu_feature_mask(CPU_FEATURE_AVX);
+            if (ecx & (1U << 12)) mask |= cpu_feature_mask(CPU_FEATURE_FMA);
+            if (ecx & (1U << 29)) mask |= cpu_feature_mask(CPU_FEATURE_F16C);
+        }
+    }
+
+    if (max_leaf >= 7)
+    {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if (ebx & (1U << 3))  mask |= cpu_feature_mask(CPU_FEATURE_BMI1);
+        if (ebx & (1U << 8))  mask |= cpu_feature_mask(CPU_FEATURE_BMI2);
+        if (ebx & (1U << 18)) mask |= cpu_feature_mask(CPU_FEATURE_RDSEED);
+        if (ebx & (1U << 29)) mask |= cpu_feature_mask(CPU_FEATURE_SHA);
+        if (os_avx && (ebx & (1U << 5)))
+            mask |= cpu_feature_mask(CPU_FEATURE_AVX2);
+        if (os_avx512)
+        {
+            if (ebx & (1U << 16)) mask |= cpu_feature_mask(CPU_FEATURE_AVX512F);
+            if (ebx & (1U << 30)) mask |= cpu_feature_mask(CPU_FEATURE_AVX512BW);
+            if (ebx & (1U << 31)) mask |= cpu_feature_mask(CPU_FEATURE_AVX512VL);
+        }
+    }
+
+    __cpuid(0x80000000, max_extended_leaf, ebx, ecx, edx);
+    if (max_extended_leaf >= 0x80000007)
+    {
+        __cpuid(0x80000007, eax, ebx, ecx, edx);
+        if (edx & (1U << 8))
+            mask |= cpu_feature_mask(CPU_FEATURE_INVARIANT_TSC);
+    }
+    if (max_extended_leaf >= 0x80000004)
+    {
+        unsigned int brand[12];
+        for (unsigned int i = 0; i < 3; i++)
+            __cpuid(0x80000002 + i, brand[i * 4], brand[i * 4 + 1], brand[i * 4 + 2], brand[i * 4 + 3]);
+        char text[49];
+        memcpy(text, brand, 48);
+        text[48] = '\0';
+        features.brand = text;
+        // 去掉首尾的空格
+        size_t begin = features.brand.find_first_not_of(' ');
+        size_t end = features.brand.find_last_not_of(' ');
+        features.brand = begin == string::npos ? string() : features.brand.substr(begin, end - begin + 1);
+    }
+
+    features.mask = mask;
+}
+#endif
+
+// 处理NGWORLD_CPU_DISABLE，名字之间用逗号分隔，"all"表示全部屏蔽
+static void apply_disable_list(CPUFeatures &features)
+{
+    const char *list = getenv("NGWORLD_CPU_DISABLE");
+    if (list == NULL)
+        return;
+
+    string names(list);
+    size_t begin = 0;
+    while (begin <= names.size())
+    {
+        size_t end = names.find(',', begin);
+        if (end == string::npos)
+            end = names.size();
+        string name = names.substr(begin, end - begin);
+        if (name == "all")
+            features.mask = 0;
+        for (int i = 0; i < CPU_FEATURE_COUNT; i++)
+            if (name == cpu_feature_names[i])
+                features.mask &= ~cpu_feature_mask(static_cast<CPU_FEATURE>(i));
+        begin = end + 1;
+    }
+}
+
+static CPUFeatures detect_cpu_features()
+{
+    CPUFeatures features;
+    features.mask = 0;
+#ifdef NGWORLD_X86
+    detect_x86(features);
+#endif
+    apply_disable_list(features);
+    return features;
+}
+
+const CPUFeatures &cpu_features()
+{
+    static const CPUFeatures features = detect_cpu_features();
+    return features;
+}
+
+// 所有已经选择过实现的分派器
+// 分派器是常量初始化的，析构函数比这里的局部静态变量更早注册，退出时反而更晚执行，
+// 所以列表和锁都故意不释放，保证分派器析构时它们仍然有效
+static mutex &dispatch_registry_mutex()
+{
+    static mutex *registry_mutex = new mutex;
+    return *registry_mutex;
+}
+
+static vector<CPUDispatchBase*> &dispatch_registry()
+{
+    static vector<CPUDispatchBase*> *registry = new vector<CPUDispatchBase*>;
+    return *registry;
+}
+
+void CPUDispatchBase::register_dispatch()
+{
+    lock_guard<mutex> guard(dispatch_registry_mutex());
+    if (m_registered)
+        return;
+    dispatch_registry().push_back(this);
+    m_registered = true;
+}
+
+CPUDispatchBase::~CPUDispatchBase()
+{
+    lock_guard<mutex> guard(dispatch_registry_mutex());
+    if (!m_registered)
+        return;
+    vector<CPUDispatchBase*> &registry = dispatch_registry();
+    for (size_t i = 0; i < registry.size(); i++)
+    {
+        if (registry[i] == this)
+        {
+            registry.erase(registry.begin() + i);
+            break;
+        }
+    }
+}
+
+string cpu_dispatch_report()
+{
+    string result;
+    lock_guard<mutex> guard(dispatch_registry_mutex());
+    vector<CPUDispatchBase*> &registry = dispatch_registry();
+    for (size_t i = 0; i < registry.size(); i++)
+    {
+        if (!result.empty())
+            result += ' ';
+        result += registry[i]->name();
+        result += '=';
+        result += registry[i]->selected_name();
+    }
+    return result;
+}
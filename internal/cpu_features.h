@@ -0,0 +1,204 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * 文件名: cpu_features.h
+ * 作用: 运行时CPU特性检测，以及按特性选择函数实现的分派机制
+ *
+ * 同一个二进制文件可以在新CPU上使用AVX2等指令，在旧CPU上退回通用实现。
+ * 各个实现用__attribute__((target("avx2")))单独编译，不需要给整个程序加-mavx2。
+ * 例如
+ *     __attribute__((target("avx2"))) static void kernel_avx2(float *p, size_t n);
+ *     static void kernel_generic(float *p, size_t n);
+ *
+ *     typedef void (*KernelFunction)(float*, size_t);
+ *     static const CPUDispatchVariant<KernelFunction> kernel_variants[] =
+ *     {
+ *         { "avx2", cpu_feature_mask(CPU_FEATURE_AVX2), kernel_avx2 },
+ *         { "generic", 0, kernel_generic },
+ *     };
+ *     static CPUDispatch<KernelFunction> kernel("kernel", kernel_variants, 2);
+ *
+ *     kernel.get()(p, n);
+ *
+ * 变体按优先顺序排列，第一个所需特性全部满足的被选中，最后一个必须不需要任何特性。
+ * 每个分派器在第一次调用get()或select()时选择一次，之后不再改变。
+ * 分派器的构造函数是constexpr，静态的分派器在任何代码运行之前就已经初始化，
+ * 所以在其他文件的静态初始化过程中也可以调用。
+ * 环境变量NGWORLD_CPU_DISABLE可以屏蔽特性用于测试，例如NGWORLD_CPU_DISABLE=avx2,sse4.2
+ */
+
+#ifndef _CPU_FEATURES_H_
+#define _CPU_FEATURES_H_
+
+#include <atomic>
+#include <string>
+#include <cstddef>
+#include "fundamental_types.h"
+
+#if (defined __GNUC__) && (defined __i386__ || defined __x86_64__)
+// x86平台，可以使用CPUID和__attribute__((target))
+#define NGWORLD_X86
+#endif
+
+enum CPU_FEATURE
+{
+    CPU_FEATURE_SSE2,
+    CPU_FEATURE_SSE3,
+    CPU_FEATURE_SSSE3,
+    CPU_FEATURE_SSE41,
+    CPU_FEATURE_SSE42,
+    CPU_FEATURE_POPCNT,
+    CPU_FEATURE_AES,
+    CPU_FEATURE_PCLMUL,
+    CPU_FEATURE_AVX,
+    CPU_FEATURE_FMA,
+    CPU_FEATURE_F16C,
+    CPU_FEATURE_AVX2,
+    CPU_FEATURE_BMI1,
+    CPU_FEATURE_BMI2,
+    CPU_FEATURE_AVX512F,
+    CPU_FEATURE_AVX512BW,
+    CPU_FEATURE_AVX512VL,
+    CPU_FEATURE_SHA,
+    CPU_FEATURE_RDRAND,
+    CPU_FEATURE_RDSEED,
+    CPU_FEATURE_INVARIANT_TSC,
+
+    CPU_FEATURE_COUNT
+};
+
+constexpr u64 cpu_feature_mask(CPU_FEATURE feature)
+{
+    return 1ULL << feature;
+}
+
+// 特性名，与GCC的target属性一致，例如"avx2"、"sse4.2"
+const char *cpu_feature_name(CPU_FEATURE feature);
+
+// 检测结果。AVX和AVX-512还要求操作系统会保存对应的寄存器(XGETBV)
+struct CPUFeatures
+{
+    u64 mask;            // 可用特性的位集合
+    std::string vendor;  // 例如"GenuineIntel"
+    std::string brand;   // 例如"Intel(R) Xeon(R) ..."
+
+    bool has(CPU_FEATURE feature) const { return (mask & cpu_feature_mask(feature)) != 0; }
+    bool has_all(u64 required) const { return (mask & required) == required; }
+    // 可用特性名，以空格分隔
+    std::string to_string() const;
+};
+
+// 第一次调用时检测，之后返回同一个对象
+const CPUFeatures &cpu_features();
+
+inline bool cpu_has(CPU_FEATURE feature)
+{
+    return cpu_features().has(feature);
+}
+
+template <typename Function>
+struct CPUDispatchVariant
+{
+    const char *name;
+    u64 required; // 所需特性的位集合，由cpu_feature_mask()组合
+    Function function;
+};
+
+// 所有分派器的公共部分，用于统一选择和报告
+class CPUDispatchBase
+{
+private:
+    const char *m_name;
+    bool m_registered; // 是否已经加入全局列表，由列表的锁保护
+
+protected:
+    std::atomic<int> m_selected; // 选中的变体下标，-1表示尚未选择
+
+    // constexpr构造，分派器是常量初始化的，其他文件的静态初始化中也可以使用
+    constexpr CPUDispatchBase(const char *name) : m_name(name), m_registered(false), m_selected(-1) { }
+    virtual ~CPUDispatchBase();
+
+    // 第一次选择时加入全局列表，供cpu_dispatch_report()使用
+    void register_dispatch();
+
+public:
+    const char *name() const { return m_name; }
+    virtual void select() = 0;
+    virtual const char *selected_name() = 0;
+};
+
+template <typename Function>
+class CPUDispatch : public CPUDispatchBase
+{
+private:
+    const CPUDispatchVariant<Function> *m_variants;
+    int m_count;
+
+public:
+    // variants必须在分派器的整个生命周期内有效，通常是静态数组
+    constexpr CPUDispatch(const char *name, const CPUDispatchVariant<Function> *variants, int count)
+        : CPUDispatchBase(name), m_variants(variants), m_count(count)
+    {
+    }
+
+    void select()
+    {
+        if (m_selected.load(std::memory_order_acquire) >= 0)
+            return;
+        const CPUFeatures &features = cpu_features();
+        int chosen = m_count - 1;
+        for (int i = 0; i < m_count; i++)
+        {
+            if (features.has_all(m_variants[i].required))
+            {
+                chosen = i;
+                break;
+            }
+        }
+        // 多个线程同时选择时结果相同，谁先写入都可以
+        m_selected.store(chosen, std::memory_order_release);
+        // 必须在写入结果之后加入列表: cpu_dispatch_report()持有列表的锁调用selected_name()，
+        // 列表中的分派器如果还没有结果，就会再次进入这里对同一个锁加锁
+        register_dispatch();
+    }
+
+    Function get()
+    {
+        int selected = m_selected.load(std::memory_order_acquire);
+        if (selected < 0)
+        {
+            select();
+            selected = m_selected.load(std::memory_order_acquire);
+        }
+        return m_variants[selected].function;
+    }
+
+    const char *selected_name()
+    {
+        get();
+        return m_variants[m_selected.load(std::memory_order_acquire)].name;
+    }
+};
+
+// 返回已经使用过的分派器的选择结果，例如"mt19937_twist=avx2 ..."，可以写入日志
+// 分派器在第一次调用get()或select()时才加入列表；需要避免第一次调用的延迟时，
+// 在启动时对它调用select()
+std::string cpu_dispatch_report();
+
+#endif
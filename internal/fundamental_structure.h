@@ -20,6 +20,7 @@
 #define _FUNDAMENTAL_STRUCTURE_H_
 
 #include <cmath>
+#include <type_traits>
 #include "fundamental_algorithm.h"
 
 template <typename T = int>
@@ -27,36 +28,37 @@ class Vector3D
 {
 public:
     T x, y, z;
-    Vector3D<T>() : x(), y(), z() { }
-    Vector3D<T>(T _x, T _y, T _z) : x(_x), y(_y), z(_z) { }
-    ~Vector3D<T>() { }
+    // 不提供析构函数和拷贝构造函数，保持平凡可复制(trivially copyable)，
+    // 以便std::vector扩容和序列化时可以直接memcpy
+    constexpr Vector3D<T>() : x(), y(), z() { }
+    constexpr Vector3D<T>(T _x, T _y, T _z) : x(_x), y(_y), z(_z) { }
 
     // 向量和向量相加
-    Vector3D<T> operator + (const Vector3D<T> &arg) const;
+    constexpr Vector3D<T> operator + (const Vector3D<T> &arg) const;
     Vector3D<T>& operator += (const Vector3D<T> &add);
     // 向量和标量相加
-    Vector3D<T> operator + (const T &arg) const;
+    constexpr Vector3D<T> operator + (const T &arg) const;
     Vector3D<T>& operator += (const T &arg);
 
     // 向量和向量相减
-    Vector3D<T> operator - (const Vector3D<T> &arg) const;
+    constexpr Vector3D<T> operator - (const Vector3D<T> &arg) const;
     Vector3D<T>& operator -= (const Vector3D<T> &add);
     // 向量和标量相减
-    Vector3D<T> operator - (const T &arg) const;
+    constexpr Vector3D<T> operator - (const T &arg) const;
     Vector3D<T>& operator -= (const T &arg);
 
     // 点乘
-    T dot(const Vector3D<T> &arg);
+    constexpr T dot(const Vector3D<T> &arg) const;
 
     // 叉乘
-    Vector3D<T> cross(const Vector3D<T> &arg);
+    constexpr Vector3D<T> cross(const Vector3D<T> &arg) const;
 
     // 向量与标量相乘
-    Vector3D<T> operator * (const T &arg) const;
+    constexpr Vector3D<T> operator * (const T &arg) const;
     Vector3D<T>& operator *= (const T &arg);
 
     // 向量与标量相除
-    Vector3D<T> operator / (const T &arg) const;
+    constexpr Vector3D<T> operator / (const T &arg) const;
     Vector3D<T>& operator /= (const T &arg);
 };
 
@@ -65,36 +67,36 @@ class Vector2D
 {
 public:
     T x, y;
-    Vector2D<T>() : x(), y() { }
-    Vector2D<T>(T _x, T _y) : x(_x), y(_y) { }
-    ~Vector2D<T>() { }
+    // 同Vector3D，保持平凡可复制
+    constexpr Vector2D<T>() : x(), y() { }
+    constexpr Vector2D<T>(T _x, T _y) : x(_x), y(_y) { }
 
     // 向量和向量相加
-    Vector2D<T> operator + (const Vector2D<T> &arg) const;
+    constexpr Vector2D<T> operator + (const Vector2D<T> &arg) const;
     Vector2D<T>& operator += (const Vector2D<T> &add);
     // 向量和标量相加
-    Vector2D<T> operator + (const T &arg) const;
+    constexpr Vector2D<T> operator + (const T &arg) const;
     Vector2D<T>& operator += (const T &arg);
 
     // 向量和向量相减
-    Vector2D<T> operator - (const Vector2D<T> &arg) const;
+    constexpr Vector2D<T> operator - (const Vector2D<T> &arg) const;
     Vector2D<T>& operator -= (const Vector2D<T> &add);
     // 向量和标量相减
-    Vector2D<T> operator - (const T &arg) const;
+    constexpr Vector2D<T> operator - (const T &arg) const;
     Vector2D<T>& operator -= (const T &arg);
 
     // 点乘
-    T dot(const Vector2D<T> &arg);
+    constexpr T dot(const Vector2D<T> &arg) const;
 
     // 叉乘 [注意:得到一个三维的向量]
-    Vector3D<T> cross(const Vector2D<T> &arg);
+    constexpr Vector3D<T> cross(const Vector2D<T> &arg) const;
 
     // 向量与标量相乘
-    Vector2D<T> operator * (const T &arg) const;
+    constexpr Vector2D<T> operator * (const T &arg) const;
     Vector2D<T>& operator *= (const T &arg);
 
     // 向量与标量相除
-    Vector2D<T> operator / (const T &arg) const;
+    constexpr Vector2D<T> operator / (const T &arg) const;
     Vector2D<T>& operator /= (const T &arg);
 
     // 将向量沿着逆时针方向旋转angle(弧度制)度
@@ -102,7 +104,7 @@ public:
 };
 
 template<typename T>
-Vector3D<T> Vector3D<T>::operator + (const Vector3D<T> &arg) const
+constexpr Vector3D<T> Vector3D<T>::operator + (const Vector3D<T> &arg) const
 {
     return Vector3D<T>(x + arg.x, y + arg.y, z + arg.z);
 }
@@ -117,7 +119,7 @@ Vector3D<T>& Vector3D<T>::operator += (const Vector3D<T> &arg)
 }
 
 template<typename T>
-Vector3D<T> Vector3D<T>::operator + (const T &arg) const
+constexpr Vector3D<T> Vector3D<T>::operator + (const T &arg) const
 {
     return Vector3D<T>(x + arg, y + arg, z + arg);
 }
@@ -132,7 +134,7 @@ Vector3D<T>& Vector3D<T>::operator += (const T &arg)
 }
 
 template<typename T>
-Vector3D<T> Vector3D<T>::operator - (const Vector3D<T> &arg) const
+constexpr Vector3D<T> Vector3D<T>::operator - (const Vector3D<T> &arg) const
 {
     return Vector3D<T>(x - arg.x, y - arg.y, z - arg.z);
 }
@@ -147,7 +149,7 @@ Vector3D<T>& Vector3D<T>::operator -= (const Vector3D<T> &arg)
 }
 
 template<typename T>
-Vector3D<T> Vector3D<T>::operator - (const T &arg) const
+constexpr Vector3D<T> Vector3D<T>::operator - (const T &arg) const
 {
     return Vector3D<T>(x - arg, y - arg, z - arg);
 }
@@ -162,21 +164,21 @@ Vector3D<T>& Vector3D<T>::operator -= (const T &arg)
 }
 
 template<typename T>
-T Vector3D<T>::dot(const Vector3D<T> &arg)
+constexpr T Vector3D<T>::dot(const Vector3D<T> &arg) const
 {
     return x * arg.x + y * arg.y + z * arg.z;
 }
 
 template<typename T>
-Vector3D<T> Vector3D<T>::cross(const Vector3D<T> &arg)
+constexpr Vector3D<T> Vector3D<T>::cross(const Vector3D<T> &arg) const
 {
-    return Vector3D(y * arg.z - z * arg.y,
-                    z * arg.x - x * arg.z,
-                    x * arg.y - y * arg.x);
+    return Vector3D<T>(y * arg.z - z * arg.y,
+                       z * arg.x - x * arg.z,
+                       x * arg.y - y * arg.x);
 }
 
 template<typename T>
-Vector3D<T> Vector3D<T>::operator * (const T &arg) const
+constexpr Vector3D<T> Vector3D<T>::operator * (const T &arg) const
 {
     return Vector3D<T>(x * arg, y * arg, z * arg);
 }
@@ -191,7 +193,7 @@ Vector3D<T>& Vector3D<T>::operator *= (const T &arg)
 }
 
 template<typename T>
-Vector3D<T> Vector3D<T>::operator / (const T &arg) const
+constexpr Vector3D<T> Vector3D<T>::operator / (const T &arg) const
 {
     return Vector3D<T>(x / arg, y / arg, z / arg);
 }
@@ -206,7 +208,7 @@ Vector3D<T>& Vector3D<T>::operator /= (const T &arg)
 }
 
 template<typename T>
-Vector2D<T> Vector2D<T>::operator + (const Vector2D<T> &arg) const
+constexpr Vector2D<T> Vector2D<T>::operator + (const Vector2D<T> &arg) const
 {
     return Vector2D<T>(x + arg.x, y + arg.y);
 }
@@ -220,7 +222,7 @@ Vector2D<T>& Vector2D<T>::operator += (const Vector2D<T> &arg)
 }
 
 template<typename T>
-Vector2D<T> Vector2D<T>::operator + (const T &arg) const
+constexpr Vector2D<T> Vector2D<T>::operator + (const T &arg) const
 {
     return Vector2D<T>(x + arg, y + arg);
 }
@@ -234,7 +236,7 @@ Vector2D<T>& Vector2D<T>::operator += (const T &arg)
 }
 
 template<typename T>
-Vector2D<T> Vector2D<T>::operator - (const Vector2D<T> &arg) const
+constexpr Vector2D<T> Vector2D<T>::operator - (const Vector2D<T> &arg) const
 {
     return Vector2D<T>(x - arg.x, y - arg.y);
 }
@@ -248,7 +250,7 @@ Vector2D<T>& Vector2D<T>::operator -= (const Vector2D<T> &arg)
 }
 
 template<typename T>
-Vector2D<T> Vector2D<T>::operator - (const T &arg) const
+constexpr Vector2D<T> Vector2D<T>::operator - (const T &arg) const
 {
     return Vector2D<T>(x - arg, y - arg);
 }
@@ -262,19 +264,19 @@ Vector2D<T>& Vector2D<T>::operator -= (const T &arg)
 }
 
 template<typename T>
-T Vector2D<T>::dot(const Vector2D<T> &arg)
+constexpr T Vector2D<T>::dot(const Vector2D<T> &arg) const
 {
     return x * arg.x + y * arg.y;
 }
 
 template<typename T>
-Vector3D<T> Vector2D<T>::cross(const Vector2D<T> &arg)
+constexpr Vector3D<T> Vector2D<T>::cross(const Vector2D<T> &arg) const
 {
     return Vector3D<T>(0, 0, x * arg.y - arg.x * y);
 }
 
 template<typename T>
-Vector2D<T> Vector2D<T>::operator * (const T &arg) const
+constexpr Vector2D<T> Vector2D<T>::operator * (const T &arg) const
 {
     return Vector2D<T>(x * arg, y * arg);
 }
@@ -288,7 +290,7 @@ Vector2D<T>& Vector2D<T>::operator *= (const T &arg)
 }
 
 template<typename T>
-Vector2D<T> Vector2D<T>::operator / (const T &arg) const
+constexpr Vector2D<T> Vector2D<T>::operator / (const T &arg) const
 {
     return Vector2D<T>(x / arg, y / arg);
 }
@@ -326,6 +328,12 @@ typedef Vector3D<s64> v3s64;
 typedef Vector3D<float> v3f;
 typedef Vector3D<double> v3d;
 
+// 向量会被大量存放在std::vector中并直接写入网络包/存档，必须保持平凡可复制
+static_assert(std::is_trivially_copyable<v2s32>::value, "Vector2D must be trivially copyable");
+static_assert(std::is_trivially_copyable<v3s32>::value, "Vector3D must be trivially copyable");
+static_assert(std::is_trivially_destructible<v3d>::value, "Vector3D must be trivially destructible");
+static_assert(sizeof(v3s32) == 3 * sizeof(s32), "Vector3D must not contain padding");
+
 // 按照x-y的顺序比较二维向量
 template <typename T>
 bool compare_vector_2d(const Vector2D<T> &left, const Vector2D<T> &right);
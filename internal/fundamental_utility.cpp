@@ -17,15 +17,36 @@
  */
 
 #include "fundamental_utility.h"
+#include "cpu_features.h"
+#include "metrics.h"
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+
+#ifdef NGWORLD_X86
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
 
 #ifdef NGWORLD_OS_UNIX
 // include UNIX头文件
 #include <unistd.h>
+#include <time.h>
+#include <errno.h>
 #elif NGWORLD_OS_WINDOWS
 // include Windows头文件
 #error NGWorld support for Windows platform is not implemented yet.
 #endif
 
+#ifdef NGWORLD_OS_LINUX
+// include Linux头文件，用于线程亲和性和NUMA
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
 void OSLayer::sleep_us(const int &us)
 {
 #ifdef NGWORLD_OS_UNIX
@@ -53,3 +74,497 @@ void OSLayer::sleep_s(const int &s)
 #endif
 }
 
+
+u64 OSLayer::now_ns()
+{
+#ifdef NGWORLD_OS_UNIX
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<u64>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+#elif NGWORLD_OS_WINDOWS
+#error NGWorld support for Windows platform is not implemented yet.
+#endif
+}
+
+u64 OSLayer::coarse_ns()
+{
+#ifdef NGWORLD_OS_LINUX
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<u64>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+#else
+    return now_ns();
+#endif
+}
+
+#ifdef NGWORLD_X86
+// TSC校准状态: 以(tsc_base, ns_base)为原点，经过calibration_ns后求出每个tick的纳秒数
+static const u64 tsc_calibration_ns = 100000000ULL;
+
+struct TSCClock
+{
+    bool invariant;
+    u64 tsc_base, ns_base;
+    std::atomic<double> ns_per_tick; // 为0表示还没有校准完成
+
+    TSCClock() : ns_per_tick(0)
+    {
+        invariant = cpu_has(CPU_FEATURE_INVARIANT_TSC);
+        ns_base = OSLayer::now_ns();
+        tsc_base = __rdtsc();
+    }
+};
+
+u64 OSLayer::fast_ns()
+{
+    static TSCClock clock;
+    if (!clock.invariant)
+        return now_ns();
+
+    double scale = clock.ns_per_tick.load(std::memory_order_relaxed);
+    if (scale > 0)
+        return clock.ns_base + static_cast<u64>((__rdtsc() - clock.tsc_base) * scale);
+
+    // 还在校准
+    u64 tsc = __rdtsc(), ns = now_ns();
+    if (ns - clock.ns_base >= tsc_calibration_ns && tsc > clock.tsc_base)
+        clock.ns_per_tick.store(static_cast<double>(ns - clock.ns_base) / (tsc - clock.tsc_base),
+                                std::memory_order_relaxed);
+    return ns;
+}
+#else
+u64 OSLayer::fast_ns()
+{
+    return now_ns();
+}
+#endif
+
+void OSLayer::sleep_until(u64 deadline_ns, u64 spin_ns)
+{
+#ifdef NGWORLD_OS_UNIX
+    u64 wake_ns = deadline_ns > spin_ns ? deadline_ns - spin_ns : 0;
+    struct timespec ts;
+#ifdef NGWORLD_OS_LINUX
+    if (now_ns() < wake_ns)
+    {
+        ts.tv_sec = static_cast<time_t>(wake_ns / 1000000000ULL);
+        ts.tv_nsec = static_cast<long>(wake_ns % 1000000000ULL);
+        // 使用绝对时间，被信号中断后用同一个截止时间继续睡眠即可
+        while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+    }
+#else
+    // macOS等系统没有clock_nanosleep，每次按剩余时间相对睡眠，醒来后重新计算，
+    // 被信号中断或者提前醒来时都会继续睡眠
+    u64 now;
+    while ((now = now_ns()) < wake_ns)
+    {
+        ts.tv_sec = static_cast<time_t>((wake_ns - now) / 1000000000ULL);
+        ts.tv_nsec = static_cast<long>((wake_ns - now) % 1000000000ULL);
+        ::nanosleep(&ts, NULL);
+    }
+#endif
+    while (spin_ns > 0 && now_ns() < deadline_ns)
+        OSLayer::cpu_relax();
+#elif NGWORLD_OS_WINDOWS
+#error NGWorld support for Windows platform is not implemented yet.
+#endif
+}
+
+// 所有FixedTimestepLoop共用的指标
+static MetricHistogram *tick_busy_ns = metrics().histogram("tick.busy_ns");
+static MetricCounter *tick_missed = metrics().counter("tick.missed");
+
+FixedTimestepLoop::FixedTimestepLoop(u64 period_ns, u64 spin_ns)
+{
+    m_period_ns = period_ns > 0 ? period_ns : 1;
+    m_spin_ns = spin_ns;
+    m_next_tick = 0;
+    m_tick_count = 0;
+    m_missed_ticks = 0;
+    m_tick_started = 0;
+}
+
+u64 FixedTimestepLoop::wait_next()
+{
+    u64 now = OSLayer::now_ns(), missed = m_missed_ticks;
+    if (m_tick_count == 0)
+        m_next_tick = now;
+    else
+        tick_busy_ns->record(now - m_tick_started);
+
+    if (m_tick_count > 0 && now >= m_next_tick + m_period_ns)
+    {
+        // 落后超过一个周期，跳过错过的tick，对齐到下一个周期
+        u64 behind = (now - m_next_tick) / m_period_ns;
+        m_missed_ticks += behind;
+        m_next_tick += behind * m_period_ns;
+        if (m_next_tick < now)
+        {
+            m_next_tick += m_period_ns;
+            m_missed_ticks++;
+        }
+        tick_missed->add(m_missed_ticks - missed);
+    }
+
+    OSLayer::sleep_until(m_next_tick, m_spin_ns);
+    m_tick_started = OSLayer::now_ns();
+    u64 tick = m_next_tick;
+    m_next_tick += m_period_ns;
+    m_tick_count++;
+    return tick;
+}
+
+// 读取/sys中的小文件，去掉末尾的换行
+static bool read_sys_file(const std::string &path, std::string &content)
+{
+    std::ifstream fin(path.c_str());
+    if (!fin)
+        return false;
+    std::getline(fin, content);
+    return true;
+}
+
+static int read_sys_int(const std::string &path, int default_value)
+{
+    std::string content;
+    if (!read_sys_file(path, content) || content.empty())
+        return default_value;
+    return atoi(content.c_str());
+}
+
+std::vector<int> CPUTopology::parse_id_list(const std::string &list)
+{
+    std::vector<int> ids;
+    const char *p = list.c_str();
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long id = first; id <= last; id++)
+            ids.push_back(static_cast<int>(id));
+        if (*p == ',')
+            ++p;
+    }
+    return ids;
+}
+
+// 解析"32K"、"8M"格式的缓存大小
+static u32 parse_cache_size(const std::string &size)
+{
+    char *end;
+    unsigned long value = strtoul(size.c_str(), &end, 10);
+    if (*end == 'K')
+        value <<= 10;
+    else if (*end == 'M')
+        value <<= 20;
+    else if (*end == 'G')
+        value <<= 30;
+    return static_cast<u32>(value);
+}
+
+#ifdef NGWORLD_X86
+// 读取确定性缓存参数(Intel为leaf 4，AMD为leaf 0x8000001D，两者格式相同)，返回找到的缓存数
+static int read_cache_leaf(unsigned int leaf, CPUTopology &topology)
+{
+    unsigned int eax, ebx, ecx, edx;
+    int found = 0;
+    for (unsigned int index = 0; index < 16; index++)
+    {
+        __cpuid_count(leaf, index, eax, ebx, ecx, edx);
+        unsigned int type = eax & 0x1F;
+        if (type == 0)
+            break;
+        CPUCacheInfo cache;
+        cache.level = (eax >> 5) & 0x7;
+        cache.type = type == 1 ? 'D' : (type == 2 ? 'I' : 'U');
+        cache.line_size = (ebx & 0xFFF) + 1;
+        cache.size = (((ebx >> 22) & 0x3FF) + 1) * (((ebx >> 12) & 0x3FF) + 1) * cache.line_size * (ecx + 1);
+        topology.caches.push_back(cache);
+        ++found;
+    }
+    return found;
+}
+
+static void detect_caches_cpuid(CPUTopology &topology)
+{
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int max_leaf = 0, max_extended_leaf = 0;
+    if (__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+        max_leaf = eax;
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx))
+        max_extended_leaf = eax;
+
+    // 较新的AMD CPU的最大基本leaf也不小于4，但leaf 4全部返回0，要按厂商选择
+    const std::string &vendor = cpu_features().vendor;
+    bool amd = vendor == "AuthenticAMD" || vendor == "HygonGenuine";
+    bool has_amd_leaf = max_extended_leaf >= 0x8000001D;
+
+    int found = 0;
+    if (amd && has_amd_leaf)
+        found = read_cache_leaf(0x8000001D, topology);
+    if (found == 0 && max_leaf >= 4)
+        found = read_cache_leaf(4, topology);
+    // 厂商未知时leaf 4可能没有内容，再试一次AMD的leaf
+    if (found == 0 && !amd && has_amd_leaf)
+        read_cache_leaf(0x8000001D, topology);
+
+    if (topology.cache_line_size == 0 && __get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        topology.cache_line_size = ((ebx >> 8) & 0xFF) * 8;
+}
+#endif
+
+static CPUTopology detect_cpu_topology()
+{
+    const std::string cpu_root = "/sys/devices/system/cpu/";
+    std::string content;
+    CPUTopology topology;
+
+    topology.cache_line_size = 0;
+    std::vector<int> online;
+    if (read_sys_file(cpu_root + "online", content))
+        online = CPUTopology::parse_id_list(content);
+#ifdef NGWORLD_OS_UNIX
+    if (online.empty())
+    {
+        long count = ::sysconf(_SC_NPROCESSORS_ONLN);
+        for (long i = 0; i < count; i++)
+            online.push_back(static_cast<int>(i));
+    }
+#endif
+    if (online.empty())
+        online.push_back(0);
+
+    for (size_t i = 0; i < online.size(); i++)
+    {
+        std::string topology_dir = cpu_root + "cpu" + std::to_string(online[i]) + "/topology/";
+        LogicalCPUInfo cpu;
+        cpu.id = online[i];
+        cpu.core_id = read_sys_int(topology_dir + "core_id", cpu.id);
+        cpu.package_id = read_sys_int(topology_dir + "physical_package_id", 0);
+        cpu.numa_node = 0;
+        topology.cpus.push_back(cpu);
+    }
+
+    // NUMA节点，没有/sys/devices/system/node时视为只有一个节点
+    std::vector<int> nodes;
+    if (read_sys_file("/sys/devices/system/node/online", content))
+        nodes = CPUTopology::parse_id_list(content);
+    topology.numa_node_count = nodes.empty() ? 1 : static_cast<int>(nodes.size());
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+        if (!read_sys_file("/sys/devices/system/node/node" + std::to_string(nodes[n]) + "/cpulist", content))
+            continue;
+        std::vector<int> cpus = CPUTopology::parse_id_list(content);
+        for (size_t i = 0; i < topology.cpus.size(); i++)
+            if (std::find(cpus.begin(), cpus.end(), topology.cpus[i].id) != cpus.end())
+                topology.cpus[i].numa_node = nodes[n];
+    }
+
+    // 物理核心由(package, core)唯一确定
+    std::vector<std::pair<int, int> > cores;
+    std::vector<int> packages;
+    for (size_t i = 0; i < topology.cpus.size(); i++)
+    {
+        cores.push_back(std::make_pair(topology.cpus[i].package_id, topology.cpus[i].core_id));
+        packages.push_back(topology.cpus[i].package_id);
+    }
+    std::sort(cores.begin(), cores.end());
+    std::sort(packages.begin(), packages.end());
+    topology.core_count = static_cast<int>(std::unique(cores.begin(), cores.end()) - cores.begin());
+    topology.package_count = static_cast<int>(std::unique(packages.begin(), packages.end()) - packages.begin());
+
+    // 缓存
+    std::string cache_root = cpu_root + "cpu" + std::to_string(topology.cpus[0].id) + "/cache/";
+    for (int index = 0; read_sys_file(cache_root + "index" + std::to_string(index) + "/level", content); index++)
+    {
+        std::string cache_dir = cache_root + "index" + std::to_string(index) + "/";
+        CPUCacheInfo cache;
+        cache.level = atoi(content.c_str());
+        if (!read_sys_file(cache_dir + "type", content))
+            continue;
+        cache.type = content == "Data" ? 'D' : (content == "Instruction" ? 'I' : 'U');
+        cache.size = read_sys_file(cache_dir + "size", content) ? parse_cache_size(content) : 0;
+        cache.line_size = static_cast<u32>(read_sys_int(cache_dir + "coherency_line_size", 0));
+        if (read_sys_file(cache_dir + "shared_cpu_list", content))
+            cache.shared_cpus = CPUTopology::parse_id_list(content);
+        topology.caches.push_back(cache);
+        if (topology.cache_line_size == 0)
+            topology.cache_line_size = cache.line_size;
+    }
+#ifdef NGWORLD_X86
+    if (topology.caches.empty())
+        detect_caches_cpuid(topology);
+#endif
+    if (topology.cache_line_size == 0)
+        topology.cache_line_size = 64;
+    return topology;
+}
+
+std::vector<int> CPUTopology::cpus_of_node(int node) const
+{
+    std::vector<int> result;
+    for (size_t i = 0; i < cpus.size(); i++)
+        if (cpus[i].numa_node == node)
+            result.push_back(cpus[i].id);
+    return result;
+}
+
+std::vector<int> CPUTopology::spread_cpus(unsigned int count) const
+{
+    // 每个节点内按"核心内的第几个超线程"排序，先用完每个核心的第一个超线程
+    std::vector<std::vector<int> > node_order;
+    std::vector<int> node_ids;
+    for (size_t i = 0; i < cpus.size(); i++)
+        if (std::find(node_ids.begin(), node_ids.end(), cpus[i].numa_node) == node_ids.end())
+            node_ids.push_back(cpus[i].numa_node);
+    std::sort(node_ids.begin(), node_ids.end());
+
+    for (size_t n = 0; n < node_ids.size(); n++)
+    {
+        std::vector<std::pair<int, int> > ranked; // (超线程序号, CPU编号)
+        for (size_t i = 0; i < cpus.size(); i++)
+        {
+            if (cpus[i].numa_node != node_ids[n])
+                continue;
+            int sibling = 0;
+            for (size_t j = 0; j < i; j++)
+                if (cpus[j].package_id == cpus[i].package_id && cpus[j].core_id == cpus[i].core_id)
+                    sibling++;
+            ranked.push_back(std::make_pair(sibling, cpus[i].id));
+        }
+        std::sort(ranked.begin(), ranked.end());
+        std::vector<int> order;
+        for (size_t i = 0; i < ranked.size(); i++)
+            order.push_back(ranked[i].second);
+        node_order.push_back(order);
+    }
+
+    // 在节点之间轮流取
+    std::vector<int> interleaved;
+    for (size_t round = 0; interleaved.size() < cpus.size(); round++)
+        for (size_t n = 0; n < node_order.size(); n++)
+            if (round < node_order[n].size())
+                interleaved.push_back(node_order[n][round]);
+
+    std::vector<int> result;
+    for (unsigned int i = 0; i < count && !interleaved.empty(); i++)
+        result.push_back(interleaved[i % interleaved.size()]);
+    return result;
+}
+
+const CPUTopology &OSLayer::cpu_topology()
+{
+    static const CPUTopology topology = detect_cpu_topology();
+    return topology;
+}
+
+bool OSLayer::set_thread_affinity(const std::vector<int> &cpus)
+{
+#ifdef NGWORLD_OS_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < cpus.size(); i++)
+        if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE)
+            CPU_SET(cpus[i], &set);
+    // pid为0表示调用的线程
+    return !cpus.empty() && ::sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+bool OSLayer::set_thread_affinity(int cpu)
+{
+    return set_thread_affinity(std::vector<int>(1, cpu));
+}
+
+bool OSLayer::set_thread_numa_node(int node)
+{
+    return set_thread_affinity(cpu_topology().cpus_of_node(node));
+}
+
+int OSLayer::current_cpu()
+{
+#ifdef NGWORLD_OS_LINUX
+    return ::sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+int OSLayer::current_numa_node()
+{
+    int cpu = current_cpu();
+    const CPUTopology &topology = cpu_topology();
+    for (size_t i = 0; i < topology.cpus.size(); i++)
+        if (topology.cpus[i].id == cpu)
+            return topology.cpus[i].numa_node;
+    return -1;
+}
+
+bool OSLayer::bind_memory_to_node(void *address, size_t size, int node)
+{
+#ifdef NGWORLD_OS_LINUX
+    // 节点掩码，最多支持1024个节点
+    const int mask_bits = 1024;
+    const int bits_per_word = static_cast<int>(sizeof(unsigned long) * 8);
+    unsigned long mask[mask_bits / (sizeof(unsigned long) * 8)] = { 0 };
+    if (node < 0 || node >= mask_bits)
+        return false;
+    mask[node / bits_per_word] |= 1UL << (node % bits_per_word);
+    // 内核会把maxnode减1，所以多传一位
+    return ::syscall(SYS_mbind, address, size, MPOL_BIND, mask, mask_bits + 1, MPOL_MF_MOVE) == 0;
+#else
+    (void)address;
+    (void)size;
+    (void)node;
+    return false;
+#endif
+}
+
+int OSLayer::numa_node_of_address(const void *address)
+{
+#ifdef NGWORLD_OS_LINUX
+    int node = -1;
+    if (::syscall(SYS_get_mempolicy, &node, NULL, 0, address, MPOL_F_NODE | MPOL_F_ADDR) != 0)
+        return -1;
+    return node;
+#else
+    (void)address;
+    return -1;
+#endif
+}
+
+void *OSLayer::aligned_malloc(size_t size, size_t alignment)
+{
+#ifdef NGWORLD_OS_UNIX
+    void *pointer = NULL;
+    if (alignment < sizeof(void*))
+        alignment = sizeof(void*);
+    if (::posix_memalign(&pointer, alignment, size) != 0)
+        return NULL;
+    return pointer;
+#elif NGWORLD_OS_WINDOWS
+#error NGWorld support for Windows platform is not implemented yet.
+#endif
+}
+
+void OSLayer::aligned_free(void *pointer)
+{
+#ifdef NGWORLD_OS_UNIX
+    ::free(pointer);
+#elif NGWORLD_OS_WINDOWS
+#error NGWorld support for Windows platform is not implemented yet.
+#endif
+}
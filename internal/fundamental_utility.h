@@ -20,12 +20,144 @@
 #define _FUNDAMENTAL_UTILITY_H_
 
 #include "fundamental_macros.h"
+#include "fundamental_types.h"
+#include <string>
+#include <vector>
+#include <cstddef>
+
+struct CPUCacheInfo
+{
+    int level;                    // 1, 2, 3...
+    char type;                    // 'D'数据, 'I'指令, 'U'统一
+    u32 size;                     // 字节数
+    u32 line_size;
+    std::vector<int> shared_cpus; // 共享这个缓存的逻辑CPU，未知时为空
+};
+
+struct LogicalCPUInfo
+{
+    int id;
+    int core_id;    // 物理核心在所属package中的编号
+    int package_id;
+    int numa_node;
+};
+
+// CPU拓扑，来自/sys/devices/system/cpu和/sys/devices/system/node，
+// 读不到缓存信息时使用CPUID
+struct CPUTopology
+{
+    std::vector<LogicalCPUInfo> cpus;  // 在线的逻辑CPU，按编号排序
+    std::vector<CPUCacheInfo> caches;  // 第一个CPU能看到的各级缓存
+    int package_count;
+    int core_count;                    // 物理核心总数
+    int numa_node_count;
+    u32 cache_line_size;
+
+    std::vector<int> cpus_of_node(int node) const;
+
+    // 为count个工作线程选择CPU，第i个线程使用返回值的第i项:
+    // 在NUMA节点之间轮流分配，同一节点内先占满不同的物理核心再使用超线程，
+    // count超过CPU数时从头循环
+    std::vector<int> spread_cpus(unsigned int count) const;
+
+    // 解析/sys中"0-3,8,10-11"格式的CPU或节点列表，遇到无法解析的内容时停止
+    static std::vector<int> parse_id_list(const std::string &list);
+};
 
 namespace OSLayer
 {
     void sleep_us(const int &us);
     void sleep_ms(const int &ms);
     void sleep_s(const int &s);
+
+    // 单调时钟(CLOCK_MONOTONIC)，单位纳秒，起点不确定，不受系统时间调整的影响
+    u64 now_ns();
+
+    // 更便宜的单调时钟，单位纳秒，与now_ns()的起点相同
+    // 在TSC频率恒定(invariant TSC)的x86 CPU上直接读取TSC，并用now_ns()校准换算比例；
+    // 第一次调用后的100ms内还在校准，期间返回now_ns()
+    // 校准误差会随时间累积，需要与now_ns()比较的截止时间不要用它计算
+    u64 fast_ns();
+
+    // 低精度的单调时钟，单位纳秒，与now_ns()的起点相同，但可能落后几毫秒
+    // Linux上读取CLOCK_MONOTONIC_COARSE，它由内核在时钟中断时更新，读取时只访问vDSO中的内存，
+    // 比fast_ns()更便宜；其他系统上等同于now_ns()
+    u64 coarse_ns();
+
+    // 睡眠到now_ns()达到deadline_ns为止，被信号中断时继续睡眠
+    // Linux上用绝对时间的clock_nanosleep；macOS等没有它的系统按剩余时间循环调用nanosleep
+    // 内核唤醒通常会晚几十微秒，spin_ns不为0时提前spin_ns醒来，剩下的时间忙等，
+    // 以占用CPU为代价换取更准确的唤醒时间
+    void sleep_until(u64 deadline_ns, u64 spin_ns = 0);
+
+    // 第一次调用时检测，之后返回同一个对象
+    const CPUTopology &cpu_topology();
+
+    // 把当前线程限制在给定的逻辑CPU上运行，不支持的系统上返回false
+    bool set_thread_affinity(const std::vector<int> &cpus);
+    bool set_thread_affinity(int cpu);
+    // 把当前线程限制在一个NUMA节点的所有CPU上
+    bool set_thread_numa_node(int node);
+
+    // 当前线程正在运行的逻辑CPU和NUMA节点，未知时返回-1
+    int current_cpu();
+    int current_numa_node();
+
+    // 把[address, address + size)的内存固定在一个NUMA节点上，已经分配的页会被迁移过去
+    // address必须按页对齐。只在Linux上有效
+    bool bind_memory_to_node(void *address, size_t size, int node);
+    // 地址所在的页当前位于哪个NUMA节点(页尚未分配时会先分配)，未知时返回-1
+    int numa_node_of_address(const void *address);
+
+    // 按alignment字节对齐分配内存，失败时返回NULL，必须用aligned_free()释放
+    // C++11的new不保证超过alignof(std::max_align_t)的对齐，按缓存行对齐的对象需要用它分配
+    void *aligned_malloc(size_t size, size_t alignment);
+    void aligned_free(void *pointer);
+
+    // 在忙等循环中调用，降低功耗并让出超线程的执行资源
+    inline void cpu_relax()
+    {
+#if (defined __GNUC__) && (defined __i386__ || defined __x86_64__)
+        __builtin_ia32_pause();
+#endif
+    }
 }
 
+// 固定步长的循环，例如服务器每秒20次的tick
+//     FixedTimestepLoop loop(50000000ULL);
+//     while (running)
+//     {
+//         loop.wait_next();
+//         tick();
+//     }
+// 每个tick的时刻是起点加上周期的整数倍，不会因为每次睡眠的误差而累积漂移。
+// 某次tick耗时太长、落后超过一个周期时，不追赶错过的tick，直接对齐到下一个周期，
+// 并记入missed_ticks()。每个tick的耗时(两次wait_next()之间的时间)记入指标tick.busy_ns，
+// 错过的tick数记入tick.missed。
+class FixedTimestepLoop
+{
+private:
+    u64 m_period_ns;
+    u64 m_spin_ns;
+    u64 m_next_tick;
+    u64 m_tick_count;
+    u64 m_missed_ticks;
+    u64 m_tick_started; // 上一个tick实际开始的时间，用于统计每个tick的耗时
+
+public:
+    // spin_ns的含义同OSLayer::sleep_until()
+    FixedTimestepLoop(u64 period_ns, u64 spin_ns = 200000);
+
+    // 等待到下一个tick的时刻，返回这个tick的计划时间(now_ns()的时间)
+    // 第一次调用立即返回，作为循环的起点
+    u64 wait_next();
+
+    u64 period_ns() const { return m_period_ns; }
+    u64 tick_count() const { return m_tick_count; }
+    u64 missed_ticks() const { return m_missed_ticks; }
+};
+
+// 工作窃取线程池: ThreadPool, Task
+#include "thread_pool.h"
+
 #endif
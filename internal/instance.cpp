@@ -17,19 +17,81 @@
  */
 
 #include "instance.h"
+#include <atomic>
 
 RandGen *rng;
 Logger *logger;
 
+// 主种子和它的版本号，版本号变化时各线程重新播种
+static std::atomic<u64> master_seed(0);
+static std::atomic<u32> master_seed_generation(0);
+// 自动分配的线程编号从2^31开始，避免和手动声明的编号重复
+static std::atomic<u32> next_thread_index(0x80000000U);
+
+// 生成器直接放在槽中，重新播种时原地赋值，thread_rng()返回的指针在线程结束前一直有效
+struct ThreadRandGenSlot
+{
+    PhiloxRandGen generator;
+    u32 generation;
+    u32 index;
+    bool has_index;
+    bool seeded;
+
+    ThreadRandGenSlot() : generator(0), generation(0), index(0), has_index(false), seeded(false) { }
+};
+
+static thread_local ThreadRandGenSlot thread_slot;
+
+RandGen *thread_rng()
+{
+    u32 generation = master_seed_generation.load(std::memory_order_acquire);
+    if (!thread_slot.seeded || thread_slot.generation != generation)
+    {
+        if (!thread_slot.has_index)
+        {
+            thread_slot.index = next_thread_index.fetch_add(1, std::memory_order_relaxed);
+            thread_slot.has_index = true;
+        }
+
+        // 每个线程使用由主种子和线程编号派生的独立密钥
+        u64 key = PhiloxRandGen::hash(master_seed.load(std::memory_order_relaxed),
+                                      static_cast<s32>(thread_slot.index), -1, -1);
+        thread_slot.generator = PhiloxRandGen(key, 0, 0, 0);
+        thread_slot.generation = generation;
+        thread_slot.seeded = true;
+    }
+    return &thread_slot.generator;
+}
+
+void set_master_seed(u64 seed)
+{
+    master_seed.store(seed, std::memory_order_relaxed);
+    master_seed_generation.fetch_add(1, std::memory_order_release);
+}
+
+u64 get_master_seed()
+{
+    return master_seed.load(std::memory_order_relaxed);
+}
+
+void set_thread_rng_index(u32 index)
+{
+    thread_slot.index = index;
+    thread_slot.has_index = true;
+    // 编号改变后，下一次调用thread_rng()时重新播种
+    thread_slot.seeded = false;
+}
+
 void init_global_variables()
 {
-#if (defined __GNUC__) && (defined __RDRND__)
-    rng = new IntelRandGen();
-#else
-    rng = new MersenneRandGen();
-#endif
+    // 是否支持RDRAND/RDSEED在运行时检测，同一个二进制文件可以在旧CPU上运行
+    rng = new HardwareSeededRandGen();
+    // 世界生成等需要复现的场合应当再用世界种子调用set_master_seed()
+    set_master_seed(rng->get_u64());
 
     logger = new Logger(LOG_LEVEL_VERBOSE);
+    // 日志默认在每个线程中暂存几条再转发，崩溃时尽量把它们写出来
+    Logger::install_crash_handler();
 }
 
 void free_global_variables()
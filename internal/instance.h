@@ -31,4 +31,21 @@
 extern RandGen *rng;
 extern Logger *logger;
 
+// 线程独立的随机数生成器
+// 全局的rng没有任何同步，只能在主线程中使用。其他线程应当使用thread_rng()，
+// 每个线程拥有自己的PhiloxRandGen，互不竞争。
+// 每个线程的密钥由主种子和线程编号决定，与线程的创建和调度顺序无关，
+// 所以只要工作线程都用set_thread_rng_index()声明了固定的编号，
+// 同一个主种子总能得到完全相同的结果。
+// 返回的指针在当前线程结束前一直有效，可以保存下来重复使用。
+RandGen *thread_rng();
+
+// 设置主种子，所有线程的生成器会在下一次调用thread_rng()时重新播种
+void set_master_seed(u64 seed);
+u64 get_master_seed();
+
+// 声明当前线程的逻辑编号(例如工作线程在线程池中的序号)。
+// 未声明编号的线程在第一次使用时按先后顺序分配编号，此时结果不可复现。
+void set_thread_rng_index(u32 index);
+
 #endif
@@ -17,16 +17,182 @@
  */
 
 #include "logger.h"
+#include "fundamental_utility.h"
+#include "metrics.h"
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <chrono>
+#include <algorithm>
+
+#ifdef NGWORLD_OS_UNIX
+// include UNIX头文件
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#elif NGWORLD_OS_WINDOWS
+// include Windows头文件
+#error NGWorld support for Windows platform is not implemented yet.
+#endif
 using namespace std;
 
+// 所有Logger共用的指标，写线程每取一批消息更新一次队列长度
+static MetricGauge *logger_queue_depth = metrics().gauge("logger.queue_depth");
+static MetricCounter *logger_dropped = metrics().counter("logger.dropped");
+
+// 每个Logger的编号，用于在线程局部的缓存中查找暂存区
+static atomic<unsigned int> next_logger_id(0);
+
+struct StagingCacheEntry
+{
+    unsigned int logger_id;
+    LogStaging *staging;
+};
+
+static thread_local vector<StagingCacheEntry> staging_cache;
+
+// 所有存在的Logger，崩溃处理时逐个写出
+static mutex live_loggers_mutex;
+static vector<Logger*> live_loggers;
+
+// 日志时间的起点，消息头中显示的是从这里开始经过的秒数
+static const unsigned long long log_time_base = OSLayer::fast_ns();
+
+// 每个线程的格式化缓存和消息缓存，重复使用以免分配内存
+static thread_local LogFormatBuffer thread_format_buffer;
+static thread_local string thread_line;
+
+void LoggerForwarder::forward_logs(const std::string *str, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        forward_log(str[i]);
+}
+
 void LoggerForwarderConsole::forward_log(const std::string &str)
 {
     cout << str;
 }
 
+void LoggerForwarderConsole::forward_logs(const std::string *str, size_t count)
+{
+    m_merged.clear();
+    for (size_t i = 0; i < count; i++)
+        m_merged += str[i];
+    cout << m_merged;
+}
+
+void LoggerForwarderConsole::flush()
+{
+    cout.flush();
+}
+
+void LogFormatBuffer::append(const char *str, size_t n)
+{
+    if (n > capacity - length)
+        n = capacity - length;
+    memcpy(data + length, str, n);
+    length += n;
+}
+
+void log_format_value(LogFormatBuffer &buffer, const char *value)
+{
+    if (value == NULL)
+        value = "(null)";
+    buffer.append(value, strlen(value));
+}
+
+void log_format_value(LogFormatBuffer &buffer, const std::string &value)
+{
+    buffer.append(value.data(), value.size());
+}
+
+void log_format_value(LogFormatBuffer &buffer, char value)
+{
+    buffer.append(&value, 1);
+}
+
+void log_format_value(LogFormatBuffer &buffer, bool value)
+{
+    if (value)
+        buffer.append("true", 4);
+    else
+        buffer.append("false", 5);
+}
+
+// 整数直接从低位向高位转换，比snprintf快得多
+static void format_unsigned(LogFormatBuffer &buffer, unsigned long long value, bool negative)
+{
+    char digits[24];
+    int position = sizeof(digits);
+    do
+    {
+        digits[--position] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    if (negative)
+        digits[--position] = '-';
+    buffer.append(digits + position, sizeof(digits) - position);
+}
+
+static void format_signed(LogFormatBuffer &buffer, long long value)
+{
+    if (value < 0)
+        format_unsigned(buffer, 0ULL - static_cast<unsigned long long>(value), true);
+    else
+        format_unsigned(buffer, static_cast<unsigned long long>(value), false);
+}
+
+void log_format_value(LogFormatBuffer &buffer, int value)
+{
+    format_signed(buffer, value);
+}
+
+void log_format_value(LogFormatBuffer &buffer, unsigned int value)
+{
+    format_unsigned(buffer, value, false);
+}
+
+void log_format_value(LogFormatBuffer &buffer, long value)
+{
+    format_signed(buffer, value);
+}
+
+void log_format_value(LogFormatBuffer &buffer, unsigned long value)
+{
+    format_unsigned(buffer, value, false);
+}
+
+void log_format_value(LogFormatBuffer &buffer, long long value)
+{
+    format_signed(buffer, value);
+}
+
+void log_format_value(LogFormatBuffer &buffer, unsigned long long value)
+{
+    format_unsigned(buffer, value, false);
+}
+
+void log_format_value(LogFormatBuffer &buffer, double value)
+{
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%g", value);
+    if (length > 0)
+        buffer.append(text, static_cast<size_t>(length) < sizeof(text) ? length : sizeof(text) - 1);
+}
+
+void log_format_value(LogFormatBuffer &buffer, const void *value)
+{
+    char text[24];
+    int length = snprintf(text, sizeof(text), "%p", value);
+    if (length > 0)
+        buffer.append(text, static_cast<size_t>(length) < sizeof(text) ? length : sizeof(text) - 1);
+}
+
 LoggerForwarderFile::LoggerForwarderFile() : m_file_name("ngworld.log")
 {
     m_fout.open(m_file_name.c_str(), ios::out | ios::app);
@@ -49,60 +215,588 @@ void LoggerForwarderFile::forward_log(const std::string &str)
     m_fout << str;
 }
 
+void LoggerForwarderFile::flush()
+{
+    m_fout.flush();
+}
+
+LoggerForwarderMapped::LoggerForwarderMapped(const string &file_prefix, size_t segment_size, unsigned int max_segments)
+    : m_file_prefix(file_prefix), m_segment_size(segment_size), m_max_segments(max_segments > 0 ? max_segments : 1)
+{
+    m_segment_index = 0;
+    m_fd = -1;
+    m_map = NULL;
+    m_position = 0;
+    m_failure_reported = false;
+    open_segment();
+}
+
+LoggerForwarderMapped::~LoggerForwarderMapped()
+{
+    close_segment();
+}
+
+void LoggerForwarderMapped::open_segment()
+{
+#ifdef NGWORLD_OS_UNIX
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%u.log", m_segment_index % m_max_segments);
+    string file_name = m_file_prefix + suffix;
+
+    m_position = 0;
+    m_fd = ::open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0)
+    {
+        report_failure(file_name, "open");
+        return;
+    }
+    if (::ftruncate(m_fd, m_segment_size) != 0)
+    {
+        // 文件仍然可以用write()写入
+        report_failure(file_name, "ftruncate");
+        return;
+    }
+
+    void *map = ::mmap(NULL, m_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (map == MAP_FAILED)
+    {
+        report_failure(file_name, "mmap");
+        return;
+    }
+    m_map = static_cast<char*>(map);
+#elif NGWORLD_OS_WINDOWS
+#error NGWorld support for Windows platform is not implemented yet.
+#endif
+}
+
+void LoggerForwarderMapped::report_failure(const string &file_name, const char *operation)
+{
+    if (m_failure_reported)
+        return;
+    m_failure_reported = true;
+    fprintf(stderr, "NGWorld logger: %s %s failed (%s), %s\n", operation, file_name.c_str(), strerror(errno),
+            m_fd >= 0 ? "falling back to write()" : "log messages will be dropped");
+}
+
+void LoggerForwarderMapped::close_segment()
+{
+#ifdef NGWORLD_OS_UNIX
+    if (m_map != NULL)
+    {
+        ::munmap(m_map, m_segment_size);
+        m_map = NULL;
+    }
+    if (m_fd >= 0)
+    {
+        // 去掉没有用到的部分
+        if (::ftruncate(m_fd, m_position) != 0)
+            m_position = m_segment_size;
+        ::close(m_fd);
+        m_fd = -1;
+    }
+#elif NGWORLD_OS_WINDOWS
+#error NGWorld support for Windows platform is not implemented yet.
+#endif
+}
+
+void LoggerForwarderMapped::forward_log(const std::string &str)
+{
+    size_t length = str.size();
+    if (length > m_segment_size)
+        length = m_segment_size;
+
+    if (m_position + length > m_segment_size)
+    {
+        close_segment();
+        ++m_segment_index;
+        open_segment();
+    }
+    if (m_map != NULL)
+    {
+        memcpy(m_map + m_position, str.data(), length);
+        m_position += length;
+    }
+#ifdef NGWORLD_OS_UNIX
+    else if (m_fd >= 0)
+    {
+        ssize_t written = ::write(m_fd, str.data(), length);
+        if (written > 0)
+            m_position += written;
+    }
+#elif NGWORLD_OS_WINDOWS
+#error NGWorld support for Windows platform is not implemented yet.
+#endif
+}
+
+void LoggerForwarderMapped::sync()
+{
+#ifdef NGWORLD_OS_UNIX
+    if (m_map != NULL)
+        ::msync(m_map, m_segment_size, MS_ASYNC);
+#elif NGWORLD_OS_WINDOWS
+#error NGWorld support for Windows platform is not implemented yet.
+#endif
+}
+
+LogRecordQueue::LogRecordQueue(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    m_cells = new Cell[size];
+    m_mask = size - 1;
+    for (size_t i = 0; i < size; i++)
+        m_cells[i].sequence.store(i, memory_order_relaxed);
+    m_enqueue_position.store(0, memory_order_relaxed);
+    m_dequeue_position = 0;
+}
+
+LogRecordQueue::~LogRecordQueue()
+{
+    delete[] m_cells;
+}
+
+bool LogRecordQueue::push(std::string &str)
+{
+    Cell *cell;
+    size_t position = m_enqueue_position.load(memory_order_relaxed), sequence;
+    for (;;)
+    {
+        cell = &m_cells[position & m_mask];
+        sequence = cell->sequence.load(memory_order_acquire);
+        if (sequence == position)
+        {
+            // 格子空闲，尝试占用
+            if (m_enqueue_position.compare_exchange_weak(position, position + 1, memory_order_relaxed))
+                break;
+        }
+        else if (sequence < position)
+        {
+            // 格子还没有被消费者取走，队列已满
+            return false;
+        }
+        else
+        {
+            // 被其他生产者抢先了
+            position = m_enqueue_position.load(memory_order_relaxed);
+        }
+    }
+
+    cell->data.swap(str);
+    cell->sequence.store(position + 1, memory_order_release);
+    return true;
+}
+
+bool LogRecordQueue::pop(std::string &str)
+{
+    Cell *cell = &m_cells[m_dequeue_position & m_mask];
+    if (cell->sequence.load(memory_order_acquire) != m_dequeue_position + 1)
+        return false;
+
+    str.swap(cell->data);
+    cell->sequence.store(m_dequeue_position + m_mask + 1, memory_order_release);
+    ++m_dequeue_position;
+    return true;
+}
+
+bool LogRecordQueue::empty() const
+{
+    return m_cells[m_dequeue_position & m_mask].sequence.load(memory_order_acquire) != m_dequeue_position + 1;
+}
+
+size_t LogRecordQueue::size() const
+{
+    return m_enqueue_position.load(memory_order_relaxed) - m_dequeue_position;
+}
+
 // 使用默认配置，一个终端转发器，一个文件转发器
-Logger::Logger(LOG_LEVEL least_notice_level)
+Logger::Logger(LOG_LEVEL least_notice_level) : Logger(least_notice_level, new LoggerForwarderConsole(), true)
 {
-    m_forwarders.push_back(make_pair(new LoggerForwarderConsole(), true));
     m_forwarders.push_back(make_pair(new LoggerForwarderFile(), false));
+}
+
+Logger::Logger(LOG_LEVEL least_notice_level, LoggerForwarder *forwarder, bool realtime)
+    : m_id(next_logger_id.fetch_add(1))
+{
+    m_forwarders.push_back(make_pair(forwarder, realtime));
     m_forward_buf_position = 0;
     m_notice_level = least_notice_level;
+    m_queue = NULL;
+    m_queue_policy = LOG_QUEUE_BLOCK;
+    m_writer_running = false;
+    m_dropped_count = 0;
+    m_writer_sleeping = false;
+    m_staging_size = default_staging_size;
+
+    lock_guard<mutex> guard(live_loggers_mutex);
+    live_loggers.push_back(this);
 }
 
 Logger::~Logger()
 {
+    {
+        lock_guard<mutex> guard(live_loggers_mutex);
+        live_loggers.erase(find(live_loggers.begin(), live_loggers.end(), this));
+    }
+
+    stop_async();
+    flush_stagings();
+    dump_forwarder_buffer();
+
     vector<pair<LoggerForwarder*, bool> >::iterator it;
-    int i;
     for (it = m_forwarders.begin(); it != m_forwarders.end(); ++it)
+        delete it->first;
+
+    // 线程退出后暂存区仍然保留，到这里统一释放
+    for (size_t i = 0; i < m_stagings.size(); i++)
+        delete m_stagings[i];
+}
+
+LogStaging *Logger::get_staging()
+{
+    for (size_t i = 0; i < staging_cache.size(); i++)
+        if (staging_cache[i].logger_id == m_id)
+            return staging_cache[i].staging;
+
+    // 当前线程第一次使用这个Logger，注册一个新的暂存区
+    LogStaging *staging = new LogStaging;
     {
-        if (it->second == false)
+        lock_guard<mutex> guard(m_staging_registry_mutex);
+        m_stagings.push_back(staging);
+    }
+    StagingCacheEntry entry = { m_id, staging };
+    staging_cache.push_back(entry);
+    return staging;
+}
+
+void Logger::flush_stagings(bool wait)
+{
+    unique_lock<mutex> dispatch_guard(m_dispatch_mutex, defer_lock);
+    unique_lock<mutex> registry_guard(m_staging_registry_mutex, defer_lock);
+    if (wait)
+    {
+        dispatch_guard.lock();
+        registry_guard.lock();
+    }
+    else if (!dispatch_guard.try_lock() || !registry_guard.try_lock())
+    {
+        return;
+    }
+    size_t i, count = m_stagings.size(), best;
+    int back;
+
+    // 交换每个暂存区的前后缓冲，之后所属线程可以继续写入，不必等待转发
+    // 没有交换的暂存区后缓冲为空，不参与下面的合并
+    for (i = 0; i < count; i++)
+    {
+        unique_lock<mutex> staging_guard(m_stagings[i]->lock, defer_lock);
+        if (wait)
+            staging_guard.lock();
+        else if (!staging_guard.try_lock())
+            continue;
+        m_stagings[i]->front ^= 1;
+    }
+
+    // 每个暂存区内部已经有序，做一次多路归并，同一时刻的消息按线程注册顺序输出
+    m_merge_cursors.assign(count, 0);
+    for (;;)
+    {
+        best = count;
+        for (i = 0; i < count; i++)
         {
-            for (i = 0; i < m_forward_buf_position; i++)
-                it->first->forward_log(m_forwarder_buffer[i]);
+            back = m_stagings[i]->front ^ 1;
+            if (m_merge_cursors[i] == m_stagings[i]->counts[back])
+                continue;
+            if (best == count ||
+                m_stagings[i]->buffers[back][m_merge_cursors[i]].timestamp <
+                m_stagings[best]->buffers[m_stagings[best]->front ^ 1][m_merge_cursors[best]].timestamp)
+                best = i;
         }
-        delete it->first;
+        if (best == count)
+            break;
+        back = m_stagings[best]->front ^ 1;
+        dispatch(m_stagings[best]->buffers[back][m_merge_cursors[best]++].line);
     }
+
+    for (i = 0; i < count; i++)
+        m_stagings[i]->counts[m_stagings[i]->front ^ 1] = 0;
 }
 
-void Logger::log(const string &str, LOG_LEVEL level)
+void Logger::add_forwarder(LoggerForwarder *forwarder, bool realtime)
 {
-    if(level < m_notice_level)
+    lock_guard<mutex> guard(m_dispatch_mutex);
+    m_forwarders.push_back(make_pair(forwarder, realtime));
+}
+
+void Logger::flush()
+{
+    flush_stagings();
+}
+
+void Logger::set_staging_size(size_t size)
+{
+    m_staging_size = size > 0 ? size : 1;
+}
+
+void Logger::flush_for_crash()
+{
+    flush_stagings(false);
+
+    unique_lock<mutex> guard(m_dispatch_mutex, try_to_lock);
+    if (!guard.owns_lock())
         return;
+    dump_forwarder_buffer();
+    vector<pair<LoggerForwarder*, bool> >::iterator it;
+    for (it = m_forwarders.begin(); it != m_forwarders.end(); ++it)
+        it->first->flush();
+}
+
+void Logger::crash_signal_handler(int signal_number)
+{
+    // 进程已经处于未定义的状态，这里只做尽力而为的输出。
+    // 处理函数带有SA_RESETHAND，这里再次崩溃时会直接按默认方式终止
+    {
+        unique_lock<mutex> guard(live_loggers_mutex, try_to_lock);
+        if (guard.owns_lock())
+            for (size_t i = 0; i < live_loggers.size(); i++)
+                live_loggers[i]->flush_for_crash();
+    }
+    raise(signal_number);
+}
+
+void Logger::install_crash_handler()
+{
+#ifdef NGWORLD_OS_UNIX
+    static const int signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = crash_signal_handler;
+    action.sa_flags = SA_RESETHAND | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+        sigaction(signals[i], &action, NULL);
+#elif NGWORLD_OS_WINDOWS
+#error NGWorld support for Windows platform is not implemented yet.
+#endif
+}
+
+void Logger::dump_forwarder_buffer()
+{
+    vector<pair<LoggerForwarder*, bool> >::iterator it;
+    for (it = m_forwarders.begin(); it != m_forwarders.end(); ++it)
+        if (it->second == false)
+            it->first->forward_logs(m_forwarder_buffer, m_forward_buf_position);
+    m_forward_buf_position = 0;
+}
 
-    // 制作消息头
-    char *p = m_message_buffer;
-    if(str.size() > 100) // 对于长消息，临时分配缓存
-        p = new char[str.size() + 20];
-    sprintf(p, "[%.3lf] %s %s\n", clock() * 1.0 / CLOCKS_PER_SEC, log_level_string[level], str.c_str());
-    m_forwarder_buffer[m_forward_buf_position++] = (string)p;
+LogFormatBuffer &Logger::get_format_buffer()
+{
+    return thread_format_buffer;
+}
+
+void Logger::format_message(string &line, const char *str, size_t length, LOG_LEVEL level, unsigned long long timestamp)
+{
+    // 制作消息头"[秒.微秒] (级别) "，手工转换数字，避免snprintf格式化浮点数的开销
+    char header[48];
+    unsigned long long elapsed = timestamp > log_time_base ? (timestamp - log_time_base) / 1000 : 0;
+    unsigned long long seconds = elapsed / 1000000;
+    unsigned int micro = static_cast<unsigned int>(elapsed % 1000000);
+    char digits[24];
+    int position = sizeof(digits), i, header_length = 0;
+    do
+    {
+        digits[--position] = static_cast<char>('0' + seconds % 10);
+        seconds /= 10;
+    } while (seconds > 0);
+
+    header[header_length++] = '[';
+    while (position < static_cast<int>(sizeof(digits)))
+        header[header_length++] = digits[position++];
+    header[header_length++] = '.';
+    for (i = 5; i >= 0; i--)
+    {
+        header[header_length + i] = static_cast<char>('0' + micro % 10);
+        micro /= 10;
+    }
+    header_length += 6;
+    header[header_length++] = ']';
+    header[header_length++] = ' ';
+    memcpy(header + header_length, log_level_string[level], 4);
+    header_length += 4;
+    header[header_length++] = ' ';
+
+    line.assign(header, header_length);
+    line.append(str, length);
+    line += '\n';
+}
+
+void Logger::dispatch(const string &line)
+{
+    m_forwarder_buffer[m_forward_buf_position++] = line;
 
     // 转发消息
-    int i;
     for (vector<pair<LoggerForwarder*, bool> >::iterator it = m_forwarders.begin(); it != m_forwarders.end(); ++it)
     {
         if (it->second) // 实时输出
         {
-            it->first->forward_log(p);
+            it->first->forward_log(line);
         }
         else if (m_forward_buf_position == forwarder_buffer_size) // dump缓存
         {
-            for (i = 0; i < forwarder_buffer_size; i++)
-                it->first->forward_log(m_forwarder_buffer[i]);
+            it->first->forward_logs(m_forwarder_buffer, forwarder_buffer_size);
         }
     }
 
     if (m_forward_buf_position == forwarder_buffer_size)
         m_forward_buf_position = 0;
+}
+
+void Logger::log(const string &str, LOG_LEVEL level)
+{
+    log_line(str.data(), str.size(), level);
+}
+
+void Logger::log_line(const char *str, size_t length, LOG_LEVEL level)
+{
+    if (!is_enabled(level))
+        return;
+
+    string &line = thread_line;
+    unsigned long long timestamp = OSLayer::fast_ns();
+    format_message(line, str, length, level, timestamp);
+
+    if (m_queue == NULL)
+    {
+        LogStaging *staging = get_staging();
+        bool full;
+        {
+            lock_guard<mutex> guard(staging->lock);
+            vector<LogRecord> &records = staging->buffers[staging->front];
+            size_t &count = staging->counts[staging->front];
+            if (count == records.size())
+                records.push_back(LogRecord());
+            records[count].timestamp = timestamp;
+            records[count].line.swap(line);
+            ++count;
+            // 只比较本线程暂存的第一条消息的时间，不读取任何共享的状态
+            full = count >= m_staging_size || timestamp - records[0].timestamp >= staging_max_delay_ns;
+        }
+        // 警告和错误要尽快让人看到
+        if (full || level >= LOG_LEVEL_WARNING)
+            flush_stagings();
+        return;
+    }
+
+    // 入队时交换字符串，换回来的是之前用过的缓存
+    while (!m_queue->push(line))
+    {
+        if (m_queue_policy == LOG_QUEUE_DROP)
+        {
+            m_dropped_count.fetch_add(1, memory_order_relaxed);
+            logger_dropped->add();
+            return;
+        }
+        // 等待写线程腾出空间
+        wake_writer();
+        this_thread::yield();
+    }
+    wake_writer();
+}
 
-    if(str.size() > 100)
-        delete p;
+void Logger::wake_writer()
+{
+    // 与writer_main()中的屏障配对: 要么这里看到m_writer_sleeping为true，
+    // 要么写线程在等待之前看到刚入队的消息
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!m_writer_sleeping.load(memory_order_relaxed) || !m_writer_sleeping.exchange(false, memory_order_relaxed))
+        return;
+    // 写线程从设置标志到开始等待一直持有m_writer_mutex，加锁之后再通知不会丢失
+    lock_guard<mutex> guard(m_writer_mutex);
+    m_writer_wakeup.notify_one();
+}
+
+void Logger::writer_main()
+{
+    vector<string> batch(writer_batch_size);
+    unsigned long long reported_drops = 0, drops;
+    size_t count;
+    char notice[96];
+    bool running;
+
+    for (;;)
+    {
+        // 先读取运行标志再取消息: stop_async()之前入队的消息一定在标志变为false之前可见，
+        // 所以只有标志已经是false并且这一轮没有取到任何消息时，才说明全部消息都已写出
+        running = m_writer_running.load(memory_order_acquire);
+        count = 0;
+        while (count < batch.size() && m_queue->pop(batch[count]))
+            ++count;
+        logger_queue_depth->set(static_cast<s64>(m_queue->size()));
+
+        drops = m_dropped_count.load(memory_order_relaxed);
+        if (drops != reported_drops && count < batch.size())
+        {
+            snprintf(notice, sizeof(notice), "%llu log messages were dropped because the queue was full",
+                     drops - reported_drops);
+            format_message(batch[count++], notice, strlen(notice), LOG_LEVEL_WARNING, OSLayer::fast_ns());
+            reported_drops = drops;
+        }
+
+        if (count > 0)
+        {
+            // 队列里的消息本身就是一批，不再经过m_forwarder_buffer
+            vector<pair<LoggerForwarder*, bool> >::iterator it;
+            for (it = m_forwarders.begin(); it != m_forwarders.end(); ++it)
+                it->first->forward_logs(&batch[0], count);
+            continue;
+        }
+
+        if (!running)
+            break;
+
+        unique_lock<mutex> lock(m_writer_mutex);
+        m_writer_sleeping.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        // 设置标志之后再检查一次，之前入队的生产者可能没有看到标志
+        if (m_queue->empty() && m_writer_running.load(memory_order_acquire) &&
+            m_dropped_count.load(memory_order_relaxed) == reported_drops)
+            m_writer_wakeup.wait_for(lock, chrono::milliseconds(100));
+        m_writer_sleeping.store(false, memory_order_relaxed);
+    }
+}
+
+void Logger::start_async(size_t queue_capacity, LOG_QUEUE_POLICY policy)
+{
+    if (m_queue != NULL)
+        return;
+
+    // 同步模式下还没写出的消息先写出，保证顺序
+    flush_stagings();
+    dump_forwarder_buffer();
+
+    m_queue = new LogRecordQueue(queue_capacity);
+    m_queue_policy = policy;
+    m_writer_running.store(true, memory_order_release);
+    m_writer = thread(&Logger::writer_main, this);
+}
+
+void Logger::stop_async()
+{
+    if (m_queue == NULL)
+        return;
+
+    {
+        lock_guard<mutex> guard(m_writer_mutex);
+        m_writer_running.store(false, memory_order_release);
+        m_writer_wakeup.notify_one();
+    }
+    m_writer.join();
+
+    delete m_queue;
+    m_queue = NULL;
+}
+
+unsigned long long Logger::dropped_count() const
+{
+    return m_dropped_count.load(memory_order_relaxed);
 }
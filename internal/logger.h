@@ -22,6 +22,13 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include "fundamental_macros.h"
+#include "fundamental_utility.h"
 
 enum LOG_LEVEL
 {
@@ -33,6 +40,12 @@ enum LOG_LEVEL
     LOG_LEVLE_COUNT
 };
 
+// 编译时的最低日志级别(LOG_LEVEL的数值)，低于它的NGW_LOG_xxx调用连同参数一起被删除
+// 由Makefile设置: DEBUG=1时为0(保留VERBOSE)，否则为1(从INFO开始)
+#ifndef NGWORLD_MIN_LOG_LEVEL
+#define NGWORLD_MIN_LOG_LEVEL 0
+#endif
+
 static const char log_level_string[][5] =
 {
     "(VB)", // LOG_LEVEL_VERBOSE
@@ -41,18 +54,36 @@ static const char log_level_string[][5] =
     "(EE)", // LOG_LEVEL_ERROR
 };
 
+// 异步模式下队列已满时的处理策略
+enum LOG_QUEUE_POLICY
+{
+    LOG_QUEUE_BLOCK, // 等待写线程腾出空间
+    LOG_QUEUE_DROP,  // 丢弃这条消息并计数
+};
+
 class LoggerForwarder
 {
 public:
     LoggerForwarder() {}
     virtual ~LoggerForwarder() {}
     virtual void forward_log(const std::string &str) = 0;
+
+    // 一次转发多条消息，默认逐条调用forward_log()
+    virtual void forward_logs(const std::string *str, size_t count);
+
+    // 把转发器自己缓存的内容写出，程序崩溃时由Logger调用
+    virtual void flush() {}
 };
 
 class LoggerForwarderConsole : public LoggerForwarder
 {
+private:
+    std::string m_merged; // 重复使用，避免每批消息都分配内存
 public:
     void forward_log(const std::string &str);
+    // 合并成一次输出，减少终端I/O的次数
+    void forward_logs(const std::string *str, size_t count);
+    void flush();
 };
 
 class LoggerForwarderFile : public LoggerForwarder
@@ -65,6 +96,200 @@ public:
     LoggerForwarderFile(const std::string &file_name);
     ~LoggerForwarderFile();
     void forward_log(const std::string &str);
+    void flush();
+};
+
+// 内存映射的环形日志文件
+// 消息直接复制进以MAP_SHARED映射的文件，写入之后即使进程崩溃也会由内核写回磁盘，
+// 不需要像LoggerForwarderFile那样等缓存写满。每个分段的大小固定，写满后截断到
+// 实际长度并切换到下一个分段(prefix.0.log, prefix.1.log, ...)，
+// 分段数达到max_segments后循环覆盖最旧的分段。
+// 进程崩溃时当前分段的末尾会留下一些'\0'字节。
+// 文件系统不支持映射时退回到普通的write()；连文件都打不开时消息被丢弃，
+// 这两种情况都只在标准错误输出上报告一次。
+class LoggerForwarderMapped : public LoggerForwarder
+{
+private:
+    const std::string m_file_prefix;
+    const size_t m_segment_size;
+    const unsigned int m_max_segments;
+    unsigned int m_segment_index;
+    int m_fd;
+    char *m_map;
+    size_t m_position;
+    bool m_failure_reported;
+
+    void open_segment();
+    void close_segment();
+    void report_failure(const std::string &file_name, const char *operation);
+
+public:
+    LoggerForwarderMapped(const std::string &file_prefix = "ngworld", size_t segment_size = 16 << 20,
+                          unsigned int max_segments = 4);
+    ~LoggerForwarderMapped();
+    void forward_log(const std::string &str);
+
+    // 当前分段的文件是否打开(无论是否映射成功)，为false时消息被丢弃
+    bool is_open() const { return m_fd >= 0; }
+    // 当前分段是否使用内存映射
+    bool is_mapped() const { return m_map != NULL; }
+
+    // 请求内核把已写入的内容异步写回磁盘(只有断电时才需要)
+    void sync();
+};
+
+// 有界无锁多生产者单消费者队列
+// 参考: Bounded MPMC queue -- Dmitry Vyukov
+// 每个格子带有一个序号，生产者用CAS抢占写入位置，消费者只有一个，不需要CAS。
+class LogRecordQueue
+{
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        std::string data;
+    };
+
+    Cell *m_cells;
+    size_t m_mask;
+    std::atomic<size_t> m_enqueue_position;
+    size_t m_dequeue_position;
+
+public:
+    // capacity会被向上取整为2的幂
+    LogRecordQueue(size_t capacity);
+    ~LogRecordQueue();
+
+    // 队列已满时返回false。成功时str的内容被交换进队列
+    bool push(std::string &str);
+    // 只能由消费者线程调用，队列为空时返回false
+    bool pop(std::string &str);
+    // 只能由消费者线程调用
+    bool empty() const;
+    // 队列中的消息数，包括正在写入的，只能由消费者线程调用
+    size_t size() const;
+};
+
+// 尚未转发的一条消息，timestamp用于多个线程的消息合并排序
+struct LogRecord
+{
+    unsigned long long timestamp;
+    std::string line;
+};
+
+// 每个线程独立的暂存区。只有所属线程写入和合并时才会加锁，几乎不会发生竞争
+// 使用双缓冲: 所属线程写入front，合并时交换两个缓冲并转发另一个。
+// 缓冲中的LogRecord只增不减，字符串的内存在之后的消息中重复使用。
+struct LogStaging
+{
+    std::mutex lock;
+    std::vector<LogRecord> buffers[2];
+    size_t counts[2];
+    int front;
+
+    LogStaging() : front(0) { counts[0] = counts[1] = 0; }
+};
+
+// 日志格式化缓存，长度固定，不会分配内存，超出的部分被截断
+struct LogFormatBuffer
+{
+    static const size_t capacity = 1024;
+    char data[capacity];
+    size_t length;
+
+    LogFormatBuffer() : length(0) { }
+    void append(const char *str, size_t n);
+};
+
+// 把各种类型的参数写入格式化缓存，不支持的类型会在编译时报错
+void log_format_value(LogFormatBuffer &buffer, const char *value);
+void log_format_value(LogFormatBuffer &buffer, const std::string &value);
+void log_format_value(LogFormatBuffer &buffer, char value);
+void log_format_value(LogFormatBuffer &buffer, bool value);
+void log_format_value(LogFormatBuffer &buffer, int value);
+void log_format_value(LogFormatBuffer &buffer, unsigned int value);
+void log_format_value(LogFormatBuffer &buffer, long value);
+void log_format_value(LogFormatBuffer &buffer, unsigned long value);
+void log_format_value(LogFormatBuffer &buffer, long long value);
+void log_format_value(LogFormatBuffer &buffer, unsigned long long value);
+void log_format_value(LogFormatBuffer &buffer, double value);
+void log_format_value(LogFormatBuffer &buffer, const void *value);
+
+inline void log_format_args(LogFormatBuffer &buffer, const char *format)
+{
+    const char *p = format;
+    while (*p)
+        ++p;
+    buffer.append(format, p - format);
+}
+
+// 依次用参数替换格式字符串中的"{}"，占位符不够时多余的参数被忽略
+template <typename T, typename... Args>
+void log_format_args(LogFormatBuffer &buffer, const char *format, const T &value, const Args&... args)
+{
+    const char *p = format;
+    while (*p && !(p[0] == '{' && p[1] == '}'))
+        ++p;
+    buffer.append(format, p - format);
+    if (!*p)
+        return;
+    log_format_value(buffer, value);
+    log_format_args(buffer, p + 2, args...);
+}
+
+// 一个日志调用点的限流状态，由NGW_LOG_RATE_LIMITED和NGW_LOG_SAMPLED宏为每个调用点
+// 定义一个静态实例。构造函数是constexpr，静态实例不需要运行时初始化的保护。
+// 计数器之间没有严格同步，多线程下放行的条数可能略多于限制，但不会丢失被抑制的计数。
+class LogCallSiteLimiter
+{
+private:
+    std::atomic<u64> m_window_start; // 当前计数窗口的开始时间(coarse_ns)
+    std::atomic<u32> m_count;
+    std::atomic<u64> m_suppressed;
+    std::atomic<u64> m_calls; // 采样模式的调用计数
+
+public:
+    constexpr LogCallSiteLimiter() : m_window_start(0), m_count(0), m_suppressed(0), m_calls(0) { }
+
+    // 当前窗口已超过1秒时开始新的窗口
+    bool start_window_if_expired()
+    {
+        u64 now = OSLayer::coarse_ns();
+        u64 start = m_window_start.load(std::memory_order_relaxed);
+        if (now - start < 1000000000ULL || !m_window_start.compare_exchange_strong(start, now, std::memory_order_relaxed))
+            return false;
+        m_count.store(0, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 每秒最多放行per_second条。放行时suppressed为上次放行之后被抑制的条数
+    // 计数未达到限制时直接放行，只有窗口的第一条消息记录一次时间；
+    // 达到限制之后才检查窗口是否结束，读的是coarse_ns()，不读TSC
+    bool acquire_rate(u32 per_second, u64 &suppressed)
+    {
+        u32 index;
+        // 超出限制后只读不写m_count，减少多个线程之间的缓存行争用
+        if ((m_count.load(std::memory_order_relaxed) >= per_second && !start_window_if_expired()) ||
+            (index = m_count.fetch_add(1, std::memory_order_relaxed)) >= per_second)
+        {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (index == 0)
+            m_window_start.store(OSLayer::coarse_ns(), std::memory_order_relaxed);
+        suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 每every_n条放行一条(第1条、第every_n+1条...)，suppressed的含义同上
+    bool acquire_sample(u32 every_n, u64 &suppressed)
+    {
+        u64 index = m_calls.fetch_add(1, std::memory_order_relaxed);
+        if (every_n > 1 && index % every_n != 0)
+            return false;
+        suppressed = index == 0 ? 0 : (every_n > 1 ? every_n - 1 : 0);
+        return true;
+    }
 };
 
 class Logger
@@ -76,16 +301,174 @@ private:
     std::vector<std::pair<LoggerForwarder*, bool> > m_forwarders;
     LOG_LEVEL m_notice_level;
 
-    // 在调制消息头的过程中，防止频繁地分配和释放内存，
-    // 提前一次性分配好一个长度为128字节的缓存空间。
-    // 在不够用的情况下，再临时分配和释放所需的内存。
-    char m_message_buffer[128];
+    // 异步模式: log()只负责制作消息并放入队列，由写线程批量转发
+    static const int writer_batch_size = 64;
+    LogRecordQueue *m_queue;
+    LOG_QUEUE_POLICY m_queue_policy;
+    std::thread m_writer;
+    std::atomic<bool> m_writer_running;
+    std::atomic<unsigned long long> m_dropped_count;
+    // 写线程只在队列为空时才等待m_writer_wakeup，等待期间m_writer_sleeping为true。
+    // 生产者只在它为true时才通知，写线程忙碌时入队不需要任何系统调用
+    std::atomic<bool> m_writer_sleeping;
+    std::mutex m_writer_mutex;
+    std::condition_variable m_writer_wakeup;
+
+    // 同步模式的多线程支持:
+    // log()只把消息放进当前线程的暂存区，暂存区满了、最早的一条已经暂存了
+    // staging_max_delay_ns、遇到警告以上级别的消息或者调用flush()时，
+    // 才获取m_dispatch_mutex，把所有线程暂存的消息按时间顺序合并后转发。
+    static const size_t default_staging_size = 16;
+    static const unsigned long long staging_max_delay_ns = 50000000ULL;
+    const unsigned int m_id;
+    size_t m_staging_size;
+    std::mutex m_dispatch_mutex; // 保护转发器和m_forwarder_buffer
+    std::mutex m_staging_registry_mutex;
+    std::vector<LogStaging*> m_stagings;
+
+    LogStaging *get_staging();
+    // wait为false时只尝试加锁，被占用的暂存区跳过，用于崩溃处理
+    void flush_stagings(bool wait = true);
+    void flush_for_crash();
+    static void crash_signal_handler(int signal_number);
+    std::vector<size_t> m_merge_cursors;
+
+    static LogFormatBuffer &get_format_buffer();
+    void format_message(std::string &line, const char *str, size_t length, LOG_LEVEL level, unsigned long long timestamp);
+    void log_line(const char *str, size_t length, LOG_LEVEL level);
+    void dispatch(const std::string &line);
+    void dump_forwarder_buffer();
+    void wake_writer();
+    void writer_main();
 
 public:
     Logger(LOG_LEVEL least_notice_level = LOG_LEVEL_INFO);
+    // 只使用给定的转发器，不创建默认的终端和文件转发器
+    Logger(LOG_LEVEL least_notice_level, LoggerForwarder *forwarder, bool realtime);
     ~Logger();
 
+    // 可以在任意线程中调用
     void log(const std::string &str, LOG_LEVEL level = LOG_LEVEL_VERBOSE);
+
+    // 级别是否会被输出，在准备开销较大的日志参数之前先检查
+    bool is_enabled(LOG_LEVEL level) const
+    {
+        return level >= NGWORLD_MIN_LOG_LEVEL && level >= m_notice_level;
+    }
+
+    // 类型安全的格式化输出，例如
+    // logger->logf(LOG_LEVEL_INFO, "chunk ({}, {}) generated in {} ms", x, z, ms);
+    // 级别被过滤时不会格式化任何参数。结果直接写入线程独立的定长缓存，
+    // 整个过程(包括转发)在稳定状态下不会分配堆内存。
+    template <typename... Args>
+    void logf(LOG_LEVEL level, const char *format, const Args&... args)
+    {
+        if (!is_enabled(level))
+            return;
+        LogFormatBuffer &buffer = get_format_buffer();
+        buffer.length = 0;
+        log_format_args(buffer, format, args...);
+        log_line(buffer.data, buffer.length, level);
+    }
+
+    // 与logf()相同，suppressed不为0时在消息末尾注明被抑制的条数
+    template <typename... Args>
+    void logf_suppressed(LOG_LEVEL level, u64 suppressed, const char *format, const Args&... args)
+    {
+        if (!is_enabled(level))
+            return;
+        LogFormatBuffer &buffer = get_format_buffer();
+        buffer.length = 0;
+        log_format_args(buffer, format, args...);
+        if (suppressed > 0)
+            log_format_args(buffer, " ({} similar messages suppressed)", static_cast<unsigned long long>(suppressed));
+        log_line(buffer.data, buffer.length, level);
+    }
+
+    // 添加一个转发器，Logger负责释放它。realtime为true时每条消息都立即转发，
+    // 否则每攒够forwarder_buffer_size条才转发一次
+    // 不能与log()并发调用
+    void add_forwarder(LoggerForwarder *forwarder, bool realtime);
+
+    // 把所有线程暂存的消息立即转发出去
+    // 所有线程都停止写日志之后，最后暂存的几条消息要等到这里或者析构时才会输出
+    void flush();
+    // 每个线程暂存多少条消息后转发，默认为16。
+    // 为1时每条消息都立即转发，但每条消息都要获取全局的转发锁并检查所有线程的暂存区
+    void set_staging_size(size_t size);
+
+    // 收到SIGSEGV、SIGABRT等致命信号时，尽量写出所有Logger暂存的消息，再按默认方式终止进程。
+    // 崩溃的线程正持有的锁不会被等待，对应的消息会被跳过。只需要在启动时调用一次
+    static void install_crash_handler();
+
+    // 切换到异步模式，切换时不能有其他线程正在写日志，queue_capacity为队列能容纳的消息数
+    void start_async(size_t queue_capacity = 4096, LOG_QUEUE_POLICY policy = LOG_QUEUE_BLOCK);
+    // 写完队列中剩余的消息后回到同步模式，析构时会自动调用
+    void stop_async();
+    // 异步模式下因为队列已满而被丢弃的消息数
+    unsigned long long dropped_count() const;
 };
 
+// 带编译时过滤的日志宏，用法与Logger::logf()相同，例如
+// NGW_LOG_VERBOSE(logger, "chunk ({}, {}) loaded", x, z);
+// 级别低于NGWORLD_MIN_LOG_LEVEL时整条语句为空，参数不会被求值，
+// 所以在热点循环中也可以放心地写VERBOSE日志。
+#define NGW_LOG(log_object, level, ...) \
+    do \
+    { \
+        if ((level) >= NGWORLD_MIN_LOG_LEVEL && (log_object)->is_enabled(level)) \
+            (log_object)->logf((level), __VA_ARGS__); \
+    } while (0)
+
+#define NGW_LOG_DISABLED(log_object, ...) do { } while (0)
+
+// 用于热点路径(每个方块、每个数据包)的限流日志，例如
+// NGW_LOG_RATE_LIMITED(logger, LOG_LEVEL_WARNING, 5, "bad packet from {}", address);
+// 每个调用点每秒最多输出per_second条；NGW_LOG_SAMPLED每every_n条输出一条。
+// 被抑制时只读一次低精度时钟(coarse_ns)和几次原子操作，不会格式化参数；下一条被输出的消息末尾会注明被抑制的条数。
+// 计数属于调用点而不是Logger对象。
+#define NGW_LOG_RATE_LIMITED(log_object, level, per_second, ...) \
+    do \
+    { \
+        if ((level) >= NGWORLD_MIN_LOG_LEVEL && (log_object)->is_enabled(level)) \
+        { \
+            static LogCallSiteLimiter ngw_log_limiter; \
+            u64 ngw_log_suppressed; \
+            if (ngw_log_limiter.acquire_rate((per_second), ngw_log_suppressed)) \
+                (log_object)->logf_suppressed((level), ngw_log_suppressed, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define NGW_LOG_SAMPLED(log_object, level, every_n, ...) \
+    do \
+    { \
+        if ((level) >= NGWORLD_MIN_LOG_LEVEL && (log_object)->is_enabled(level)) \
+        { \
+            static LogCallSiteLimiter ngw_log_limiter; \
+            u64 ngw_log_suppressed; \
+            if (ngw_log_limiter.acquire_sample((every_n), ngw_log_suppressed)) \
+                (log_object)->logf_suppressed((level), ngw_log_suppressed, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#if NGWORLD_MIN_LOG_LEVEL <= 0
+#define NGW_LOG_VERBOSE(log_object, ...) NGW_LOG(log_object, LOG_LEVEL_VERBOSE, __VA_ARGS__)
+#else
+#define NGW_LOG_VERBOSE(log_object, ...) NGW_LOG_DISABLED(log_object, __VA_ARGS__)
+#endif
+
+#if NGWORLD_MIN_LOG_LEVEL <= 1
+#define NGW_LOG_INFO(log_object, ...) NGW_LOG(log_object, LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define NGW_LOG_INFO(log_object, ...) NGW_LOG_DISABLED(log_object, __VA_ARGS__)
+#endif
+
+#if NGWORLD_MIN_LOG_LEVEL <= 2
+#define NGW_LOG_WARNING(log_object, ...) NGW_LOG(log_object, LOG_LEVEL_WARNING, __VA_ARGS__)
+#else
+#define NGW_LOG_WARNING(log_object, ...) NGW_LOG_DISABLED(log_object, __VA_ARGS__)
+#endif
+
+#define NGW_LOG_ERROR(log_object, ...) NGW_LOG(log_object, LOG_LEVEL_ERROR, __VA_ARGS__)
+
 #endif
@@ -0,0 +1,317 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "metrics.h"
+#include "logger.h"
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <new>
+
+#ifdef NGWORLD_OS_UNIX
+// include UNIX头文件
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#elif NGWORLD_OS_WINDOWS
+// include Windows头文件
+#error NGWorld support for Windows platform is not implemented yet.
+#endif
+
+using namespace std;
+
+// 线程第一次更新计数器时按先后顺序分配分片
+static atomic<int> next_counter_shard(0);
+static thread_local int counter_shard = -1;
+
+MetricCounter::MetricCounter()
+{
+    for (int i = 0; i < shard_count; i++)
+        m_shards[i].value.store(0, memory_order_relaxed);
+}
+
+void *MetricCounter::operator new(size_t size)
+{
+    void *pointer = OSLayer::aligned_malloc(size, cache_line_size);
+    if (pointer == NULL)
+        throw bad_alloc();
+    return pointer;
+}
+
+void MetricCounter::operator delete(void *pointer)
+{
+    OSLayer::aligned_free(pointer);
+}
+
+int MetricCounter::thread_shard()
+{
+    if (counter_shard < 0)
+        counter_shard = next_counter_shard.fetch_add(1, memory_order_relaxed) % shard_count;
+    return counter_shard;
+}
+
+u64 MetricCounter::value() const
+{
+    u64 sum = 0;
+    for (int i = 0; i < shard_count; i++)
+        sum += m_shards[i].value.load(memory_order_relaxed);
+    return sum;
+}
+
+u64 MetricHistogramSnapshot::percentile(double p) const
+{
+    if (count == 0)
+        return 0;
+    u64 target = static_cast<u64>(p * count + 0.5);
+    if (target < 1)
+        target = 1;
+    if (target > count)
+        target = count;
+
+    // 返回目标所在桶的上界，最大不超过记录过的最大值
+    u64 seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        seen += buckets[i];
+        if (seen >= target)
+        {
+            if (i + 1 >= buckets.size())
+                return max;
+            u64 upper = MetricHistogram::bucket_lower_bound(static_cast<int>(i + 1)) - 1;
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+u64 MetricHistogram::bucket_lower_bound(int index)
+{
+    if (index < sub_bucket_count)
+        return index;
+    int exponent = index / sub_bucket_count + sub_bucket_bits - 1;
+    u64 sub = static_cast<u64>(index % sub_bucket_count);
+    return (sub_bucket_count + sub) << (exponent - sub_bucket_bits);
+}
+
+MetricHistogram::MetricHistogram()
+{
+    reset();
+}
+
+void MetricHistogram::snapshot(MetricHistogramSnapshot &out) const
+{
+    out.buckets.resize(bucket_count);
+    out.count = 0;
+    for (int i = 0; i < bucket_count; i++)
+    {
+        out.buckets[i] = m_buckets[i].load(memory_order_relaxed);
+        out.count += out.buckets[i];
+    }
+    // sum和max可能包含快照期间新记录的值
+    out.sum = m_sum.load(memory_order_relaxed);
+    out.max = m_max.load(memory_order_relaxed);
+}
+
+void MetricHistogram::reset()
+{
+    for (int i = 0; i < bucket_count; i++)
+        m_buckets[i].store(0, memory_order_relaxed);
+    m_sum.store(0, memory_order_relaxed);
+    m_max.store(0, memory_order_relaxed);
+}
+
+MetricsRegistry::MetricsRegistry()
+{
+    m_report_logger = NULL;
+    m_report_interval_ms = 0;
+    m_reporter_running = false;
+}
+
+MetricsRegistry::~MetricsRegistry()
+{
+    stop_reporter();
+
+    for (map<string, MetricCounter*>::iterator it = m_counters.begin(); it != m_counters.end(); ++it)
+        delete it->second;
+    for (map<string, MetricGauge*>::iterator it = m_gauges.begin(); it != m_gauges.end(); ++it)
+        delete it->second;
+    for (map<string, MetricHistogram*>::iterator it = m_histograms.begin(); it != m_histograms.end(); ++it)
+        delete it->second;
+}
+
+MetricCounter *MetricsRegistry::counter(const string &name)
+{
+    lock_guard<mutex> guard(m_mutex);
+    MetricCounter *&metric = m_counters[name];
+    if (metric == NULL)
+        metric = new MetricCounter();
+    return metric;
+}
+
+MetricGauge *MetricsRegistry::gauge(const string &name)
+{
+    lock_guard<mutex> guard(m_mutex);
+    MetricGauge *&metric = m_gauges[name];
+    if (metric == NULL)
+        metric = new MetricGauge();
+    return metric;
+}
+
+MetricHistogram *MetricsRegistry::histogram(const string &name)
+{
+    lock_guard<mutex> guard(m_mutex);
+    MetricHistogram *&metric = m_histograms[name];
+    if (metric == NULL)
+        metric = new MetricHistogram();
+    return metric;
+}
+
+void MetricsRegistry::snapshot(string &out)
+{
+    char line[256];
+    MetricHistogramSnapshot histogram;
+    out.clear();
+
+    lock_guard<mutex> guard(m_mutex);
+    for (map<string, MetricCounter*>::iterator it = m_counters.begin(); it != m_counters.end(); ++it)
+    {
+        snprintf(line, sizeof(line), " counter %llu\n", it->second->value());
+        out += it->first;
+        out += line;
+    }
+    for (map<string, MetricGauge*>::iterator it = m_gauges.begin(); it != m_gauges.end(); ++it)
+    {
+        snprintf(line, sizeof(line), " gauge %lld\n", it->second->value());
+        out += it->first;
+        out += line;
+    }
+    for (map<string, MetricHistogram*>::iterator it = m_histograms.begin(); it != m_histograms.end(); ++it)
+    {
+        it->second->snapshot(histogram);
+        snprintf(line, sizeof(line), " histogram count=%llu mean=%.1lf p50=%llu p90=%llu p99=%llu max=%llu\n",
+                 histogram.count, histogram.mean(), histogram.percentile(0.5), histogram.percentile(0.9),
+                 histogram.percentile(0.99), histogram.max);
+        out += it->first;
+        out += line;
+    }
+}
+
+void MetricsRegistry::report(Logger *logger)
+{
+    string text;
+    snapshot(text);
+
+    size_t begin = 0, end;
+    while ((end = text.find('\n', begin)) != string::npos)
+    {
+        logger->logf(LOG_LEVEL_INFO, "metric {}", text.substr(begin, end - begin));
+        begin = end + 1;
+    }
+}
+
+bool MetricsRegistry::write_snapshot(const string &file_name)
+{
+    string text;
+    snapshot(text);
+
+    // 先写入临时文件再改名，读取方不会看到写了一半的快照
+    string temp_name = file_name + ".tmp";
+    FILE *file = fopen(temp_name.c_str(), "w");
+    if (file == NULL)
+        return false;
+    bool success = fwrite(text.data(), 1, text.size(), file) == text.size();
+    success = fclose(file) == 0 && success;
+    return success && rename(temp_name.c_str(), file_name.c_str()) == 0;
+}
+
+bool MetricsRegistry::send_snapshot(const string &socket_path)
+{
+#ifdef NGWORLD_OS_UNIX
+    struct sockaddr_un address;
+    if (socket_path.size() >= sizeof(address.sun_path))
+        return false;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    string text;
+    snapshot(text);
+
+    // 数据报套接字，没有进程接收或接收方缓存已满时直接失败，不会阻塞
+    int fd = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return false;
+    ssize_t sent = ::sendto(fd, text.data(), text.size(), MSG_DONTWAIT,
+                            reinterpret_cast<struct sockaddr*>(&address), sizeof(address));
+    ::close(fd);
+    return sent == static_cast<ssize_t>(text.size());
+#elif NGWORLD_OS_WINDOWS
+#error NGWorld support for Windows platform is not implemented yet.
+#endif
+}
+
+void MetricsRegistry::start_reporter(int interval_ms, Logger *logger, const string &file_name,
+                                     const string &socket_path)
+{
+    stop_reporter();
+
+    m_report_interval_ms = interval_ms > 0 ? interval_ms : 1;
+    m_report_logger = logger;
+    m_report_file = file_name;
+    m_report_socket = socket_path;
+    m_reporter_running = true;
+    m_reporter = thread(&MetricsRegistry::reporter_main, this);
+}
+
+void MetricsRegistry::stop_reporter()
+{
+    if (!m_reporter.joinable())
+        return;
+    {
+        lock_guard<mutex> guard(m_reporter_mutex);
+        m_reporter_running = false;
+    }
+    m_reporter_wakeup.notify_one();
+    m_reporter.join();
+}
+
+void MetricsRegistry::reporter_main()
+{
+    unique_lock<mutex> lock(m_reporter_mutex);
+    while (true)
+    {
+        if (m_reporter_wakeup.wait_for(lock, chrono::milliseconds(m_report_interval_ms),
+                                       [this] { return !m_reporter_running; }))
+            break;
+
+        lock.unlock();
+        if (m_report_logger != NULL)
+            report(m_report_logger);
+        if (!m_report_file.empty())
+            write_snapshot(m_report_file);
+        if (!m_report_socket.empty())
+            send_snapshot(m_report_socket);
+        lock.lock();
+    }
+}
+
+MetricsRegistry &metrics()
+{
+    static MetricsRegistry *registry = new MetricsRegistry();
+    return *registry;
+}
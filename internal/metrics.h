@@ -0,0 +1,205 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * 文件名: metrics.h
+ * 作用: 运行时指标(计数器、仪表、延迟直方图)的注册表和定期快照
+ *
+ * 用法: 在初始化时取得指标的指针并保存下来，之后的更新都是无锁的，例如
+ *     static MetricHistogram *tick_time = metrics().histogram("server.tick_ns");
+ *     MetricTimer timer(tick_time);
+ * 注册表按名字查找指标时需要加锁，不要在热点路径中查找。
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <atomic>
+#include <map>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "fundamental_types.h"
+#include "fundamental_utility.h"
+
+class Logger;
+
+// 单调递增的计数器
+// 按线程分片，每个分片独占一条缓存行，多个线程同时累加时不会互相争抢
+class MetricCounter
+{
+private:
+    static const int shard_count = 16;
+    static const size_t cache_line_size = 64;
+    struct alignas(cache_line_size) Shard
+    {
+        std::atomic<u64> value;
+    };
+    Shard m_shards[shard_count];
+
+    static int thread_shard();
+
+public:
+    MetricCounter();
+
+    // 保证分片按缓存行对齐，用new创建的计数器也是如此
+    static void *operator new(size_t size);
+    static void operator delete(void *pointer);
+
+    void add(u64 n = 1)
+    {
+        m_shards[thread_shard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // 所有分片之和，并发更新时只是近似值
+    u64 value() const;
+};
+
+// 记录当前值的仪表，例如队列长度
+class MetricGauge
+{
+private:
+    std::atomic<s64> m_value;
+
+public:
+    MetricGauge() : m_value(0) { }
+
+    void set(s64 value) { m_value.store(value, std::memory_order_relaxed); }
+    void add(s64 delta) { m_value.fetch_add(delta, std::memory_order_relaxed); }
+    s64 value() const { return m_value.load(std::memory_order_relaxed); }
+};
+
+// 直方图的一份快照，percentile()的相对误差不超过1/16
+struct MetricHistogramSnapshot
+{
+    u64 count;
+    u64 sum;
+    u64 max;
+    std::vector<u64> buckets;
+
+    double mean() const { return count > 0 ? static_cast<double>(sum) / count : 0.0; }
+    // p取值0~1，例如0.99
+    u64 percentile(double p) const;
+};
+
+// 对数线性(HDR风格)直方图，用于记录延迟等非负整数
+// 每个2的幂区间再等分为16个桶，小于16的值每个值一个桶，共976个桶，
+// 覆盖整个u64范围。记录一个值只需要几次原子加法。
+class MetricHistogram
+{
+public:
+    static const int sub_bucket_bits = 4;
+    static const int sub_bucket_count = 1 << sub_bucket_bits;
+    static const int bucket_count = (64 - sub_bucket_bits + 1) * sub_bucket_count;
+
+    static int bucket_index(u64 value)
+    {
+        if (value < static_cast<u64>(sub_bucket_count))
+            return static_cast<int>(value);
+        int exponent = 63 - __builtin_clzll(value);
+        return (exponent - sub_bucket_bits + 1) * sub_bucket_count +
+            static_cast<int>((value >> (exponent - sub_bucket_bits)) & (sub_bucket_count - 1));
+    }
+    // 桶中最小的值
+    static u64 bucket_lower_bound(int index);
+
+private:
+    std::atomic<u64> m_buckets[bucket_count];
+    std::atomic<u64> m_sum;
+    std::atomic<u64> m_max;
+
+public:
+    MetricHistogram();
+
+    void record(u64 value)
+    {
+        m_buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+        u64 max = m_max.load(std::memory_order_relaxed);
+        while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+            ;
+    }
+
+    void snapshot(MetricHistogramSnapshot &out) const;
+    void reset();
+};
+
+// 作用域计时器，析构时把经过的纳秒数记录到直方图中
+class MetricTimer
+{
+private:
+    MetricHistogram *m_histogram;
+    u64 m_start;
+
+public:
+    explicit MetricTimer(MetricHistogram *histogram) : m_histogram(histogram), m_start(OSLayer::fast_ns()) { }
+    ~MetricTimer() { m_histogram->record(OSLayer::fast_ns() - m_start); }
+};
+
+class MetricsRegistry
+{
+private:
+    std::mutex m_mutex; // 保护三个表和输出设置
+    std::map<std::string, MetricCounter*> m_counters;
+    std::map<std::string, MetricGauge*> m_gauges;
+    std::map<std::string, MetricHistogram*> m_histograms;
+
+    // 定期快照
+    Logger *m_report_logger;
+    std::string m_report_file;
+    std::string m_report_socket;
+    int m_report_interval_ms;
+    std::thread m_reporter;
+    bool m_reporter_running;
+    std::mutex m_reporter_mutex;
+    std::condition_variable m_reporter_wakeup;
+
+    void reporter_main();
+
+public:
+    MetricsRegistry();
+    ~MetricsRegistry();
+
+    // 按名字取得指标，不存在时创建。返回的指针在注册表的整个生命周期内有效
+    MetricCounter *counter(const std::string &name);
+    MetricGauge *gauge(const std::string &name);
+    MetricHistogram *histogram(const std::string &name);
+
+    // 把所有指标写成文本，每个指标一行，依次是计数器、仪表、直方图，同类按名字排序，例如
+    // compress.bytes_in counter 1048576
+    // server.tick_ns histogram count=1200 mean=812.4 p50=790 p90=1015 p99=1535 max=4210
+    void snapshot(std::string &out);
+
+    // 快照的三种输出方式: 以INFO级别写入日志、覆盖写入文件、发送到Unix数据报套接字
+    void report(Logger *logger);
+    bool write_snapshot(const std::string &file_name);
+    bool send_snapshot(const std::string &socket_path);
+
+    // 启动后台线程，每隔interval_ms输出一次快照。logger为NULL或字符串为空时跳过对应的输出
+    // 在释放logger之前必须先调用stop_reporter()
+    void start_reporter(int interval_ms, Logger *logger, const std::string &file_name = "",
+                        const std::string &socket_path = "");
+    void stop_reporter();
+};
+
+// 全局的指标注册表，第一次调用时创建，程序退出时不会释放
+MetricsRegistry &metrics();
+
+#endif
@@ -0,0 +1,331 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "noise.h"
+#include <cmath>
+#include <cfloat>
+using namespace std;
+
+// 求x所在的格点下标(对256取模，噪声在每个方向上的周期都是256)和x在格内的位置[0, 1)。
+// |x| >= 2^52的double都是整数，先按周期取模，结果不变，而且转换成整数时不会溢出。
+// 2^52以内用64位整数，世界坐标乘以各层的频率之后超过int的范围也没有问题
+static inline int lattice_cell(double x, double *fraction)
+{
+    if (!(fabs(x) < 4503599627370496.0))
+        x = (fabs(x) <= DBL_MAX) ? fmod(x, 256.0) : 0; // 无穷大和非数当作0
+    long long i = static_cast<long long>(x);
+    if (x < i)
+        --i;
+    *fraction = x - i;
+    return static_cast<int>(i & 255);
+}
+
+// 5次平滑曲线 6t^5 - 15t^4 + 10t^3
+static inline double fade(double t)
+{
+    return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+static inline double lerp(double t, double a, double b)
+{
+    return a + t * (b - a);
+}
+
+// 梯度方向表，用查表和乘法代替分支
+// 二维取8个方向，三维取立方体12条棱的方向并补齐到16个
+static const double grad_2d_x[8] = { 1, -1, 1, -1, 1, -1, 0, 0 };
+static const double grad_2d_y[8] = { 1, 1, -1, -1, 0, 0, 1, -1 };
+
+static const double grad_3d_x[16] = { 1, -1, 1, -1, 1, -1, 1, -1, 0, 0, 0, 0, 1, 0, -1, 0 };
+static const double grad_3d_y[16] = { 1, 1, -1, -1, 0, 0, 0, 0, 1, -1, 1, -1, 1, -1, 1, -1 };
+static const double grad_3d_z[16] = { 0, 0, 0, 0, 1, 1, -1, -1, 1, 1, -1, -1, 0, 1, 0, -1 };
+
+static inline double grad_2d(int hash, double x, double y)
+{
+    return grad_2d_x[hash & 7] * x + grad_2d_y[hash & 7] * y;
+}
+
+static inline double grad_3d(int hash, double x, double y, double z)
+{
+    int h = hash & 15;
+    return grad_3d_x[h] * x + grad_3d_y[h] * y + grad_3d_z[h] * z;
+}
+
+PerlinNoise::PerlinNoise(RandGen *rng)
+{
+    int i, j, t;
+    for (i = 0; i < 256; i++)
+        m_perm[i] = i;
+
+    // Fisher-Yates洗牌
+    for (i = 255; i > 0; i--)
+    {
+        j = static_cast<int>(rng->get_u32_bounded(i + 1));
+        t = m_perm[i];
+        m_perm[i] = m_perm[j];
+        m_perm[j] = t;
+    }
+
+    for (i = 0; i < 256; i++)
+        m_perm[i + 256] = m_perm[i];
+}
+
+// 哈希按照perm[perm[perm[z] + y] + x]的顺序计算，
+// 这样同一行(y, z相同)的采样点可以共用前两层查表的结果
+
+double PerlinNoise::noise_2d(double x, double y) const
+{
+    double xf, yf;
+    int X = lattice_cell(x, &xf), Y = lattice_cell(y, &yf);
+
+    int h0 = m_perm[Y], h1 = m_perm[Y + 1];
+    double g00 = grad_2d(m_perm[h0 + X], xf, yf);
+    double g10 = grad_2d(m_perm[h0 + X + 1], xf - 1, yf);
+    double g01 = grad_2d(m_perm[h1 + X], xf, yf - 1);
+    double g11 = grad_2d(m_perm[h1 + X + 1], xf - 1, yf - 1);
+
+    double u = fade(xf), v = fade(yf);
+    return lerp(v, lerp(u, g00, g10), lerp(u, g01, g11));
+}
+
+double PerlinNoise::noise_3d(double x, double y, double z) const
+{
+    double xf, yf, zf;
+    int X = lattice_cell(x, &xf), Y = lattice_cell(y, &yf), Z = lattice_cell(z, &zf);
+
+    int h00 = m_perm[m_perm[Z] + Y], h10 = m_perm[m_perm[Z] + Y + 1];
+    int h01 = m_perm[m_perm[Z + 1] + Y], h11 = m_perm[m_perm[Z + 1] + Y + 1];
+
+    double g000 = grad_3d(m_perm[h00 + X], xf, yf, zf);
+    double g100 = grad_3d(m_perm[h00 + X + 1], xf - 1, yf, zf);
+    double g010 = grad_3d(m_perm[h10 + X], xf, yf - 1, zf);
+    double g110 = grad_3d(m_perm[h10 + X + 1], xf - 1, yf - 1, zf);
+    double g001 = grad_3d(m_perm[h01 + X], xf, yf, zf - 1);
+    double g101 = grad_3d(m_perm[h01 + X + 1], xf - 1, yf, zf - 1);
+    double g011 = grad_3d(m_perm[h11 + X], xf, yf - 1, zf - 1);
+    double g111 = grad_3d(m_perm[h11 + X + 1], xf - 1, yf - 1, zf - 1);
+
+    double u = fade(xf), v = fade(yf), w = fade(zf);
+    return lerp(w, lerp(v, lerp(u, g000, g100), lerp(u, g010, g110)),
+                   lerp(v, lerp(u, g001, g101), lerp(u, g011, g111)));
+}
+
+double PerlinNoise::fbm_2d(double x, double y, int octaves, double lacunarity, double gain) const
+{
+    double sum = 0, frequency = 1, amplitude = 1;
+    for (int i = 0; i < octaves; i++)
+    {
+        sum += amplitude * noise_2d(x * frequency, y * frequency);
+        frequency *= lacunarity;
+        amplitude *= gain;
+    }
+    return sum;
+}
+
+double PerlinNoise::fbm_3d(double x, double y, double z, int octaves, double lacunarity, double gain) const
+{
+    double sum = 0, frequency = 1, amplitude = 1;
+    for (int i = 0; i < octaves; i++)
+    {
+        sum += amplitude * noise_3d(x * frequency, y * frequency, z * frequency);
+        frequency *= lacunarity;
+        amplitude *= gain;
+    }
+    return sum;
+}
+
+double PerlinNoise::ridged_2d(double x, double y, int octaves, double lacunarity, double gain) const
+{
+    double sum = 0, frequency = 1, amplitude = 1, signal;
+    for (int i = 0; i < octaves; i++)
+    {
+        signal = 1 - fabs(noise_2d(x * frequency, y * frequency));
+        sum += amplitude * signal * signal;
+        frequency *= lacunarity;
+        amplitude *= gain;
+    }
+    return sum;
+}
+
+double PerlinNoise::ridged_3d(double x, double y, double z, int octaves, double lacunarity, double gain) const
+{
+    double sum = 0, frequency = 1, amplitude = 1, signal;
+    for (int i = 0; i < octaves; i++)
+    {
+        signal = 1 - fabs(noise_3d(x * frequency, y * frequency, z * frequency));
+        sum += amplitude * signal * signal;
+        frequency *= lacunarity;
+        amplitude *= gain;
+    }
+    return sum;
+}
+
+void PerlinNoise::grid_2d(double x0, double y0, double step, double *out) const
+{
+    grid_2d_accumulate(x0, y0, step, 1, 1, false, out);
+}
+
+void PerlinNoise::grid_2d_accumulate(double x0, double y0, double step, double frequency,
+                                                        double amplitude, bool accumulate, double *out) const
+{
+    // 每一行的x坐标都相同，先算好格点下标和小数部分
+    int X[grid_size];
+    double xf[grid_size], u[grid_size];
+    double g00[grid_size], g10[grid_size], g01[grid_size], g11[grid_size];
+    int i, j, Y, h0, h1;
+    double x, y, yf, v;
+
+    for (i = 0; i < grid_size; i++)
+    {
+        x = (x0 + i * step) * frequency;
+        X[i] = lattice_cell(x, &xf[i]);
+        u[i] = fade(xf[i]);
+    }
+
+    for (j = 0; j < grid_size; j++)
+    {
+        y = (y0 + j * step) * frequency;
+        Y = lattice_cell(y, &yf);
+        v = fade(yf);
+        h0 = m_perm[Y];
+        h1 = m_perm[Y + 1];
+
+        // 查表部分只能逐个计算
+        for (i = 0; i < grid_size; i++)
+        {
+            g00[i] = grad_2d(m_perm[h0 + X[i]], xf[i], yf);
+            g10[i] = grad_2d(m_perm[h0 + X[i] + 1], xf[i] - 1, yf);
+            g01[i] = grad_2d(m_perm[h1 + X[i]], xf[i], yf - 1);
+            g11[i] = grad_2d(m_perm[h1 + X[i] + 1], xf[i] - 1, yf - 1);
+        }
+
+        // 插值部分没有分支，可以向量化
+        double *row = out + j * grid_size;
+        if (accumulate)
+        {
+            for (i = 0; i < grid_size; i++)
+                row[i] += amplitude * lerp(v, lerp(u[i], g00[i], g10[i]), lerp(u[i], g01[i], g11[i]));
+        }
+        else
+        {
+            for (i = 0; i < grid_size; i++)
+                row[i] = lerp(v, lerp(u[i], g00[i], g10[i]), lerp(u[i], g01[i], g11[i]));
+        }
+    }
+}
+
+void PerlinNoise::grid_3d(double x0, double y0, double z0, double step, double *out) const
+{
+    grid_3d_accumulate(x0, y0, z0, step, 1, 1, false, out);
+}
+
+void PerlinNoise::grid_3d_accumulate(double x0, double y0, double z0, double step, double frequency,
+                                                        double amplitude, bool accumulate, double *out) const
+{
+    int X[grid_size];
+    double xf[grid_size], u[grid_size];
+    double g000[grid_size], g100[grid_size], g010[grid_size], g110[grid_size];
+    double g001[grid_size], g101[grid_size], g011[grid_size], g111[grid_size];
+    int i, j, k, Y, Z, h00, h10, h01, h11;
+    double x, y, z, yf, zf, v, w;
+
+    for (i = 0; i < grid_size; i++)
+    {
+        x = (x0 + i * step) * frequency;
+        X[i] = lattice_cell(x, &xf[i]);
+        u[i] = fade(xf[i]);
+    }
+
+    for (j = 0; j < grid_size; j++)
+    {
+        y = (y0 + j * step) * frequency;
+        Y = lattice_cell(y, &yf);
+        v = fade(yf);
+
+        for (k = 0; k < grid_size; k++)
+        {
+            z = (z0 + k * step) * frequency;
+            Z = lattice_cell(z, &zf);
+            w = fade(zf);
+
+            h00 = m_perm[m_perm[Z] + Y];
+            h10 = m_perm[m_perm[Z] + Y + 1];
+            h01 = m_perm[m_perm[Z + 1] + Y];
+            h11 = m_perm[m_perm[Z + 1] + Y + 1];
+
+            for (i = 0; i < grid_size; i++)
+            {
+                g000[i] = grad_3d(m_perm[h00 + X[i]], xf[i], yf, zf);
+                g100[i] = grad_3d(m_perm[h00 + X[i] + 1], xf[i] - 1, yf, zf);
+                g010[i] = grad_3d(m_perm[h10 + X[i]], xf[i], yf - 1, zf);
+                g110[i] = grad_3d(m_perm[h10 + X[i] + 1], xf[i] - 1, yf - 1, zf);
+                g001[i] = grad_3d(m_perm[h01 + X[i]], xf[i], yf, zf - 1);
+                g101[i] = grad_3d(m_perm[h01 + X[i] + 1], xf[i] - 1, yf, zf - 1);
+                g011[i] = grad_3d(m_perm[h11 + X[i]], xf[i], yf - 1, zf - 1);
+                g111[i] = grad_3d(m_perm[h11 + X[i] + 1], xf[i] - 1, yf - 1, zf - 1);
+            }
+
+            double *row = out + (j * grid_size + k) * grid_size;
+            if (accumulate)
+            {
+                for (i = 0; i < grid_size; i++)
+                    row[i] += amplitude * lerp(w, lerp(v, lerp(u[i], g000[i], g100[i]), lerp(u[i], g010[i], g110[i])),
+                                                  lerp(v, lerp(u[i], g001[i], g101[i]), lerp(u[i], g011[i], g111[i])));
+            }
+            else
+            {
+                for (i = 0; i < grid_size; i++)
+                    row[i] = lerp(w, lerp(v, lerp(u[i], g000[i], g100[i]), lerp(u[i], g010[i], g110[i])),
+                                     lerp(v, lerp(u[i], g001[i], g101[i]), lerp(u[i], g011[i], g111[i])));
+            }
+        }
+    }
+}
+
+void PerlinNoise::fbm_grid_2d(double x0, double y0, double step, int octaves, double *out,
+                              double lacunarity, double gain) const
+{
+    const int count = grid_size * grid_size;
+    double frequency = 1, amplitude = 1;
+
+    for (int i = 0; i < count; i++)
+        out[i] = 0;
+    for (int octave = 0; octave < octaves; octave++)
+    {
+        grid_2d_accumulate(x0, y0, step, frequency, amplitude, true, out);
+        frequency *= lacunarity;
+        amplitude *= gain;
+    }
+}
+
+void PerlinNoise::fbm_grid_3d(double x0, double y0, double z0, double step, int octaves, double *out,
+                              double lacunarity, double gain) const
+{
+    const int count = grid_size * grid_size * grid_size;
+    double frequency = 1, amplitude = 1;
+
+    // 每层直接累加到out中，不需要32KB的临时缓冲区
+    for (int i = 0; i < count; i++)
+        out[i] = 0;
+    for (int octave = 0; octave < octaves; octave++)
+    {
+        grid_3d_accumulate(x0, y0, z0, step, frequency, amplitude, true, out);
+        frequency *= lacunarity;
+        amplitude *= gain;
+    }
+}
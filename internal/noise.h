@@ -0,0 +1,72 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NOISE_H_
+#define _NOISE_H_
+
+#include "randgen.h"
+
+// 梯度噪声(Improved Perlin Noise)
+// 参考文献: Improving Noise -- Ken Perlin, SIGGRAPH 2002
+// 返回值大约在[-1, 1]之间，在整数格点上为0。
+class PerlinNoise
+{
+private:
+    // 置换表重复一遍，省去下标取模
+    int m_perm[512];
+
+    // 第i个采样点的坐标为(x0 + i * step) * frequency，与fbm_2d/fbm_3d的计算顺序相同，
+    // 保证分形的批量结果与逐点结果完全相同。
+    // accumulate为false时把噪声写入out，为true时把amplitude倍的噪声加到out上
+    void grid_2d_accumulate(double x0, double y0, double step, double frequency,
+                            double amplitude, bool accumulate, double *out) const;
+    void grid_3d_accumulate(double x0, double y0, double z0, double step, double frequency,
+                            double amplitude, bool accumulate, double *out) const;
+
+public:
+    // 区块的边长，批量接口一次计算一个区块的全部采样点
+    static const int grid_size = 16;
+
+    // 用rng打乱置换表，同一个种子得到同一个噪声场
+    PerlinNoise(RandGen *rng);
+
+    double noise_2d(double x, double y) const;
+    double noise_3d(double x, double y, double z) const;
+
+    // 分形布朗运动(fBm): 把octaves层频率依次乘以lacunarity、振幅依次乘以gain的噪声叠加
+    double fbm_2d(double x, double y, int octaves, double lacunarity = 2.0, double gain = 0.5) const;
+    double fbm_3d(double x, double y, double z, int octaves, double lacunarity = 2.0, double gain = 0.5) const;
+
+    // 脊状分形: 每层取1 - |noise|的平方，适合生成山脊
+    double ridged_2d(double x, double y, int octaves, double lacunarity = 2.0, double gain = 0.5) const;
+    double ridged_3d(double x, double y, double z, int octaves, double lacunarity = 2.0, double gain = 0.5) const;
+
+    // 批量接口: 以(x0, y0[, z0])为起点、step为间距，计算16x16或16x16x16个采样点
+    // 二维的结果存放在out[y * 16 + x]，三维的结果存放在out[(y * 16 + z) * 16 + x]
+    // 结果与逐点调用noise_2d/noise_3d完全相同，但同一行内的哈希和插值权重只计算一次，
+    // 插值部分写成了可以被编译器自动向量化的形式(Makefile为noise.cpp单独打开-ftree-vectorize)。
+    // 没有手写SIMD，使用的指令集取决于编译选项，默认的x86-64只有SSE2，一次处理两个double。
+    void grid_2d(double x0, double y0, double step, double *out) const;
+    void grid_3d(double x0, double y0, double z0, double step, double *out) const;
+    void fbm_grid_2d(double x0, double y0, double step, int octaves, double *out,
+                     double lacunarity = 2.0, double gain = 0.5) const;
+    void fbm_grid_3d(double x0, double y0, double z0, double step, int octaves, double *out,
+                     double lacunarity = 2.0, double gain = 0.5) const;
+};
+
+#endif
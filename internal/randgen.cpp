@@ -16,12 +16,17 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "RandGen.h"
+#include "randgen.h"
 #include "fundamental_algorithm.h"
 #include <iostream>
 #include <cstdlib>
 #include <cmath>
 #include <ctime>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include "cpu_features.h"
 using namespace std;
 
 unsigned long long RandGen::get_u64()
@@ -39,7 +44,9 @@ long long RandGen::get_s64_ranged(long long x, long long y)
 {
     if(x > y)
         swap(x, y);
-    return x + get_s64() % (y - x);
+    // 在无符号数上计算区间长度，避免y - x溢出
+    unsigned long long range = static_cast<unsigned long long>(y) - static_cast<unsigned long long>(x);
+    return static_cast<long long>(static_cast<unsigned long long>(x) + get_u64_bounded(range));
 }
 
 int RandGen::get_s32()
@@ -51,7 +58,63 @@ int RandGen::get_s32_ranged(int x, int y)
 {
     if(x > y)
         swap(x, y);
-    return x + get_s32() % (y - x);
+    unsigned int range = static_cast<unsigned int>(y) - static_cast<unsigned int>(x);
+    return static_cast<int>(static_cast<unsigned int>(x) + get_u32_bounded(range));
+}
+
+// 有界随机整数: 乘法移位代替取模，拒绝采样保证严格均匀
+// 参考文献: Fast Random Integer Generation in an Interval
+// -- Daniel Lemire, ACM TOMACS 2019
+// 只有低位落在[0, 2^32 mod range)中时才需要计算一次取模并重新采样，
+// 对小区间来说几乎从不发生。
+unsigned int RandGen::get_u32_bounded(unsigned int range)
+{
+    if (range == 0)
+        return 0;
+
+    unsigned long long m = static_cast<unsigned long long>(get_u32()) * range;
+    unsigned int low = static_cast<unsigned int>(m);
+    if (low < range)
+    {
+        unsigned int threshold = (0U - range) % range;
+        while (low < threshold)
+        {
+            m = static_cast<unsigned long long>(get_u32()) * range;
+            low = static_cast<unsigned int>(m);
+        }
+    }
+    return static_cast<unsigned int>(m >> 32);
+}
+
+unsigned long long RandGen::get_u64_bounded(unsigned long long range)
+{
+    if (range == 0)
+        return 0;
+    if (range <= 0xFFFFFFFFULL)
+        return get_u32_bounded(static_cast<unsigned int>(range));
+
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 m = static_cast<unsigned __int128>(get_u64()) * range;
+    unsigned long long low = static_cast<unsigned long long>(m);
+    if (low < range)
+    {
+        unsigned long long threshold = (0ULL - range) % range;
+        while (low < threshold)
+        {
+            m = static_cast<unsigned __int128>(get_u64()) * range;
+            low = static_cast<unsigned long long>(m);
+        }
+    }
+    return static_cast<unsigned long long>(m >> 64);
+#else
+    // 没有128位整数时退回到带拒绝的取模
+    unsigned long long threshold = (0ULL - range) % range, value;
+    do
+    {
+        value = get_u64();
+    } while (value < threshold);
+    return value % range;
+#endif
 }
 
 short RandGen::get_s16()
@@ -71,7 +134,9 @@ bool RandGen::one_in(int x)
 
 bool RandGen::x_in_y(int x, int y)
 {
-    return get_s32_ranged(0, y) < x;
+    if (y <= 0)
+        return false;
+    return static_cast<int>(get_u32_bounded(static_cast<unsigned int>(y))) < x;
 }
 
 double RandGen::get_double_co()
@@ -91,6 +156,29 @@ double RandGen::get_double_ranged(double x, double y)
     return x + (y - x) * get_double_co();
 }
 
+void RandGen::fill_u32(unsigned int *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = get_u32();
+}
+
+void RandGen::fill_double(double *out, size_t n)
+{
+    // 先分段批量生成整数再统一转换，转换循环可以被编译器向量化
+    const double scale = 1.0 / 4294967296.0;
+    unsigned int tmp[256];
+    size_t count;
+    while (n > 0)
+    {
+        count = n < 256 ? n : 256;
+        fill_u32(tmp, count);
+        for (size_t i = 0; i < count; i++)
+            out[i] = tmp[i] * scale;
+        out += count;
+        n -= count;
+    }
+}
+
 bool RandGen::is_evenly_distributed()
 {
     int c0 = 0, c1 = 0;
@@ -137,6 +225,93 @@ bool RandGen::monte_carlo_calc_pi()
     return (fabs(count * 1.0 / exps - 0.7853981634) <= 0.01); // 只允许模拟结果和pi/4之间存在1%以内的误差
 }
 
+bool RandGen::chi_square_test()
+{
+    // 2^18个样本按高8位分到256个桶中，自由度为255，
+    // 统计量的期望为255，标准差约为22.6，允许偏离4个标准差。
+    // 统计量过小说明分布"过于均匀"，同样不是随机的表现。
+    const int buckets = 256, exps = 1 << 18;
+    const double expected = exps * 1.0 / buckets;
+    vector<int> count(buckets, 0);
+    unsigned int values[256];
+    int i, j;
+
+    for (i = 0; i < exps; i += 256)
+    {
+        fill_u32(values, 256);
+        for (j = 0; j < 256; j++)
+            ++count[values[j] >> 24];
+    }
+
+    double chi_square = 0;
+    for (i = 0; i < buckets; i++)
+        chi_square += (count[i] - expected) * (count[i] - expected) / expected;
+    //cout << chi_square << endl;
+    return (chi_square >= 255 - 4 * 22.6 && chi_square <= 255 + 4 * 22.6);
+}
+
+bool RandGen::serial_correlation_test()
+{
+    // 计算x[i]与x[i+1]的相关系数，理想值为0，
+    // 样本数为n时其标准差约为1/sqrt(n)，允许偏离4个标准差。
+    const int exps = 1 << 16;
+    vector<double> x(exps + 1);
+    fill_double(&x[0], exps + 1);
+
+    double sum_x = 0, sum_y = 0, sum_xx = 0, sum_yy = 0, sum_xy = 0;
+    for (int i = 0; i < exps; i++)
+    {
+        sum_x += x[i];
+        sum_y += x[i+1];
+        sum_xx += x[i] * x[i];
+        sum_yy += x[i+1] * x[i+1];
+        sum_xy += x[i] * x[i+1];
+    }
+    double cov = sum_xy - sum_x * sum_y / exps;
+    double var_x = sum_xx - sum_x * sum_x / exps;
+    double var_y = sum_yy - sum_y * sum_y / exps;
+    double r = cov / sqrt(var_x * var_y);
+    //cout << r << endl;
+    return (fabs(r) <= 4.0 / sqrt(static_cast<double>(exps)));
+}
+
+bool RandGen::birthday_spacings_test()
+{
+    // 参考文献: DIEHARD -- George Marsaglia
+    // 在长度为2^24的"一年"中取512个生日，排序后计算相邻生日的间隔，
+    // 重复出现的间隔数服从lambda = 512^3 / (4 * 2^24) = 2的泊松分布。
+    // 重复128轮，总数服从lambda = 256的泊松分布，允许偏离4个标准差。
+    const int birthdays = 512, rounds = 128;
+    const double lambda = 2.0 * rounds;
+    unsigned int days[birthdays], spacings[birthdays];
+    int duplicates = 0, i, k;
+
+    for (k = 0; k < rounds; k++)
+    {
+        fill_u32(days, birthdays);
+        for (i = 0; i < birthdays; i++)
+            days[i] >>= 8;
+        sort(days, days + birthdays);
+
+        spacings[0] = days[0];
+        for (i = 1; i < birthdays; i++)
+            spacings[i] = days[i] - days[i-1];
+        sort(spacings, spacings + birthdays);
+
+        for (i = 1; i < birthdays; i++)
+            if (spacings[i] == spacings[i-1])
+                ++duplicates;
+    }
+    //cout << duplicates << endl;
+    return (fabs(duplicates - lambda) <= 4 * sqrt(lambda));
+}
+
+bool RandGen::passes_all_tests()
+{
+    return is_evenly_distributed() && monte_carlo_calc_pi() && chi_square_test() &&
+           serial_correlation_test() && birthday_spacings_test();
+}
+
 // Mersenne Twister Random Number Generation Algorithm
 
 inline unsigned int M32(unsigned int x)
@@ -164,27 +339,83 @@ MersenneRandGen::MersenneRandGen(unsigned int k)
     seed(k);
 }
 
-void MersenneRandGen::generate_numbers()
-{
-    unsigned int y, i = 0;
+// 对[begin, end)区间内的每个i计算
+// buffer[i] = buffer[i+far_offset] ^ twist(buffer[i], buffer[i+1])
+// far_offset为period(前半段)或-diff(后半段)，两段内部的依赖距离都不小于8，
+// 所以可以一次处理4个(SSE2)或8个(AVX2)元素，结果与逐个计算完全一致。
+typedef void (*TwistRangeFunction)(unsigned int *buffer, unsigned int begin, unsigned int end, int far_offset);
 
-    while ( i < (diff-1) )
+static void twist_range_generic(unsigned int *buffer, unsigned int begin, unsigned int end, int far_offset)
+{
+    unsigned int y;
+    for (unsigned int i = begin; i < end; i++)
     {
         y = M32(buffer[i]) | L31(buffer[i+1]);
-        buffer[i] = buffer[i+period] ^ (y >> 1) ^ matrix(y);
-        ++i;
+        buffer[i] = buffer[i+far_offset] ^ (y >> 1) ^ matrix(y);
     }
+}
 
-    y = M32(buffer[i]) | L31(buffer[i+1]);
-    buffer[i] = buffer[(i+period)%buffer_size] ^ (y >> 1) ^ matrix(y);
-    ++i;
+#ifdef NGWORLD_X86
+__attribute__((target("sse2")))
+static void twist_range_sse2(unsigned int *buffer, unsigned int begin, unsigned int end, int far_offset)
+{
+    unsigned int i = begin;
+    const __m128i upper = _mm_set1_epi32(0x80000000), lower = _mm_set1_epi32(0x7FFFFFFF);
+    const __m128i one = _mm_set1_epi32(1), matrix_value = _mm_set1_epi32(0x9908b0df);
+    __m128i cur, next, far, y4, mag;
+    for (; i + 4 <= end; i += 4)
+    {
+        cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer + i));
+        next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer + i + 1));
+        far = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer + i + far_offset));
+        y4 = _mm_or_si128(_mm_and_si128(cur, upper), _mm_and_si128(next, lower));
+        mag = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(y4, one), one), matrix_value);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(buffer + i),
+                         _mm_xor_si128(_mm_xor_si128(far, _mm_srli_epi32(y4, 1)), mag));
+    }
+    twist_range_generic(buffer, i, end, far_offset);
+}
 
-    while ( i < (buffer_size-1) )
+__attribute__((target("avx2")))
+static void twist_range_avx2(unsigned int *buffer, unsigned int begin, unsigned int end, int far_offset)
+{
+    unsigned int i = begin;
+    const __m256i upper8 = _mm256_set1_epi32(0x80000000), lower8 = _mm256_set1_epi32(0x7FFFFFFF);
+    const __m256i one8 = _mm256_set1_epi32(1), matrix8 = _mm256_set1_epi32(0x9908b0df);
+    __m256i cur8, next8, far8, y8, mag8;
+    for (; i + 8 <= end; i += 8)
     {
-        y = M32(buffer[i]) | L31(buffer[i+1]);
-        buffer[i] = buffer[i-diff] ^ (y >> 1) ^ matrix(y);
-        ++i;
+        cur8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buffer + i));
+        next8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buffer + i + 1));
+        far8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buffer + i + far_offset));
+        y8 = _mm256_or_si256(_mm256_and_si256(cur8, upper8), _mm256_and_si256(next8, lower8));
+        mag8 = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_and_si256(y8, one8), one8), matrix8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(buffer + i),
+                            _mm256_xor_si256(_mm256_xor_si256(far8, _mm256_srli_epi32(y8, 1)), mag8));
     }
+    twist_range_sse2(buffer, i, end, far_offset);
+}
+#endif
+
+static const CPUDispatchVariant<TwistRangeFunction> twist_range_variants[] =
+{
+#ifdef NGWORLD_X86
+    { "avx2", cpu_feature_mask(CPU_FEATURE_AVX2), twist_range_avx2 },
+    { "sse2", cpu_feature_mask(CPU_FEATURE_SSE2), twist_range_sse2 },
+#endif
+    { "generic", 0, twist_range_generic },
+};
+
+static CPUDispatch<TwistRangeFunction> twist_range("mt19937_twist", twist_range_variants,
+    sizeof(twist_range_variants) / sizeof(twist_range_variants[0]));
+
+void MersenneRandGen::generate_numbers()
+{
+    unsigned int y;
+
+    TwistRangeFunction twist = twist_range.get();
+    twist(buffer, 0, diff, period);
+    twist(buffer, diff, buffer_size-1, -static_cast<int>(diff));
 
     y = M32(buffer[buffer_size-1]) | L31(buffer[0]);
     buffer[buffer_size-1] = buffer[period-1] ^ (y>>1) ^ matrix(y);
@@ -217,6 +448,255 @@ unsigned int MersenneRandGen::get_u32()
     return y;
 }
 
+void MersenneRandGen::fill_u32(unsigned int *out, size_t n)
+{
+    unsigned int y;
+    size_t count, i;
+    while (n > 0)
+    {
+        if ( !index )
+            generate_numbers();
+
+        // 一次取走缓存中剩余的全部数字，回火(tempering)循环可以被向量化
+        count = buffer_size - index;
+        if (count > n)
+            count = n;
+        for (i = 0; i < count; i++)
+        {
+            y = buffer[index + i];
+            y ^= y>>11;
+            y ^= y<< 7 & 0x9d2c5680;
+            y ^= y<<15 & 0xefc60000;
+            y ^= y>>18;
+            out[i] = y;
+        }
+
+        index += count;
+        if (index == buffer_size)
+            index = 0;
+        out += count;
+        n -= count;
+    }
+}
+
+bool MersenneRandGen::is_standard_mt19937()
+{
+    // 参考输出: 以5489为种子时，第10000个数应为4123659995
+    // -- Makoto Matsumoto & Takuji Nishimura, mt19937ar.c
+    MersenneRandGen gen(5489);
+    unsigned int value = 0;
+    for (int i = 0; i < 10000; i++)
+        value = gen.get_u32();
+    return value == 4123659995U;
+}
+
+// Mersenne Twister jump-ahead
+// 参考文献: Efficient Jump Ahead for F2-Linear Random Number Generators
+// -- Hiroshi Haramoto, Makoto Matsumoto, Takuji Nishimura, Francois Panneton, Pierre L'Ecuyer
+// 把624个字看作GF(2)上的状态向量s，每生成一个数就是一次线性变换T。
+// 设phi(x)为T的特征多项式，则T^n s = p(T) s，其中p(x) = x^n mod phi(x)。
+
+typedef vector<unsigned long long> GF2Polynomial;
+
+static const unsigned int mt_degree = 19937;
+static const unsigned int mt_poly_words = (2 * mt_degree + 63) / 64 + 1;
+
+static inline bool poly_bit(const GF2Polynomial &p, unsigned int i)
+{
+    return (p[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void poly_flip(GF2Polynomial &p, unsigned int i)
+{
+    p[i >> 6] ^= 1ULL << (i & 63);
+}
+
+// p ^= q << shift
+static void poly_xor_shifted(GF2Polynomial &p, const GF2Polynomial &q, unsigned int shift)
+{
+    unsigned int word_shift = shift >> 6, bit_shift = shift & 63;
+    for (size_t i = q.size(); i-- > 0; )
+    {
+        if (!q[i] || i + word_shift >= p.size())
+            continue;
+        p[i + word_shift] ^= q[i] << bit_shift;
+        if (bit_shift && i + word_shift + 1 < p.size())
+            p[i + word_shift + 1] ^= q[i] >> (64 - bit_shift);
+    }
+}
+
+// 由MT19937的输出求出特征多项式
+static GF2Polynomial compute_mt_characteristic_polynomial()
+{
+    // 输出的任何一位都满足同一个线性递推，取最低位构成2*19937项的序列，
+    // 用Berlekamp-Massey算法求出最短的线性反馈多项式C(x)
+    const unsigned int length = 2 * mt_degree;
+    MersenneRandGen gen(5489);
+    GF2Polynomial c(mt_poly_words, 0), b(mt_poly_words, 0), t, window(mt_poly_words, 0);
+    unsigned int l = 0, m = 1, n, i, d;
+    c[0] = b[0] = 1;
+
+    for (n = 0; n < length; n++)
+    {
+        // window的第i位为s[n-i]
+        for (i = mt_poly_words - 1; i > 0; i--)
+            window[i] = (window[i] << 1) | (window[i-1] >> 63);
+        window[0] = (window[0] << 1) | (gen.get_u32() & 1);
+
+        d = 0;
+        for (i = 0; i <= (l >> 6); i++)
+            d ^= __builtin_popcountll(c[i] & window[i]);
+        d &= 1;
+
+        if (!d)
+        {
+            ++m;
+        }
+        else if (2 * l <= n)
+        {
+            t = c;
+            poly_xor_shifted(c, b, m);
+            l = n + 1 - l;
+            b = t;
+            m = 1;
+        }
+        else
+        {
+            poly_xor_shifted(c, b, m);
+            ++m;
+        }
+    }
+
+    // 特征多项式是C(x)的倒序: phi(x) = x^l * C(1/x)
+    GF2Polynomial result(mt_poly_words, 0);
+    for (i = 0; i <= l; i++)
+        if (poly_bit(c, i))
+            poly_flip(result, l - i);
+    return result;
+}
+
+static const GF2Polynomial &mt_characteristic_polynomial()
+{
+    // 局部静态变量的初始化是线程安全的，只会计算一次
+    static const GF2Polynomial phi = compute_mt_characteristic_polynomial();
+    return phi;
+}
+
+// p = p mod phi，phi的最高次项为mt_degree
+static void poly_reduce(GF2Polynomial &p, const GF2Polynomial &phi, unsigned int top)
+{
+    for (unsigned int k = top + 1; k-- > mt_degree; )
+        if (poly_bit(p, k))
+            poly_xor_shifted(p, phi, k - mt_degree);
+}
+
+// 跳过2^k个块(624 * 2^k个数)的多项式x^(624 * 2^k) mod phi，k从0到mt_max_jump_power
+// 每个都由前一个平方得到，第一次用到时才计算，之后一直缓存
+static const unsigned int mt_max_jump_power = 120;
+
+// 少于2^mt_direct_discard_bits个块时直接重新生成比多项式跳跃更快
+static const unsigned int mt_direct_discard_bits = 12;
+static const unsigned long long mt_direct_discard_blocks = 1ULL << mt_direct_discard_bits;
+
+static const GF2Polynomial &mt_jump_power(unsigned int k)
+{
+    static GF2Polynomial powers[mt_max_jump_power + 1];
+    static unsigned int computed = 0;
+    static mutex powers_mutex;
+
+    lock_guard<mutex> guard(powers_mutex);
+    if (computed > k)
+        return powers[k];
+
+    const GF2Polynomial &phi = mt_characteristic_polynomial();
+    GF2Polynomial square(mt_poly_words, 0);
+    unsigned int i;
+    if (computed == 0)
+    {
+        // x^624: 从1开始乘624次x
+        GF2Polynomial &r = powers[0];
+        r.assign(mt_poly_words, 0);
+        r[0] = 1;
+        for (unsigned int step = 0; step < 624; step++)
+        {
+            for (i = mt_poly_words - 1; i > 0; i--)
+                r[i] = (r[i] << 1) | (r[i-1] >> 63);
+            r[0] <<= 1;
+            poly_reduce(r, phi, mt_degree);
+        }
+        computed = 1;
+    }
+    for (; computed <= k; computed++)
+    {
+        // GF(2)上平方就是把第i位移到第2i位
+        const GF2Polynomial &previous = powers[computed - 1];
+        fill(square.begin(), square.end(), 0);
+        for (i = 0; i < mt_degree; i++)
+            if (poly_bit(previous, i))
+                poly_flip(square, 2 * i);
+        poly_reduce(square, phi, 2 * mt_degree - 2);
+        powers[computed] = square;
+    }
+    return powers[k];
+}
+
+void MersenneRandGen::jump_by_polynomial(const unsigned long long *poly, unsigned int degree)
+{
+    // 用Horner法则计算p(T)s。这里每一步只生成一个字(T作用一次)，
+    // 当前状态由环形缓存和指针position共同表示，两个状态相加时按各自的指针对齐。
+    // buffer无论是否已经重新生成都是一个指针为0的完整状态，跳跃后index不变，
+    // 接下来仍从buffer[index]开始输出。
+    unsigned int acc[buffer_size] = {0}, position = 0, i, y;
+
+    for (unsigned int k = degree + 1; k-- > 0; )
+    {
+        // acc = T(acc)
+        y = M32(acc[position]) | L31(acc[(position + 1) % buffer_size]);
+        acc[position] = acc[(position + period) % buffer_size] ^ (y >> 1) ^ matrix(y);
+        position = (position + 1) % buffer_size;
+
+        // acc += p_k * s
+        if ((poly[k >> 6] >> (k & 63)) & 1)
+            for (i = 0; i < buffer_size; i++)
+                acc[(position + i) % buffer_size] ^= buffer[i];
+    }
+
+    for (i = 0; i < buffer_size; i++)
+        buffer[i] = acc[(position + i) % buffer_size];
+}
+
+void MersenneRandGen::discard(unsigned long long n)
+{
+    // 先对齐到缓存的边界
+    while (n > 0 && index != 0)
+    {
+        get_u32();
+        --n;
+    }
+
+    // 一次多项式跳跃约需十几毫秒，相当于直接重新生成几千个块，
+    // 所以块数的低位直接重新生成状态，高位的每一位用缓存的多项式跳跃一次
+    unsigned long long blocks = n / buffer_size;
+    for (unsigned long long i = blocks & (mt_direct_discard_blocks - 1); i > 0; i--)
+        generate_numbers();
+    for (unsigned int k = mt_direct_discard_bits; k < 64 && (blocks >> k) != 0; k++)
+        if ((blocks >> k) & 1)
+            jump_by_polynomial(&mt_jump_power(k)[0], mt_degree - 1);
+
+    // 剩下不足一块的部分直接移动指针
+    n %= buffer_size;
+    if (n > 0)
+    {
+        generate_numbers();
+        index = static_cast<unsigned int>(n);
+    }
+}
+
+void MersenneRandGen::jump()
+{
+    jump_by_polynomial(&mt_jump_power(mt_max_jump_power)[0], mt_degree - 1);
+}
+
 // Linear Recurrence Random Number Generation Algorithm
 
 LinearRandGen::LinearRandGen()
@@ -251,10 +731,320 @@ unsigned int LinearRandGen::get_u32()
     return v;
 }
 
-#if (defined __GNUC__) && (defined __RDRND__)
+void LinearRandGen::fill_u32(unsigned int *out, size_t n)
+{
+    // 状态放在局部变量中，避免每一步都写回成员
+    unsigned int value = v, a = coefficient, c = offset;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        out[i] = value = value * a + c;
+        out[i+1] = value = value * a + c;
+        out[i+2] = value = value * a + c;
+        out[i+3] = value = value * a + c;
+    }
+    for (; i < n; i++)
+        out[i] = value = value * a + c;
+    v = value;
+}
+
+void LinearRandGen::discard(unsigned long long n)
+{
+    // v -> a*v + c是仿射变换，n次复合后仍是仿射变换v -> A*v + C，
+    // 用快速幂在O(log n)内求出(A, C)
+    unsigned int total_a = 1, total_c = 0, a = coefficient, c = offset;
+    while (n > 0)
+    {
+        if (n & 1)
+        {
+            total_a = total_a * a;
+            total_c = total_c * a + c;
+        }
+        c = c * a + c;
+        a = a * a;
+        n >>= 1;
+    }
+    v = v * total_a + total_c;
+}
+
+void LinearRandGen::jump()
+{
+    discard(1ULL << 24);
+}
+
+// Philox4x32-10 Counter-based Random Number Generation Algorithm
+
+static const unsigned int philox_m0 = 0xD2511F53, philox_m1 = 0xCD9E8D57;
+static const unsigned int philox_w0 = 0x9E3779B9, philox_w1 = 0xBB67AE85;
+static const int philox_rounds = 10;
+
+PhiloxRandGen::PhiloxRandGen()
+{
+    seed((unsigned int)time(NULL));
+}
+
+PhiloxRandGen::PhiloxRandGen(unsigned int k)
+{
+    seed(k);
+}
+
+PhiloxRandGen::PhiloxRandGen(unsigned long long world_seed, int x, int y, int z)
+{
+    m_key[0] = static_cast<unsigned int>(world_seed);
+    m_key[1] = static_cast<unsigned int>(world_seed >> 32);
+
+    // 第0个字作为块序号，其余三个字放坐标
+    m_counter[0] = 0;
+    m_counter[1] = static_cast<unsigned int>(x);
+    m_counter[2] = static_cast<unsigned int>(y);
+    m_counter[3] = static_cast<unsigned int>(z);
+    m_index = 4;
+}
+
+void PhiloxRandGen::seed(unsigned int k)
+{
+    m_key[0] = k;
+    m_key[1] = 0;
+    m_counter[0] = m_counter[1] = m_counter[2] = m_counter[3] = 0;
+    m_index = 4;
+}
+
+void PhiloxRandGen::increase_counter()
+{
+    // 128位计数器加一
+    for (int i = 0; i < 4; i++)
+        if (++m_counter[i] != 0)
+            break;
+}
+
+unsigned int PhiloxRandGen::get_u32()
+{
+    if (m_index == 4)
+    {
+        philox_block(m_counter, m_key, m_output);
+        increase_counter();
+        m_index = 0;
+    }
+    return m_output[m_index++];
+}
+
+void PhiloxRandGen::philox_block(const unsigned int counter[4], const unsigned int key[2], unsigned int output[4])
+{
+    unsigned int c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    unsigned int k0 = key[0], k1 = key[1];
+    unsigned long long p0, p1;
+
+    for (int i = 0; i < philox_rounds; i++)
+    {
+        p0 = static_cast<unsigned long long>(philox_m0) * c0;
+        p1 = static_cast<unsigned long long>(philox_m1) * c2;
+        c0 = static_cast<unsigned int>(p1 >> 32) ^ c1 ^ k0;
+        c2 = static_cast<unsigned int>(p0 >> 32) ^ c3 ^ k1;
+        c1 = static_cast<unsigned int>(p1);
+        c3 = static_cast<unsigned int>(p0);
+        k0 += philox_w0;
+        k1 += philox_w1;
+    }
+
+    output[0] = c0;
+    output[1] = c1;
+    output[2] = c2;
+    output[3] = c3;
+}
+
+void PhiloxRandGen::fill_u32(unsigned int *out, size_t n)
+{
+    // 先用完上次剩下的输出
+    while (n > 0 && m_index < 4)
+    {
+        *out++ = m_output[m_index++];
+        --n;
+    }
+
+    // 整块直接写入输出
+    while (n >= 4)
+    {
+        philox_block(m_counter, m_key, out);
+        increase_counter();
+        out += 4;
+        n -= 4;
+    }
+
+    while (n > 0)
+    {
+        *out++ = get_u32();
+        --n;
+    }
+}
+
+unsigned long long PhiloxRandGen::hash(unsigned long long world_seed, int x, int y, int z)
+{
+    const unsigned int counter[4] =
+    {
+        0, static_cast<unsigned int>(x), static_cast<unsigned int>(y), static_cast<unsigned int>(z)
+    };
+    const unsigned int key[2] =
+    {
+        static_cast<unsigned int>(world_seed), static_cast<unsigned int>(world_seed >> 32)
+    };
+    unsigned int output[4];
+    philox_block(counter, key, output);
+    return (static_cast<unsigned long long>(output[0]) << 32) + output[1];
+}
+
+// Hardware-seeded Random Number Generation
+
+#ifdef NGWORLD_X86
+// Intel建议RDRAND连续失败10次以上才认为硬件出错
+static const int rdrand_retry_limit = 10;
+// RDSEED在熵池耗尽时会频繁失败，多等待一会儿
+static const int rdseed_retry_limit = 128;
+
+__attribute__((target("rdrnd")))
+static bool rdrand_u32(unsigned int *out)
+{
+    for (int i = 0; i < rdrand_retry_limit; i++)
+        if (_rdrand32_step(out))
+            return true;
+    return false;
+}
+
+__attribute__((target("rdseed")))
+static bool rdseed_u32(unsigned int *out)
+{
+    for (int i = 0; i < rdseed_retry_limit; i++)
+    {
+        if (_rdseed32_step(out))
+            return true;
+        _mm_pause();
+    }
+    return false;
+}
+#endif
+
+HardwareSeededRandGen::HardwareSeededRandGen()
+{
+    m_has_rdrand = cpu_has(CPU_FEATURE_RDRAND);
+    m_has_rdseed = cpu_has(CPU_FEATURE_RDSEED);
+    m_extra_seed = 0;
+    reseed();
+}
+
+unsigned long long HardwareSeededRandGen::get_entropy()
+{
+    unsigned int low, high;
+#ifdef NGWORLD_X86
+    if (m_has_rdseed && rdseed_u32(&low) && rdseed_u32(&high))
+        return (static_cast<unsigned long long>(high) << 32) | low;
+    if (m_has_rdrand && rdrand_u32(&low) && rdrand_u32(&high))
+        return (static_cast<unsigned long long>(high) << 32) | low;
+#endif
+    // 没有可用的硬件熵，使用操作系统的熵源(Linux上为/dev/urandom)
+    random_device device;
+    low = device();
+    high = device();
+    return (static_cast<unsigned long long>(high) << 32) | low;
+}
+
+void HardwareSeededRandGen::reseed()
+{
+    unsigned long long key = get_entropy() ^ m_extra_seed;
+    unsigned long long stream = get_entropy();
+    m_generator = PhiloxRandGen(key, static_cast<int>(stream), static_cast<int>(stream >> 32), 0);
+    m_remaining = reseed_interval;
+}
+
+void HardwareSeededRandGen::seed(unsigned int k)
+{
+    m_extra_seed = k;
+    reseed();
+}
+
+unsigned int HardwareSeededRandGen::get_u32()
+{
+    if (m_remaining == 0)
+        reseed();
+    --m_remaining;
+    return m_generator.get_u32();
+}
+
+void HardwareSeededRandGen::fill_u32(unsigned int *out, size_t n)
+{
+    size_t count;
+    while (n > 0)
+    {
+        if (m_remaining == 0)
+            reseed();
+        count = n < m_remaining ? n : m_remaining;
+        m_generator.fill_u32(out, count);
+        m_remaining -= static_cast<unsigned int>(count);
+        out += count;
+        n -= count;
+    }
+}
+
+bool HardwareSeededRandGen::has_hardware_entropy() const
+{
+    return m_has_rdrand || m_has_rdseed;
+}
+
+#ifdef NGWORLD_X86
+IntelRandGen::IntelRandGen() : m_fallback(0), m_fallback_seeded(false), m_failures(0)
+{
+}
+
+bool IntelRandGen::is_supported()
+{
+    return cpu_has(CPU_FEATURE_RDRAND);
+}
+
+unsigned int IntelRandGen::fallback_u32()
+{
+    // 第一次失败时才向操作系统取熵，正常情况下不需要这一步
+    if (!m_fallback_seeded)
+    {
+        random_device device;
+        unsigned long long key = (static_cast<unsigned long long>(device()) << 32) | device();
+        m_fallback = PhiloxRandGen(key, static_cast<int>(device()), static_cast<int>(device()), 0);
+        m_fallback_seeded = true;
+    }
+    ++m_failures;
+    return m_fallback.get_u32();
+}
+
+__attribute__((target("rdrnd")))
 unsigned int IntelRandGen::get_u32()
 {
-    _rdrand32_step(&value);
-    return value;
+    unsigned int value;
+    if (rdrand_u32(&value))
+        return value;
+    return fallback_u32();
+}
+
+__attribute__((target("rdrnd")))
+void IntelRandGen::fill_u32(unsigned int *out, size_t n)
+{
+    size_t i = 0;
+#ifdef __x86_64__
+    // 64位模式下一次RDRAND取两个数，指令次数减半
+    unsigned long long pair = 0;
+    int retry;
+    for (; i + 2 <= n; i += 2)
+    {
+        for (retry = 0; retry < rdrand_retry_limit; retry++)
+            if (_rdrand64_step(&pair))
+                break;
+        if (retry == rdrand_retry_limit)
+        {
+            out[i] = fallback_u32();
+            out[i+1] = fallback_u32();
+            continue;
+        }
+        out[i] = static_cast<unsigned int>(pair);
+        out[i+1] = static_cast<unsigned int>(pair >> 32);
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = get_u32();
 }
 #endif
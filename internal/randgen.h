@@ -20,6 +20,9 @@
 #define _RANDGEN_H_
 
 #include <immintrin.h>
+#include <cstddef>
+#include "cpu_features.h"
+
 class RandGen
 {
 public:
@@ -30,11 +33,13 @@ public:
     unsigned long long get_u64();
     long long get_s64();
     long long get_s64_ranged(long long x, long long y); // [x, y)
+    unsigned long long get_u64_bounded(unsigned long long range); // [0, range)
 
     // 32bit
     virtual unsigned int get_u32() = 0;
     int get_s32();
     int get_s32_ranged(int x, int y); // [x, y)
+    unsigned int get_u32_bounded(unsigned int range); // [0, range)
 
     // 16bit
     short get_s16();
@@ -49,9 +54,19 @@ public:
     double get_double_cc(); // returns double value in [0, 1]
     double get_double_ranged(double x, double y); // [x, y)
 
+    // 批量生成
+    // 逐个调用get_u32()每次都要经过虚函数分派，无法内联和向量化。
+    // 子类应当重写fill_u32()，在内部直接循环生成。
+    virtual void fill_u32(unsigned int *out, size_t n);
+    void fill_double(double *out, size_t n); // 每个值都在[0, 1)之间
+
     // 随机性测试
     bool is_evenly_distributed(); // 01分布均匀性测试
     bool monte_carlo_calc_pi(); // 蒙特卡洛随机落点测试
+    bool chi_square_test(); // 高8位分桶卡方检验
+    bool serial_correlation_test(); // 相邻数值的序列相关性检验
+    bool birthday_spacings_test(); // Marsaglia生日间隔检验
+    bool passes_all_tests(); // 依次运行以上全部测试
 };
 
 class MersenneRandGen : public RandGen
@@ -61,6 +76,7 @@ private:
     unsigned int buffer[buffer_size], index;
 
     void generate_numbers();
+    void jump_by_polynomial(const unsigned long long *poly, unsigned int degree);
 
 public:
     // automatically set seed to current UNIX time stamp
@@ -74,6 +90,22 @@ public:
 
     // generate an unsigned 32bit integer
     unsigned int get_u32();
+
+    // generate n unsigned 32bit integers
+    void fill_u32(unsigned int *out, size_t n);
+
+    // 检查输出序列是否与标准MT19937的参考输出一致
+    static bool is_standard_mt19937();
+
+    // 跳过接下来的n个数，复杂度O(log n)
+    // n小于624*4096时直接重新生成状态(每624个数约2微秒)，
+    // 更大时n/624的每个更高的二进制位做一次多项式跳跃(每次约十几毫秒)。
+    // 跳跃多项式在第一次用到时计算并缓存，第一次还要用Berlekamp-Massey算法求出特征多项式
+    void discard(unsigned long long n);
+
+    // 前进624*2^120个数，用于把同一个序列分给多个线程
+    // 第一次调用时要计算跳跃多项式(约一秒)，之后每次约十几毫秒
+    void jump();
 };
 
 class LinearRandGen : public RandGen
@@ -96,21 +128,121 @@ public:
 
     // generate an unsigned 32bit integer
     unsigned int get_u32();
+
+    // generate n unsigned 32bit integers
+    void fill_u32(unsigned int *out, size_t n);
+
+    // 跳过接下来的n个数，复杂度O(log n)
+    void discard(unsigned long long n);
+
+    // 前进2^24个数，用于把同一个序列分给多个线程
+    // 注意周期最多只有2^32，最多可以分出256个互不重叠的子序列
+    void jump();
 };
 
-#if (defined __GNUC__) && (defined __RDRND__)
+// Philox4x32-10 计数器模式随机数生成器
+// 参考文献: Parallel Random Numbers: As Easy as 1, 2, 3
+// -- John K. Salmon, Mark A. Moraes, Ron O. Dror, David E. Shaw (SC'11)
+// 输出只取决于(key, counter)，不存在需要顺序推进的内部状态，
+// 所以任何线程对同一个区块坐标都能得到同一串随机数，与调度顺序无关。
+class PhiloxRandGen : public RandGen
+{
+private:
+    unsigned int m_key[2], m_counter[4], m_output[4], m_index;
+
+    void increase_counter();
+
+public:
+    // automatically set seed to current UNIX time stamp
+    PhiloxRandGen();
+
+    // set seed to the given value k
+    PhiloxRandGen(unsigned int k);
+
+    // 为区块坐标(x, y, z)打开一个独立的随机数流，
+    // 每个流在重复之前可以生成2^34个32位整数
+    PhiloxRandGen(unsigned long long world_seed, int x, int y, int z);
+
+    // set seed to k
+    void seed(unsigned int k);
+
+    // generate an unsigned 32bit integer
+    unsigned int get_u32();
+
+    // generate n unsigned 32bit integers
+    void fill_u32(unsigned int *out, size_t n);
+
+    // 无状态接口: 计算一个Philox4x32-10块
+    static void philox_block(const unsigned int counter[4], const unsigned int key[2], unsigned int output[4]);
+
+    // 无状态接口: 由世界种子和坐标直接得到64位随机值，
+    // 结果与PhiloxRandGen(world_seed, x, y, z).get_u64()相同
+    static unsigned long long hash(unsigned long long world_seed, int x, int y, int z);
+};
+
+// 硬件熵播种的随机数生成器
+// RDRAND比软件生成器慢很多，所以只用RDSEED/RDRAND定期为Philox取新的密钥，
+// 平时的数字都由Philox生成。是否支持RDSEED/RDRAND在运行时通过CPUID检测，
+// 不支持或者硬件连续失败时退回到操作系统提供的熵源。
+class HardwareSeededRandGen : public RandGen
+{
+private:
+    // 每生成这么多个数重新取一次硬件熵
+    static const unsigned int reseed_interval = 1 << 20;
+
+    PhiloxRandGen m_generator;
+    unsigned int m_remaining;
+    unsigned int m_extra_seed;
+    bool m_has_rdrand, m_has_rdseed;
+
+    void reseed();
+    unsigned long long get_entropy();
+
+public:
+    HardwareSeededRandGen();
+
+    // 把k混入下一次播种使用的熵中，并立即重新播种
+    void seed(unsigned int k);
+
+    // generate an unsigned 32bit integer
+    unsigned int get_u32();
+
+    // generate n unsigned 32bit integers
+    void fill_u32(unsigned int *out, size_t n);
+
+    // 是否在使用CPU提供的硬件熵
+    bool has_hardware_entropy() const;
+};
+
+#ifdef NGWORLD_X86
 // Intel的RNRAND硬件随机数生成器
+// 不需要用-mrdrnd编译，但只能在is_supported()为true的CPU上使用
+// RDRAND连续失败(硬件出错或熵源耗尽)时不会返回旧值，而是改用操作系统熵源播种的Philox
 class IntelRandGen : public RandGen
 {
 private:
-    unsigned int value;
+    PhiloxRandGen m_fallback;
+    bool m_fallback_seeded;
+    unsigned long long m_failures;
+
+    unsigned int fallback_u32();
 
 public:
+    IntelRandGen();
+
+    static bool is_supported();
+
     // dummy function
     void seed(unsigned int k) {}
 
+    // RDRAND重试后仍然失败、由软件生成器代替的次数
+    unsigned long long failure_count() const { return m_failures; }
+
     // generate an unsigned 32bit integer
     unsigned int get_u32();
+
+    // generate n unsigned 32bit integers
+    void fill_u32(unsigned int *out, size_t n);
 };
 #endif
 
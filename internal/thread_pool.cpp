@@ -0,0 +1,343 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fundamental_utility.h"
+#include <algorithm>
+
+#ifdef NGWORLD_OS_LINUX
+// include Linux头文件
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif NGWORLD_OS_WINDOWS
+// include Windows头文件
+#error NGWorld support for Windows platform is not implemented yet.
+#endif
+
+using namespace std;
+
+// 当前线程所属的线程池和工作线程序号，池外线程为NULL和-1
+static thread_local ThreadPool *current_pool = NULL;
+static thread_local int current_worker = -1;
+
+// 空闲时自旋多少次之后才休眠
+static const int idle_spin_count = 64;
+
+// 地址处的值仍为expected时休眠，直到被futex_wake()唤醒(也可能提前返回)
+static void futex_wait(atomic<u32> *address, u32 expected)
+{
+#ifdef NGWORLD_OS_LINUX
+    ::syscall(SYS_futex, reinterpret_cast<u32*>(address), FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+#elif NGWORLD_OS_WINDOWS
+#error NGWorld support for Windows platform is not implemented yet.
+#else
+    // 其他UNIX没有futex，短暂睡眠后重新检查
+    if (address->load(memory_order_seq_cst) == expected)
+        OSLayer::sleep_us(100);
+#endif
+}
+
+static void futex_wake(atomic<u32> *address, int count)
+{
+#ifdef NGWORLD_OS_LINUX
+    ::syscall(SYS_futex, reinterpret_cast<u32*>(address), FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#elif NGWORLD_OS_WINDOWS
+#error NGWorld support for Windows platform is not implemented yet.
+#else
+    (void)address;
+    (void)count;
+#endif
+}
+
+Task::Task(const function<void()> &function) : m_function(function), m_pool(NULL), m_pending(1), m_finished(false)
+{
+    m_completing = false;
+}
+
+void Task::depends_on(Task &prerequisite)
+{
+    lock_guard<mutex> guard(prerequisite.m_lock);
+    // 前置任务已经(或正在)完成时不需要等待
+    if (prerequisite.m_completing)
+        return;
+    m_pending.fetch_add(1, memory_order_relaxed);
+    prerequisite.m_successors.push_back(this);
+}
+
+WorkStealingDeque::WorkStealingDeque(size_t capacity) : m_top(0), m_bottom(0)
+{
+    m_buffer = new atomic<Task*>[capacity];
+    m_mask = static_cast<s64>(capacity) - 1;
+}
+
+WorkStealingDeque::~WorkStealingDeque()
+{
+    delete[] m_buffer;
+}
+
+bool WorkStealingDeque::push(Task *task)
+{
+    s64 bottom = m_bottom.load(memory_order_relaxed);
+    s64 top = m_top.load(memory_order_acquire);
+    if (bottom - top > m_mask)
+        return false;
+    m_buffer[bottom & m_mask].store(task, memory_order_relaxed);
+    m_bottom.store(bottom + 1, memory_order_release);
+    return true;
+}
+
+Task *WorkStealingDeque::pop()
+{
+    s64 bottom = m_bottom.load(memory_order_relaxed) - 1;
+    m_bottom.store(bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    s64 top = m_top.load(memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        // 队列为空
+        m_bottom.store(bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    Task *task = m_buffer[bottom & m_mask].load(memory_order_relaxed);
+    if (top == bottom)
+    {
+        // 只剩最后一个，和窃取者竞争
+        if (!m_top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+            task = NULL;
+        m_bottom.store(bottom + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+Task *WorkStealingDeque::steal()
+{
+    s64 top = m_top.load(memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    s64 bottom = m_bottom.load(memory_order_acquire);
+    if (top >= bottom)
+        return NULL;
+
+    Task *task = m_buffer[top & m_mask].load(memory_order_relaxed);
+    // 失败说明被其他窃取者或所属线程抢先，由调用者决定是否重试
+    if (!m_top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+    return task;
+}
+
+ThreadPool::ThreadPool(unsigned int thread_count, const function<void(unsigned int)> &on_worker_start)
+    : m_on_worker_start(on_worker_start), m_injection_size(0), m_wake_epoch(0), m_sleeping(0), m_running(true)
+{
+    if (thread_count == 0)
+    {
+        unsigned int cores = thread::hardware_concurrency();
+        thread_count = cores > 1 ? cores - 1 : 1;
+    }
+
+    // 先创建所有队列，工作线程启动后就可能窃取任意一个队列
+    for (unsigned int i = 0; i < thread_count; i++)
+        m_workers.push_back(new Worker());
+    for (unsigned int i = 0; i < thread_count; i++)
+        m_workers[i]->thread = thread(&ThreadPool::worker_main, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    m_running.store(false, memory_order_seq_cst);
+    m_wake_epoch.fetch_add(1, memory_order_seq_cst);
+    futex_wake(&m_wake_epoch, static_cast<int>(m_workers.size()));
+
+    // 其他线程退出前仍可能窃取任意一个队列，全部退出后才能释放
+    for (size_t i = 0; i < m_workers.size(); i++)
+        m_workers[i]->thread.join();
+    for (size_t i = 0; i < m_workers.size(); i++)
+        delete m_workers[i];
+}
+
+void ThreadPool::worker_main(unsigned int index)
+{
+    current_pool = this;
+    current_worker = static_cast<int>(index);
+    if (m_on_worker_start)
+        m_on_worker_start(index);
+
+    int self = static_cast<int>(index);
+    while (true)
+    {
+        Task *task = find_task(self);
+        for (int spin = 0; task == NULL && spin < idle_spin_count; spin++)
+        {
+            OSLayer::cpu_relax();
+            task = find_task(self);
+        }
+        if (task != NULL)
+        {
+            execute(task);
+            continue;
+        }
+
+        // 先记下版本号并声明要休眠，再检查一次队列。
+        // 提交者先放入任务再递增版本号，所以要么这次检查能看到任务，
+        // 要么futex_wait()发现版本号已经变化而立即返回，要么提交者看到m_sleeping而唤醒。
+        u32 epoch = m_wake_epoch.load(memory_order_seq_cst);
+        if (!m_running.load(memory_order_seq_cst))
+            break;
+        m_sleeping.fetch_add(1, memory_order_seq_cst);
+        task = find_task(self);
+        if (task == NULL)
+            futex_wait(&m_wake_epoch, epoch);
+        m_sleeping.fetch_sub(1, memory_order_seq_cst);
+        if (task != NULL)
+            execute(task);
+    }
+
+    current_pool = NULL;
+    current_worker = -1;
+}
+
+void ThreadPool::wake_one()
+{
+    m_wake_epoch.fetch_add(1, memory_order_seq_cst);
+    if (m_sleeping.load(memory_order_seq_cst) > 0)
+        futex_wake(&m_wake_epoch, 1);
+}
+
+void ThreadPool::enqueue(Task *task)
+{
+    // 工作线程产生的任务放入自己的队列，队列满了或者来自池外线程时放入共享队列
+    if (current_pool != this || current_worker < 0 || !m_workers[current_worker]->deque.push(task))
+    {
+        lock_guard<mutex> guard(m_injection_lock);
+        m_injection_queue.push_back(task);
+        m_injection_size.fetch_add(1, memory_order_relaxed);
+    }
+    wake_one();
+}
+
+Task *ThreadPool::find_task(int self)
+{
+    Task *task;
+    if (self >= 0 && (task = m_workers[self]->deque.pop()) != NULL)
+        return task;
+
+    if (m_injection_size.load(memory_order_relaxed) > 0)
+    {
+        lock_guard<mutex> guard(m_injection_lock);
+        if (!m_injection_queue.empty())
+        {
+            task = m_injection_queue.front();
+            m_injection_queue.pop_front();
+            m_injection_size.fetch_sub(1, memory_order_relaxed);
+            return task;
+        }
+    }
+
+    // 从下一个线程开始依次窃取，避免所有线程都去窃取同一个队列
+    int count = static_cast<int>(m_workers.size());
+    for (int i = 1; i <= count; i++)
+    {
+        int victim = (self + i) % count;
+        if (victim < 0 || victim == self)
+            continue;
+        if ((task = m_workers[victim]->deque.steal()) != NULL)
+            return task;
+    }
+    return NULL;
+}
+
+void ThreadPool::execute(Task *task)
+{
+    task->m_function();
+
+    // 取出后继任务之后，depends_on()不会再向这个任务添加后继
+    vector<Task*> successors;
+    {
+        lock_guard<mutex> guard(task->m_lock);
+        task->m_completing = true;
+        successors.swap(task->m_successors);
+    }
+    for (size_t i = 0; i < successors.size(); i++)
+        if (successors[i]->m_pending.fetch_sub(1, memory_order_acq_rel) == 1)
+            successors[i]->m_pool->enqueue(successors[i]);
+
+    // 之后不能再访问task，等待者可能已经释放了它
+    task->m_finished.store(true, memory_order_release);
+}
+
+void ThreadPool::submit(Task &task)
+{
+    task.m_pool = this;
+    if (task.m_pending.fetch_sub(1, memory_order_acq_rel) == 1)
+        enqueue(&task);
+}
+
+void ThreadPool::wait(Task &task)
+{
+    int self = current_pool == this ? current_worker : -1;
+    while (!task.finished())
+    {
+        Task *other = find_task(self);
+        if (other != NULL)
+            execute(other);
+        else
+        {
+            OSLayer::cpu_relax();
+            this_thread::yield();
+        }
+    }
+}
+
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain,
+                              const function<void(size_t, size_t)> &body)
+{
+    if (end <= begin)
+        return;
+    if (grain == 0)
+        grain = 1;
+    size_t chunks = (end - begin + grain - 1) / grain;
+
+    // 每个参与的线程一个任务，从共享的计数器领取下一块，负载自动均衡
+    atomic<size_t> next_chunk(0);
+    function<void()> run = [&]()
+    {
+        size_t chunk;
+        while ((chunk = next_chunk.fetch_add(1, memory_order_relaxed)) < chunks)
+        {
+            size_t chunk_begin = begin + chunk * grain;
+            body(chunk_begin, min(end, chunk_begin + grain));
+        }
+    };
+
+    size_t helper_count = min(chunks, m_workers.size() + 1) - 1;
+    vector<Task*> helpers;
+    for (size_t i = 0; i < helper_count; i++)
+    {
+        helpers.push_back(new Task(run));
+        submit(*helpers.back());
+    }
+
+    // 调用者自己也参与，没有空闲工作线程时所有块都在这里完成
+    run();
+
+    for (size_t i = 0; i < helpers.size(); i++)
+    {
+        wait(*helpers[i]);
+        delete helpers[i];
+    }
+}
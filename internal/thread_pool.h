@@ -0,0 +1,150 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * 文件名: thread_pool.h
+ * 作用: 工作窃取(work-stealing)线程池，通过fundamental_utility.h引入
+ *
+ * 每个工作线程有自己的Chase-Lev双端队列，从队尾压入和取出自己产生的任务，
+ * 空闲时从其他线程的队头窃取。不在线程池中的线程提交的任务放入一个共享队列。
+ * 没有任务可做的工作线程在futex上休眠，有新任务时再唤醒。
+ */
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <cstddef>
+#include "fundamental_types.h"
+
+class ThreadPool;
+
+// 任务对象由调用者持有，提交之后到完成之前不能被释放。例如
+//     Task load([&] { load_chunk(); });
+//     Task light([&] { compute_light(); });
+//     light.depends_on(load);
+//     pool.submit(load);
+//     pool.submit(light);
+//     pool.wait(light);
+class Task
+{
+    friend class ThreadPool;
+
+private:
+    std::function<void()> m_function;
+    ThreadPool *m_pool;
+    // 尚未完成的前置任务数，加上1表示还没有提交，为0时可以执行
+    std::atomic<int> m_pending;
+    // 完成后不再访问任务对象的任何成员，wait()看到它之后就可以释放任务
+    std::atomic<bool> m_finished;
+
+    std::mutex m_lock; // 保护下面两个成员
+    bool m_completing;
+    std::vector<Task*> m_successors;
+
+public:
+    explicit Task(const std::function<void()> &function);
+
+    // 声明必须在prerequisite完成之后才能执行，只能在提交本任务之前调用
+    void depends_on(Task &prerequisite);
+
+    bool finished() const { return m_finished.load(std::memory_order_acquire); }
+};
+
+// Chase-Lev工作窃取双端队列，容量固定
+// 参考: Correct and Efficient Work-Stealing for Weak Memory Models -- Lê, Pop, Cohen, Nardelli
+// 只有所属线程可以push()和pop()，任何线程都可以steal()
+class WorkStealingDeque
+{
+private:
+    std::atomic<s64> m_top;
+    std::atomic<s64> m_bottom;
+    std::atomic<Task*> *m_buffer;
+    s64 m_mask;
+
+public:
+    // capacity必须是2的幂
+    explicit WorkStealingDeque(size_t capacity);
+    ~WorkStealingDeque();
+
+    // 队列已满时返回false
+    bool push(Task *task);
+    Task *pop();
+    Task *steal();
+};
+
+class ThreadPool
+{
+private:
+    static const size_t deque_capacity = 4096;
+
+    struct Worker
+    {
+        WorkStealingDeque deque;
+        std::thread thread;
+
+        Worker() : deque(deque_capacity) { }
+    };
+
+    std::vector<Worker*> m_workers;
+    std::function<void(unsigned int)> m_on_worker_start;
+
+    // 池外线程提交的任务
+    std::mutex m_injection_lock;
+    std::deque<Task*> m_injection_queue;
+    std::atomic<size_t> m_injection_size;
+
+    // 空闲的工作线程在m_wake_epoch上休眠，每次有新任务时递增并唤醒
+    std::atomic<u32> m_wake_epoch;
+    std::atomic<int> m_sleeping;
+    std::atomic<bool> m_running;
+
+    void worker_main(unsigned int index);
+    void enqueue(Task *task);
+    Task *find_task(int self);
+    void execute(Task *task);
+    void wake_one();
+
+public:
+    // thread_count为0时使用CPU核数减1个工作线程，调用wait()的线程也会帮忙执行任务
+    // on_worker_start在每个工作线程开始时以线程序号调用，例如用于set_thread_rng_index()，
+    // 或者把工作线程分散固定到各个NUMA节点上:
+    //     std::vector<int> cpus = OSLayer::cpu_topology().spread_cpus(n);
+    //     ThreadPool pool(n, [cpus](unsigned int i) { OSLayer::set_thread_affinity(cpus[i]); });
+    explicit ThreadPool(unsigned int thread_count = 0,
+                        const std::function<void(unsigned int)> &on_worker_start = std::function<void(unsigned int)>());
+    // 等待所有工作线程退出，此时不能还有未完成的任务
+    ~ThreadPool();
+
+    unsigned int thread_count() const { return static_cast<unsigned int>(m_workers.size()); }
+
+    // 提交任务，前置任务都完成后才会执行
+    void submit(Task &task);
+    // 等待任务完成，等待期间当前线程也会执行其他任务
+    void wait(Task &task);
+
+    // 把[begin, end)分成每块grain个元素，并行调用body(块的开始, 块的结束)，全部完成后返回
+    void parallel_for(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)> &body);
+};
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trace.h"
+#include <cstdio>
+#include <vector>
+#include <mutex>
+using namespace std;
+
+atomic<bool> trace_enabled(false);
+
+struct TraceEvent
+{
+    const char *name;
+    u64 begin;
+    u64 duration;
+};
+
+// 每个线程的环形缓存，只有所属线程写入
+// write_index只增不减，导出时据此判断哪些事件在复制期间被覆盖
+struct TraceBuffer
+{
+    u32 thread_id;
+    string thread_name;
+    vector<TraceEvent> events;
+    atomic<u64> write_index;
+
+    TraceBuffer(u32 id) : thread_id(id), events(trace_buffer_capacity), write_index(0) { }
+};
+
+// 线程退出后缓存仍然保留，导出时还能看到它的事件
+static mutex trace_registry_mutex;
+static vector<TraceBuffer*> trace_buffers;
+static thread_local TraceBuffer *thread_trace_buffer = NULL;
+
+// 事件时间相对于这里，JSON中的时间单位是微秒
+static const u64 trace_time_base = OSLayer::fast_ns();
+
+static TraceBuffer *get_trace_buffer()
+{
+    if (thread_trace_buffer == NULL)
+    {
+        lock_guard<mutex> guard(trace_registry_mutex);
+        thread_trace_buffer = new TraceBuffer(static_cast<u32>(trace_buffers.size()) + 1);
+        trace_buffers.push_back(thread_trace_buffer);
+    }
+    return thread_trace_buffer;
+}
+
+void trace_start()
+{
+    trace_enabled.store(true, memory_order_relaxed);
+}
+
+void trace_stop()
+{
+    trace_enabled.store(false, memory_order_relaxed);
+}
+
+void trace_clear()
+{
+    lock_guard<mutex> guard(trace_registry_mutex);
+    for (size_t i = 0; i < trace_buffers.size(); i++)
+        trace_buffers[i]->write_index.store(0, memory_order_release);
+}
+
+void trace_set_thread_name(const string &name)
+{
+    TraceBuffer *buffer = get_trace_buffer();
+    lock_guard<mutex> guard(trace_registry_mutex);
+    buffer->thread_name = name;
+}
+
+void trace_record(const char *name, u64 begin_ns, u64 end_ns)
+{
+    TraceBuffer *buffer = get_trace_buffer();
+    u64 index = buffer->write_index.load(memory_order_relaxed);
+    TraceEvent &event = buffer->events[index & (trace_buffer_capacity - 1)];
+    event.name = name;
+    event.begin = begin_ns;
+    event.duration = end_ns - begin_ns;
+    buffer->write_index.store(index + 1, memory_order_release);
+}
+
+// 输出JSON字符串，只转义引号、反斜杠和控制字符
+static void write_json_string(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for (const char *p = str; *p; ++p)
+    {
+        unsigned char c = static_cast<unsigned char>(*p);
+        if (c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(file, "\\u%04x", c);
+        else
+            fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+bool trace_export(const string &file_name)
+{
+    FILE *file = fopen(file_name.c_str(), "w");
+    if (file == NULL)
+        return false;
+
+    vector<TraceEvent> events;
+    bool first = true;
+    fputs("{\"traceEvents\":[", file);
+
+    lock_guard<mutex> guard(trace_registry_mutex);
+    for (size_t i = 0; i < trace_buffers.size(); i++)
+    {
+        TraceBuffer *buffer = trace_buffers[i];
+
+        if (!buffer->thread_name.empty())
+        {
+            fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                    first ? "" : ",", buffer->thread_id);
+            write_json_string(file, buffer->thread_name.c_str());
+            fputs("}}", file);
+            first = false;
+        }
+
+        // 先复制再检查，复制期间可能已被所属线程覆盖的事件全部丢弃
+        u64 end = buffer->write_index.load(memory_order_acquire);
+        u64 begin = end > trace_buffer_capacity ? end - trace_buffer_capacity : 0;
+        events.clear();
+        for (u64 index = begin; index < end; index++)
+            events.push_back(buffer->events[index & (trace_buffer_capacity - 1)]);
+        // 复制的读取不能推迟到再次读取write_index之后
+        atomic_thread_fence(memory_order_acquire);
+        // 所属线程先写事件再递增write_index，读到overwritten时它可能正在写第overwritten个事件，
+        // 这个位置上原来的第overwritten - capacity个事件也要丢弃
+        u64 overwritten = buffer->write_index.load(memory_order_relaxed) + 1;
+        u64 valid_begin = overwritten > trace_buffer_capacity ? overwritten - trace_buffer_capacity : 0;
+
+        for (u64 index = begin; index < end; index++)
+        {
+            if (index < valid_begin)
+                continue;
+            const TraceEvent &event = events[index - begin];
+            u64 relative = event.begin > trace_time_base ? event.begin - trace_time_base : 0;
+            fprintf(file, "%s\n{\"name\":", first ? "" : ",");
+            write_json_string(file, event.name);
+            fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03llu,\"dur\":%llu.%03llu}",
+                    buffer->thread_id, relative / 1000, relative % 1000,
+                    event.duration / 1000, event.duration % 1000);
+            first = false;
+        }
+    }
+
+    fputs("\n]}\n", file);
+    return fclose(file) == 0;
+}
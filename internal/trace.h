@@ -0,0 +1,97 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * 文件名: trace.h
+ * 作用: 作用域跟踪，导出为Chrome trace_event格式的JSON，可以用Perfetto或chrome://tracing查看
+ *
+ * 用法:
+ *     void generate_chunk()
+ *     {
+ *         NGW_TRACE_SCOPE("chunk_gen");
+ *         ...
+ *     }
+ *     trace_start();
+ *     ...
+ *     trace_stop();
+ *     trace_export("ngworld.trace.json");
+ *
+ * 每个作用域结束时记录一个完整事件(开始时间和持续时间)，写入当前线程的环形缓存，
+ * 缓存写满后覆盖最旧的事件。未调用trace_start()时每个作用域只多一次原子读取；
+ * 用NOTRACE=1编译时NGW_TRACE_SCOPE被完全删除。
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <atomic>
+#include <string>
+#include "fundamental_types.h"
+#include "fundamental_utility.h"
+
+// 运行时开关，由trace_start()和trace_stop()设置
+extern std::atomic<bool> trace_enabled;
+
+// 每个线程的环形缓存能容纳的事件数
+static const size_t trace_buffer_capacity = 1 << 16;
+
+// 开始和停止记录，已经记录的事件保留到trace_clear()，trace_clear()只能在trace_stop()之后调用
+void trace_start();
+void trace_stop();
+void trace_clear();
+
+// 在当前线程的事件中显示的线程名，例如"worker 3"
+void trace_set_thread_name(const std::string &name);
+
+// 把所有线程缓存中的事件写成JSON文件。最好在trace_stop()之后调用，
+// 否则正在被覆盖的事件会被丢弃。导出时无法知道所属线程是否正在写入，
+// 写满的缓存中最旧的一个事件总是被丢弃，每个线程最多导出trace_buffer_capacity - 1个事件
+bool trace_export(const std::string &file_name);
+
+// 记录一个完整事件，name必须是字符串常量(只保存指针)
+void trace_record(const char *name, u64 begin_ns, u64 end_ns);
+
+class TraceScope
+{
+private:
+    const char *m_name;
+    u64 m_begin;
+
+public:
+    explicit TraceScope(const char *name) : m_name(name)
+    {
+        m_begin = trace_enabled.load(std::memory_order_relaxed) ? OSLayer::fast_ns() : 0;
+    }
+
+    ~TraceScope()
+    {
+        if (m_begin != 0)
+            trace_record(m_name, m_begin, OSLayer::fast_ns());
+    }
+};
+
+#define NGW_TRACE_CONCAT_IMPL(a, b) a##b
+#define NGW_TRACE_CONCAT(a, b) NGW_TRACE_CONCAT_IMPL(a, b)
+
+#ifndef NGWORLD_NO_TRACE
+#define NGW_TRACE_SCOPE(name) TraceScope NGW_TRACE_CONCAT(ngw_trace_scope_, __LINE__)(name)
+#else
+#define NGW_TRACE_SCOPE(name) static_cast<void>(0)
+#endif
+
+#endif
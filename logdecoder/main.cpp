@@ -0,0 +1,32 @@
+/*
+ *  This file is part of NGWorld.
+ *
+ *  NGWorld is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NGWorld is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NGWorld.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "binary_log.h"
+#include <cstdio>
+
+// 用法: logdecoder [ngworld.blog]
+int main(int argc, char *argv[])
+{
+    const char *file_name = argc > 1 ? argv[1] : "ngworld.blog";
+    std::string error;
+    if (!decode_binary_log(file_name, stdout, &error))
+    {
+        fprintf(stderr, "logdecoder: failed to decode %s: %s\n", file_name, error.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,376 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "allocator.h"
+#include "randgen.h"
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <vector>
+using namespace std;
+
+static bool is_aligned(const void *pointer, size_t alignment)
+{
+    return (reinterpret_cast<size_t>(pointer) & (alignment - 1)) == 0;
+}
+
+NGW_TEST(arena_alignment)
+{
+    FrameArena arena(4096);
+    vector<pair<unsigned char*, size_t> > allocations;
+    bool ok = true;
+    for (int round = 0; round < 3; round++)
+        for (size_t alignment = 1; alignment <= 1024; alignment *= 2)
+        {
+            size_t size = 1 + (alignment * 7 + round * 13) % 300;
+            unsigned char *p = static_cast<unsigned char*>(arena.allocate(size, alignment));
+            ok = ok && p != NULL && is_aligned(p, alignment);
+            memset(p, static_cast<int>(allocations.size()), size);
+            allocations.push_back(make_pair(p, size));
+        }
+    // 分配的内存互不重叠: 后面的写入没有覆盖前面的内容
+    for (size_t i = 0; i < allocations.size(); i++)
+        for (size_t j = 0; j < allocations[i].second; j++)
+            ok = ok && allocations[i].first[j] == static_cast<unsigned char>(i);
+    NGW_CHECK(ok);
+
+    double *values = arena.allocate_array<double>(100);
+    NGW_CHECK(is_aligned(values, alignof(double)));
+    struct Point { int x, y; Point(int _x, int _y) : x(_x), y(_y) { } };
+    Point *point = arena.create<Point>(3, 4);
+    NGW_CHECK(point->x == 3 && point->y == 4);
+}
+
+NGW_TEST(arena_reset_reuses_blocks)
+{
+    // 每帧的分配总量超过一个块，包括一个比块还大的分配
+    FrameArena arena(4096);
+    vector<void*> first_frame;
+    size_t capacity = 0;
+    bool same = true;
+    for (int frame = 0; frame < 100; frame++)
+    {
+        for (int i = 0; i < 200; i++)
+        {
+            void *p = arena.allocate(16 + (i % 5) * 24, 16);
+            if (frame == 0)
+                first_frame.push_back(p);
+            else
+                same = same && first_frame[i] == p;
+        }
+        void *big = arena.allocate(3 * 4096);
+        if (frame == 0)
+        {
+            first_frame.push_back(big);
+            capacity = arena.capacity();
+        }
+        else
+            same = same && first_frame[200] == big;
+        NGW_CHECK(arena.bytes_used() > 200 * 16 + 3 * 4096);
+        arena.reset();
+        NGW_CHECK(arena.bytes_used() == 0);
+    }
+    NGW_CHECK(same);
+    // 稳定状态下不再申请新块
+    NGW_CHECK(arena.capacity() == capacity);
+    NGW_CHECK(capacity >= 3 * 4096);
+    NGW_CHECK(arena.peak_bytes_used() > 3 * 4096);
+
+    arena.release();
+    NGW_CHECK(arena.capacity() == 0 && arena.peak_bytes_used() == 0);
+    NGW_CHECK(arena.allocate(10) != NULL);
+}
+
+NGW_TEST(arena_mark_rewind)
+{
+    FrameArena arena(1024);
+    arena.allocate(100);
+    FrameArena::Marker marker = arena.mark();
+    size_t used = arena.bytes_used();
+
+    // 跨越多个块之后回到标记处
+    void *after_mark = arena.allocate(64, 16);
+    for (int i = 0; i < 50; i++)
+        arena.allocate(100);
+    size_t capacity = arena.capacity();
+    arena.rewind(marker);
+    NGW_CHECK(arena.bytes_used() == used);
+    NGW_CHECK(arena.allocate(64, 16) == after_mark);
+
+    // 回退之后再分配同样多的内存，使用已有的块
+    for (int i = 0; i < 50; i++)
+        arena.allocate(100);
+    NGW_CHECK(arena.capacity() == capacity);
+}
+
+NGW_TEST(fixed_size_pool_reuse)
+{
+    FixedSizePool pool(40, 16);
+    NGW_CHECK(pool.slot_size() >= 40 && pool.slot_size() % alignof(max_align_t) == 0);
+
+    vector<void*> slots;
+    bool ok = true;
+    for (int i = 0; i < 100; i++)
+    {
+        slots.push_back(pool.allocate());
+        ok = ok && is_aligned(slots.back(), alignof(max_align_t));
+        memset(slots.back(), i, 40);
+    }
+    NGW_CHECK(ok);
+    NGW_CHECK(pool.live_count() == 100);
+    size_t capacity = pool.capacity();
+    NGW_CHECK(capacity >= 100 && capacity % 16 == 0);
+
+    // 释放的格子被下一次分配优先使用
+    pool.deallocate(slots[37]);
+    NGW_CHECK(pool.live_count() == 99);
+    NGW_CHECK(pool.allocate() == slots[37]);
+    for (size_t i = 0; i < slots.size(); i++)
+        pool.deallocate(slots[i]);
+    NGW_CHECK(pool.live_count() == 0);
+    for (int i = 0; i < 100; i++)
+        pool.allocate();
+    NGW_CHECK(pool.capacity() == capacity);
+}
+
+struct CountedObject
+{
+    static int alive;
+    int value;
+    CountedObject(int v) : value(v) { ++alive; }
+    ~CountedObject() { --alive; }
+};
+
+int CountedObject::alive = 0;
+
+NGW_TEST(object_pool)
+{
+    ObjectPool<CountedObject> pool(8);
+    vector<CountedObject*> objects;
+    for (int i = 0; i < 20; i++)
+        objects.push_back(pool.create(i));
+    NGW_CHECK(CountedObject::alive == 20 && pool.live_count() == 20);
+    NGW_CHECK(objects[13]->value == 13);
+
+    CountedObject *freed = objects[5];
+    pool.destroy(freed);
+    NGW_CHECK(CountedObject::alive == 19 && pool.live_count() == 19);
+    objects[5] = pool.create(500);
+    NGW_CHECK(objects[5] == freed && objects[5]->value == 500);
+
+    pool.destroy(NULL);
+    for (size_t i = 0; i < objects.size(); i++)
+        pool.destroy(objects[i]);
+    NGW_CHECK(CountedObject::alive == 0 && pool.live_count() == 0);
+}
+
+NGW_TEST(pool_resource_size_classes)
+{
+    PoolResource resource(8);
+    bool ok = true;
+    for (size_t size = 0; size <= 300; size++)
+    {
+        unsigned char *p = static_cast<unsigned char*>(resource.allocate(size));
+        ok = ok && p != NULL && is_aligned(p, alignof(max_align_t));
+        memset(p, 0xAB, size);
+        resource.deallocate(p, size);
+        // 同一个大小级别内释放之后再分配得到同一块内存
+        if (size > 0 && size <= 256)
+            ok = ok && resource.allocate(size) == p;
+        else
+            resource.deallocate(resource.allocate(size), size);
+    }
+    NGW_CHECK(ok);
+}
+
+NGW_TEST(stl_allocator_adapters)
+{
+    FrameArena arena;
+    {
+        vector<int, ArenaAllocator<int> > values((ArenaAllocator<int>(&arena)));
+        for (int i = 0; i < 10000; i++)
+            values.push_back(i);
+        bool ok = true;
+        for (int i = 0; i < 10000; i++)
+            ok = ok && values[i] == i;
+        NGW_CHECK(ok);
+        NGW_CHECK(arena.bytes_used() >= 10000 * sizeof(int));
+    }
+    NGW_CHECK(ArenaAllocator<int>(&arena) == ArenaAllocator<double>(&arena));
+
+    PoolResource resource;
+    typedef PoolAllocator<pair<const int, int> > MapAllocator;
+    {
+        MapAllocator allocator(&resource);
+        map<int, int, less<int>, MapAllocator> chunks(less<int>(), allocator);
+        MersenneRandGen rng(1);
+        map<int, int> reference;
+        for (int i = 0; i < 20000; i++)
+        {
+            int key = rng.get_s32_ranged(0, 2000);
+            if (rng.one_in(3))
+            {
+                chunks.erase(key);
+                reference.erase(key);
+            }
+            else
+            {
+                chunks[key] = i;
+                reference[key] = i;
+            }
+        }
+        NGW_CHECK(chunks.size() == reference.size());
+        NGW_CHECK(equal(chunks.begin(), chunks.end(), reference.begin()));
+
+        list<int, PoolAllocator<int> > queue((PoolAllocator<int>(&resource)));
+        for (int i = 0; i < 1000; i++)
+            queue.push_back(i);
+        NGW_CHECK(queue.size() == 1000 && queue.back() == 999);
+    }
+    NGW_CHECK(PoolAllocator<int>(&resource) != PoolAllocator<int>(NULL));
+}
+
+// 与malloc/free比较的分配密集负载
+
+static const int bench_frames = 200, bench_allocations = 10000;
+
+NGW_BENCHMARK(arena_vs_malloc)
+{
+    // 一个tick内分配大量16到256字节的临时对象，tick结束时全部释放
+    vector<size_t> sizes(bench_allocations);
+    MersenneRandGen rng(1);
+    for (int i = 0; i < bench_allocations; i++)
+        sizes[i] = 16 + rng.get_u32_bounded(241);
+    vector<void*> pointers(bench_allocations);
+    const double count = static_cast<double>(bench_frames) * bench_allocations;
+    u64 sum = 0;
+
+    BenchTimer timer;
+    for (int frame = 0; frame < bench_frames; frame++)
+    {
+        for (int i = 0; i < bench_allocations; i++)
+        {
+            pointers[i] = malloc(sizes[i]);
+            *static_cast<char*>(pointers[i]) = static_cast<char>(i);
+        }
+        sum += *static_cast<char*>(pointers[frame]);
+        for (int i = 0; i < bench_allocations; i++)
+            free(pointers[i]);
+    }
+    bench_report("malloc/free per tick", timer.elapsed_ns() / count, "ns/allocation");
+
+    FrameArena arena;
+    timer.restart();
+    for (int frame = 0; frame < bench_frames; frame++)
+    {
+        for (int i = 0; i < bench_allocations; i++)
+        {
+            pointers[i] = arena.allocate(sizes[i]);
+            *static_cast<char*>(pointers[i]) = static_cast<char>(i);
+        }
+        sum += *static_cast<char*>(pointers[frame]);
+        arena.reset();
+    }
+    bench_report("FrameArena + reset per tick", timer.elapsed_ns() / count, "ns/allocation");
+
+    bench_sink += sum;
+}
+
+struct BenchEntity
+{
+    double position[3], velocity[3];
+    int id;
+    BenchEntity(int _id) : id(_id) { }
+};
+
+NGW_BENCHMARK(object_pool_vs_new)
+{
+    // 实体不断生成和消失，按随机顺序销毁
+    const int live = 10000, operations = 2000000;
+    vector<BenchEntity*> entities(live);
+    MersenneRandGen rng(1);
+    vector<unsigned int> victims(operations);
+    rng.fill_u32(&victims[0], operations);
+    u64 sum = 0;
+
+    for (int i = 0; i < live; i++)
+        entities[i] = new BenchEntity(i);
+    BenchTimer timer;
+    for (int i = 0; i < operations; i++)
+    {
+        unsigned int victim = victims[i] % live;
+        sum += entities[victim]->id;
+        delete entities[victim];
+        entities[victim] = new BenchEntity(i);
+    }
+    bench_report("new/delete churn", timer.elapsed_ns() / operations, "ns/operation");
+    for (int i = 0; i < live; i++)
+        delete entities[i];
+
+    ObjectPool<BenchEntity> pool;
+    for (int i = 0; i < live; i++)
+        entities[i] = pool.create(i);
+    timer.restart();
+    for (int i = 0; i < operations; i++)
+    {
+        unsigned int victim = victims[i] % live;
+        sum += entities[victim]->id;
+        pool.destroy(entities[victim]);
+        entities[victim] = pool.create(i);
+    }
+    bench_report("ObjectPool churn", timer.elapsed_ns() / operations, "ns/operation");
+    for (int i = 0; i < live; i++)
+        pool.destroy(entities[i]);
+
+    bench_sink += sum;
+}
+
+template <typename Map>
+static double bench_map(Map &chunks, const vector<unsigned int> &keys)
+{
+    BenchTimer timer;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (keys[i] & 1)
+            chunks.erase(keys[i] >> 17);
+        else
+            chunks[keys[i] >> 17] = static_cast<int>(i);
+    }
+    return timer.elapsed_ns() / keys.size();
+}
+
+NGW_BENCHMARK(pool_allocator_map)
+{
+    const int operations = 2000000;
+    vector<unsigned int> keys(operations);
+    MersenneRandGen rng(1);
+    rng.fill_u32(&keys[0], operations);
+
+    map<int, int> standard;
+    bench_report("std::map, std::allocator", bench_map(standard, keys), "ns/operation");
+
+    typedef PoolAllocator<pair<const int, int> > MapAllocator;
+    PoolResource resource;
+    MapAllocator allocator(&resource);
+    map<int, int, less<int>, MapAllocator> pooled(less<int>(), allocator);
+    bench_report("std::map, PoolAllocator", bench_map(pooled, keys), "ns/operation");
+
+    bench_sink += standard.size() + pooled.size();
+}
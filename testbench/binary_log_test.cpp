@@ -0,0 +1,276 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "binary_log.h"
+#include "randgen.h"
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+using namespace std;
+
+// 收集文本日志的消息内容(去掉消息头和换行)
+class BodyForwarder : public LoggerForwarder
+{
+private:
+    vector<string> *m_bodies;
+
+public:
+    BodyForwarder(vector<string> *bodies) : m_bodies(bodies) { }
+
+    void forward_log(const std::string &str)
+    {
+        size_t begin = str.find(") ");
+        m_bodies->push_back(str.substr(begin + 2, str.size() - begin - 3));
+    }
+};
+
+static string temp_file_name(const char *tag)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/tmp/ngworld_%s_%d.blog", tag, static_cast<int>(getpid()));
+    return name;
+}
+
+static vector<char> read_file(const string &file_name)
+{
+    vector<char> data;
+    FILE *in = fopen(file_name.c_str(), "rb");
+    if (in == NULL)
+        return data;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+        data.insert(data.end(), chunk, chunk + n);
+    fclose(in);
+    return data;
+}
+
+static void write_file(const string &file_name, const char *data, size_t size)
+{
+    FILE *out = fopen(file_name.c_str(), "wb");
+    if (size > 0)
+        fwrite(data, 1, size, out);
+    fclose(out);
+}
+
+// 解码成文本，返回每条记录的消息内容(去掉第一行的文件头)
+static bool decode_bodies(const string &file_name, vector<string> *bodies, string *error)
+{
+    FILE *out = tmpfile();
+    bool ok = decode_binary_log(file_name, out, error);
+    rewind(out);
+    char line[2048];
+    bool header = true;
+    while (fgets(line, sizeof(line), out) != NULL)
+    {
+        string text(line);
+        if (!text.empty() && text[text.size() - 1] == '\n')
+            text.erase(text.size() - 1);
+        if (header)
+        {
+            header = false;
+            continue;
+        }
+        size_t begin = text.find(") ");
+        bodies->push_back(begin == string::npos ? text : text.substr(begin + 2));
+    }
+    fclose(out);
+    return ok;
+}
+
+// 同一组参数分别写入二进制日志和文本日志
+template <typename... Args>
+static void log_both(LoggerForwarderBinary &binary, Logger &text, const char *format, const Args&... args)
+{
+    binary.write(LOG_LEVEL_INFO, format, args...);
+    text.logf(LOG_LEVEL_INFO, format, args...);
+}
+
+NGW_TEST(binary_log_round_trip)
+{
+    string file_name = temp_file_name("round_trip");
+    vector<string> expected;
+    {
+        LoggerForwarderBinary binary(file_name);
+        Logger text(LOG_LEVEL_VERBOSE, new BodyForwarder(&expected), true);
+        text.set_staging_size(1);
+
+        const char *null_string = NULL;
+        int local = 0;
+        log_both(binary, text, "int {} {} {}", 0, -123456789, 2147483647);
+        log_both(binary, text, "unsigned {} {}", 4000000000U, 0U);
+        log_both(binary, text, "long {} {}", -9000000000L, 9000000000UL);
+        log_both(binary, text, "long long {} {}", -9223372036854775807LL - 1, 18446744073709551615ULL);
+        log_both(binary, text, "double {} {} {}", 3.25, -1e-300, 1.0 / 3);
+        log_both(binary, text, "bool {} {}", true, false);
+        log_both(binary, text, "char {}{}", 'x', '!');
+        log_both(binary, text, "string {} {} [{}]", "literal", string("std::string"), string());
+        log_both(binary, text, "null {}", null_string);
+        log_both(binary, text, "pointer {} {}", static_cast<const void*>(&local), static_cast<const void*>(NULL));
+        // 占位符多于参数和少于参数
+        log_both(binary, text, "missing {} {}", 1);
+        log_both(binary, text, "extra {}", 1, 2.5, "ignored");
+        log_both(binary, text, "no placeholders");
+        // 同一个格式字符串再用一次，只写入一次定义
+        log_both(binary, text, "int {} {} {}", 1, 2, 3);
+        // 作为普通转发器收到的文本原样保存
+        binary.forward_log("preformatted text\n");
+        expected.push_back("preformatted text");
+    }
+
+    vector<string> decoded;
+    string error;
+    NGW_CHECK(decode_bodies(file_name, &decoded, &error));
+    NGW_CHECK(error.empty());
+    // 预先格式化的文本没有消息头，decode_bodies()原样返回
+    NGW_CHECK(decoded == expected);
+    remove(file_name.c_str());
+}
+
+NGW_TEST(binary_log_rejects_damaged_files)
+{
+    string file_name = temp_file_name("damaged");
+    {
+        LoggerForwarderBinary binary(file_name);
+        for (int i = 0; i < 20; i++)
+            binary.write(LOG_LEVEL_WARNING, "record {} {} {}", i, "text", 0.5 * i);
+    }
+    vector<char> data = read_file(file_name);
+    string damaged_name = temp_file_name("damaged_copy");
+    vector<string> bodies;
+    string error;
+
+    // 在任意位置截断都不会越界，只有恰好在记录边界截断时才成功
+    size_t succeeded = 0;
+    for (size_t size = 0; size <= data.size(); size++)
+    {
+        write_file(damaged_name, &data[0], size);
+        bodies.clear();
+        error.clear();
+        if (decode_bodies(damaged_name, &bodies, &error))
+            ++succeeded;
+        else
+            NGW_CHECK(!error.empty());
+    }
+    // 文件头之后、定义之后以及每条记录之后
+    NGW_CHECK(succeeded == 2 + 20);
+
+    // 逐个检查各种损坏
+    struct Damage
+    {
+        size_t offset;
+        char value;
+        const char *reason;
+    };
+    // 文件头16字节，格式定义'F' + id + length，从偏移25开始是格式字符串
+    const Damage damages[] =
+    {
+        { 0, 'X', "not a binary log file" },
+        { 16, 'Z', "unknown record type" },
+        { 17, 0, "invalid format id" },
+        { 24, 0x7F, "format length exceeds file size" },
+    };
+    for (size_t i = 0; i < sizeof(damages) / sizeof(damages[0]); i++)
+    {
+        vector<char> copy(data);
+        copy[damages[i].offset] = damages[i].value;
+        write_file(damaged_name, &copy[0], copy.size());
+        bodies.clear();
+        error.clear();
+        NGW_CHECK(!decode_bodies(damaged_name, &bodies, &error));
+        NGW_CHECK(error.find(damages[i].reason) == 0);
+    }
+
+    // 第一条记录引用未定义的格式，或者参数类型标记损坏
+    size_t record = 16 + 1 + 4 + 4 + strlen("record {} {} {}");
+    vector<char> copy(data);
+    copy[record + 1] = 9;
+    write_file(damaged_name, &copy[0], copy.size());
+    error.clear();
+    NGW_CHECK(!decode_bodies(damaged_name, &bodies, &error) && error.find("undefined format id") == 0);
+    copy = data;
+    copy[record + 1 + 4 + 1 + 8 + 1] = 0x55;
+    write_file(damaged_name, &copy[0], copy.size());
+    error.clear();
+    NGW_CHECK(!decode_bodies(damaged_name, &bodies, &error) && error.find("invalid argument") == 0);
+
+    // 随机改写字节，解码可以失败但不能崩溃或者越界
+    PhiloxRandGen gen(40);
+    for (int round = 0; round < 200; round++)
+    {
+        copy = data;
+        for (int k = 0; k < 4; k++)
+            copy[16 + gen.get_u32_bounded(static_cast<unsigned int>(copy.size() - 16))] = static_cast<char>(gen.get_u32());
+        write_file(damaged_name, &copy[0], copy.size());
+        bodies.clear();
+        decode_bodies(damaged_name, &bodies, NULL);
+    }
+
+    NGW_CHECK(!decode_binary_log("/nonexistent/ngworld.blog", stdout, &error));
+    remove(damaged_name.c_str());
+    remove(file_name.c_str());
+}
+
+// 每秒能写入多少条记录，参数为整数、字符串和浮点数各一个
+static double binary_log_throughput(int threads)
+{
+    static const int total = 1 << 21;
+    int per_thread = total / threads;
+    string file_name = temp_file_name("bench");
+    double rate;
+    {
+        LoggerForwarderBinary binary(file_name);
+        BenchTimer timer;
+        vector<thread> workers;
+        for (int t = 0; t < threads; t++)
+            workers.push_back(thread([&binary, per_thread]()
+            {
+                for (int i = 0; i < per_thread; i++)
+                    binary.write(LOG_LEVEL_INFO, "chunk {} of {} generated in {} ms", i, "overworld", 1.5);
+            }));
+        for (int t = 0; t < threads; t++)
+            workers[t].join();
+        binary.flush();
+        rate = per_thread * threads / timer.elapsed_ns() * 1000;
+    }
+    remove(file_name.c_str());
+    return rate;
+}
+
+NGW_BENCHMARK(binary_log_write)
+{
+    bench_report("write(), 1 thread", binary_log_throughput(1), "M records/s");
+    bench_report("write(), 4 threads", binary_log_throughput(4), "M records/s");
+
+    // 作为对比: 文本日志格式化同样的消息，转发器什么都不做
+    class NullForwarder : public LoggerForwarder
+    {
+    public:
+        void forward_log(const std::string &str) { bench_sink += str.size(); }
+    };
+    static const int count = 1 << 21;
+    Logger text(LOG_LEVEL_VERBOSE, new NullForwarder(), true);
+    BenchTimer timer;
+    for (int i = 0; i < count; i++)
+        text.logf(LOG_LEVEL_INFO, "chunk {} of {} generated in {} ms", i, "overworld", 1.5);
+    text.flush();
+    bench_report("text logf(), 1 thread", count / timer.elapsed_ns() * 1000, "M records/s");
+}
@@ -0,0 +1,192 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "fundamental_macros.h"
+#include "cpu_features.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+using namespace std;
+
+NGW_TEST(cpu_features_detected)
+{
+    const CPUFeatures &features = cpu_features();
+    NGW_CHECK(&features == &cpu_features());
+    NGW_CHECK((features.mask >> CPU_FEATURE_COUNT) == 0);
+
+    // to_string()恰好列出可用的特性
+    string names = " " + features.to_string() + " ";
+    bool ok = true;
+    for (int i = 0; i < CPU_FEATURE_COUNT; i++)
+    {
+        CPU_FEATURE feature = static_cast<CPU_FEATURE>(i);
+        bool listed = names.find(string(" ") + cpu_feature_name(feature) + " ") != string::npos;
+        ok = ok && listed == features.has(feature) && cpu_has(feature) == features.has(feature);
+    }
+    NGW_CHECK(ok);
+
+    // 被NGWORLD_CPU_DISABLE屏蔽的特性不可用
+    const char *disabled = getenv("NGWORLD_CPU_DISABLE");
+    if (disabled != NULL)
+    {
+        string list = string(",") + disabled + ",";
+        for (int i = 0; i < CPU_FEATURE_COUNT; i++)
+        {
+            CPU_FEATURE feature = static_cast<CPU_FEATURE>(i);
+            if (list.find(string(",") + cpu_feature_name(feature) + ",") != string::npos)
+                NGW_CHECK(!features.has(feature));
+        }
+        if (list.find(",all,") != string::npos)
+            NGW_CHECK(features.mask == 0);
+    }
+#ifdef __x86_64__
+    else
+    {
+        // x86-64一定支持SSE2，AVX2意味着AVX
+        NGW_CHECK(features.has(CPU_FEATURE_SSE2));
+        NGW_CHECK(!features.has(CPU_FEATURE_AVX2) || features.has(CPU_FEATURE_AVX));
+        NGW_CHECK(!features.vendor.empty());
+    }
+#endif
+}
+
+static int variant_index(int index)
+{
+    return index;
+}
+
+NGW_TEST(cpu_dispatch_selection)
+{
+    typedef int (*Function)(int);
+    const u64 available = cpu_features().mask;
+    // 第一个所需特性全部满足的变体被选中；没有任何特性可用时只有最后一个满足
+    const u64 missing = cpu_feature_mask(CPU_FEATURE_COUNT);
+    const CPUDispatchVariant<Function> variants[] =
+    {
+        { "missing", missing, variant_index },
+        { "all-available", available, variant_index },
+        { "generic", 0, variant_index },
+    };
+    CPUDispatch<Function> dispatch("test_dispatch", variants, 3);
+    NGW_CHECK(strcmp(dispatch.selected_name(), "all-available") == 0);
+    NGW_CHECK(cpu_dispatch_report().find("test_dispatch=all-available") != string::npos);
+
+    CPUDispatch<Function> fallback("test_fallback", variants, 1);
+    NGW_CHECK(strcmp(fallback.selected_name(), "missing") == 0);
+
+    const CPUDispatchVariant<Function> generic_only[] =
+    {
+        { "missing", missing | available, variant_index },
+        { "generic", 0, variant_index },
+    };
+    CPUDispatch<Function> generic("test_generic", generic_only, 2);
+    NGW_CHECK(strcmp(generic.selected_name(), "generic") == 0);
+}
+
+// 一个线程第一次选择，另一个线程同时生成报告，不能死锁
+NGW_TEST(cpu_dispatch_report_while_selecting)
+{
+    typedef int (*Function)(int);
+    static const CPUDispatchVariant<Function> variants[] =
+    {
+        { "generic", 0, variant_index },
+    };
+    static const int count = 2000;
+    vector<CPUDispatch<Function>*> dispatches;
+    for (int i = 0; i < count; i++)
+        dispatches.push_back(new CPUDispatch<Function>("test_concurrent", variants, 1));
+
+    atomic<bool> done(false);
+    thread reporter([&done]()
+    {
+        while (!done.load())
+            bench_sink += cpu_dispatch_report().size();
+    });
+    for (int i = 0; i < count; i++)
+        dispatches[i]->select();
+    done.store(true);
+    reporter.join();
+
+    string report = cpu_dispatch_report();
+    size_t found = 0;
+    for (size_t position = report.find("test_concurrent=generic"); position != string::npos;
+         position = report.find("test_concurrent=generic", position + 1))
+        ++found;
+    NGW_CHECK(found == count);
+    for (int i = 0; i < count; i++)
+        delete dispatches[i];
+    NGW_CHECK(cpu_dispatch_report().find("test_concurrent") == string::npos);
+}
+
+#ifdef NGWORLD_OS_LINUX
+// 特性在进程内只检测一次，所以用给定的NGWORLD_CPU_DISABLE重新运行本程序的部分测试，
+// 返回子进程的输出，子进程失败时返回空字符串
+static string run_with_disabled(const char *disabled, const char *tests)
+{
+    char self[4096];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length <= 0)
+        return string();
+    self[length] = 0;
+
+    string command = string("NGWORLD_CPU_DISABLE=") + disabled + " '" + self + "' test " + tests + " 2>&1";
+    FILE *child = popen(command.c_str(), "r");
+    if (child == NULL)
+        return string();
+    string output;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), child)) > 0)
+        output.append(chunk, n);
+    int status = pclose(child);
+    if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        printf("%s", output.c_str());
+        return string();
+    }
+    return output;
+}
+
+NGW_TEST(cpu_disable_fallback)
+{
+    // 子进程运行mt19937_reference_output，它与std::mt19937逐个比较输出并打印分派结果
+    static const char tests[] = "cpu_features_detected cpu_dispatch_selection mt19937_reference_output";
+    string generic = run_with_disabled("avx2,sse2", tests);
+    NGW_CHECK(generic.find("mt19937_twist=generic") != string::npos);
+    NGW_CHECK(generic.find("3 run, 0 failed") != string::npos);
+
+    string all = run_with_disabled("all", tests);
+    NGW_CHECK(all.find("mt19937_twist=generic") != string::npos);
+
+#ifdef NGWORLD_X86
+    if (cpu_has(CPU_FEATURE_SSE2))
+    {
+        string sse2 = run_with_disabled("avx2", tests);
+        NGW_CHECK(sse2.find("mt19937_twist=sse2") != string::npos);
+        NGW_CHECK(sse2.find("3 run, 0 failed") != string::npos);
+    }
+#endif
+}
+#endif
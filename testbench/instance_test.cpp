@@ -0,0 +1,92 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "instance.h"
+#include <thread>
+#include <vector>
+using namespace std;
+
+static const int stream_length = 100;
+
+// 在一个新线程中声明编号index，取出thread_rng()的前stream_length个数
+static vector<unsigned int> thread_stream(u32 index)
+{
+    vector<unsigned int> values;
+    thread worker([&]
+    {
+        set_thread_rng_index(index);
+        RandGen *gen = thread_rng();
+        for (int i = 0; i < stream_length; i++)
+            values.push_back(gen->get_u32());
+    });
+    worker.join();
+    return values;
+}
+
+NGW_TEST(thread_rng_reproducible)
+{
+    u64 saved = get_master_seed();
+
+    // 同一个主种子和编号，在不同的线程中得到相同的序列
+    set_master_seed(12345);
+    vector<unsigned int> first = thread_stream(3), again = thread_stream(3);
+    NGW_CHECK(first.size() == static_cast<size_t>(stream_length));
+    NGW_CHECK(first == again);
+
+    // 不同的编号、不同的主种子得到不同的序列
+    NGW_CHECK(first != thread_stream(4));
+    NGW_CHECK(thread_stream(0) != thread_stream(1));
+    set_master_seed(12346);
+    NGW_CHECK(first != thread_stream(3));
+
+    set_master_seed(saved);
+}
+
+NGW_TEST(thread_rng_reseeds_existing_threads)
+{
+    u64 saved = get_master_seed();
+    set_master_seed(777);
+    vector<unsigned int> expected_777 = thread_stream(9);
+    set_master_seed(888);
+    vector<unsigned int> expected_888 = thread_stream(9);
+
+    // 已经在使用生成器的线程，在主种子改变后的下一次thread_rng()时重新播种，
+    // 之前保存的指针仍然有效并指向同一个生成器
+    set_master_seed(777);
+    set_thread_rng_index(9);
+    RandGen *gen = thread_rng();
+    vector<unsigned int> values;
+    for (int i = 0; i < stream_length; i++)
+        values.push_back(gen->get_u32());
+    NGW_CHECK(values == expected_777);
+
+    set_master_seed(888);
+    NGW_CHECK(thread_rng() == gen);
+    values.clear();
+    for (int i = 0; i < stream_length; i++)
+        values.push_back(gen->get_u32());
+    NGW_CHECK(values == expected_888);
+
+    // 改变编号同样重新播种，指针不变
+    set_thread_rng_index(10);
+    NGW_CHECK(thread_rng() == gen);
+    NGW_CHECK(gen->get_u32() != expected_888[0]);
+
+    set_master_seed(saved);
+}
@@ -0,0 +1,535 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "logger.h"
+#include "metrics.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+using namespace std;
+
+// 把消息记录到外部的数组中，Logger析构之后仍然可以检查。
+// gate不为NULL时，每次转发前等待它变为true，用来模拟缓慢的磁盘
+class CaptureForwarder : public LoggerForwarder
+{
+private:
+    vector<string> *m_lines;
+    const atomic<bool> *m_gate;
+
+public:
+    CaptureForwarder(vector<string> *lines, const atomic<bool> *gate = NULL) : m_lines(lines), m_gate(gate) { }
+
+    void forward_log(const std::string &str)
+    {
+        while (m_gate != NULL && !m_gate->load())
+            this_thread::yield();
+        m_lines->push_back(str);
+    }
+};
+
+// 只计数，用来测量Logger本身的开销
+class NullForwarder : public LoggerForwarder
+{
+public:
+    void forward_log(const std::string &str) { bench_sink += str.size(); }
+};
+
+// 去掉消息头"[秒.微秒] (级别) "和末尾的换行
+static string message_body(const string &line)
+{
+    size_t begin = line.find(") ");
+    if (begin == string::npos || line.empty() || line[line.size() - 1] != '\n')
+        return string();
+    return line.substr(begin + 2, line.size() - begin - 3);
+}
+
+// 写线程报告丢弃条数的消息，返回其中的条数，不是这种消息时返回0
+static unsigned long long dropped_notice(const string &line)
+{
+    string body = message_body(line);
+    if (body.find("log messages were dropped") == string::npos)
+        return 0;
+    return strtoull(body.c_str(), NULL, 10);
+}
+
+// 每个线程的消息都按顺序出现，而且恰好出现一次
+static bool all_messages_in_order(const vector<string> &lines, int threads, int per_thread)
+{
+    vector<int> next(threads, 0);
+    int thread_index, message_index;
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        if (sscanf(message_body(lines[i]).c_str(), "t%d m%d", &thread_index, &message_index) != 2 ||
+            thread_index < 0 || thread_index >= threads || message_index != next[thread_index])
+            return false;
+        ++next[thread_index];
+    }
+    for (int t = 0; t < threads; t++)
+        if (next[t] != per_thread)
+            return false;
+    return true;
+}
+
+// 消息头中的时间(微秒)
+static unsigned long long message_time(const string &line)
+{
+    unsigned long long seconds = 0, micro = 0;
+    sscanf(line.c_str(), "[%llu.%llu]", &seconds, &micro);
+    return seconds * 1000000 + micro;
+}
+
+// 多个线程同时写日志，全部结束后调用flush()
+static void log_from_threads(Logger &logger, int threads, int per_thread)
+{
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.push_back(thread([&logger, t, per_thread]()
+        {
+            for (int i = 0; i < per_thread; i++)
+                logger.logf(LOG_LEVEL_INFO, "t{} m{}", t, i);
+        }));
+    for (int t = 0; t < threads; t++)
+        workers[t].join();
+    logger.flush();
+}
+
+NGW_TEST(logger_staging_merges_threads)
+{
+    static const int threads = 8;
+    vector<string> lines;
+    Logger logger(LOG_LEVEL_VERBOSE, new CaptureForwarder(&lines), true);
+
+    // 暂存区多次写满，消息既不丢失也不重复
+    log_from_threads(logger, threads, 1000);
+    NGW_CHECK(lines.size() == static_cast<size_t>(threads * 1000));
+    NGW_CHECK(all_messages_in_order(lines, threads, 1000));
+
+    // 一次合并之内，各线程暂存的消息按时间排序。
+    // 多次合并之间不保证: 一个线程取得时间之后、放入暂存区之前，其他线程可能已经转发了更晚的消息
+    lines.clear();
+    logger.set_staging_size(1000);
+    log_from_threads(logger, threads, 100);
+    NGW_CHECK(lines.size() == static_cast<size_t>(threads * 100));
+    NGW_CHECK(all_messages_in_order(lines, threads, 100));
+    bool sorted = true;
+    for (size_t i = 1; i < lines.size(); i++)
+        sorted = sorted && message_time(lines[i - 1]) <= message_time(lines[i]);
+    NGW_CHECK(sorted);
+}
+
+NGW_TEST(logger_staging_flush_triggers)
+{
+    vector<string> lines;
+    Logger logger(LOG_LEVEL_VERBOSE, new CaptureForwarder(&lines), true);
+
+    // 默认暂存，INFO不会立即转发
+    logger.logf(LOG_LEVEL_INFO, "t{} m{}", 0, 0);
+    NGW_CHECK(lines.empty());
+    // 警告连同之前暂存的消息一起立即转发
+    logger.logf(LOG_LEVEL_WARNING, "t{} m{}", 0, 1);
+    NGW_CHECK(lines.size() == 2 && all_messages_in_order(lines, 1, 2));
+
+    // 暂存时间超过上限后，下一条消息触发转发
+    lines.clear();
+    logger.logf(LOG_LEVEL_INFO, "t{} m{}", 0, 0);
+    this_thread::sleep_for(chrono::milliseconds(60));
+    logger.logf(LOG_LEVEL_INFO, "t{} m{}", 0, 1);
+    NGW_CHECK(lines.size() == 2);
+
+    // 暂存区满时转发
+    lines.clear();
+    logger.set_staging_size(4);
+    for (int i = 0; i < 4; i++)
+        logger.logf(LOG_LEVEL_INFO, "t{} m{}", 0, i);
+    NGW_CHECK(lines.size() == 4 && all_messages_in_order(lines, 1, 4));
+
+    // 为1时每条消息立即转发
+    lines.clear();
+    logger.set_staging_size(1);
+    logger.logf(LOG_LEVEL_INFO, "t{} m{}", 0, 0);
+    NGW_CHECK(lines.size() == 1);
+}
+
+NGW_TEST(logger_crash_handler_flushes)
+{
+    char file_name[64];
+    snprintf(file_name, sizeof(file_name), "/tmp/ngworld_crash_test_%d.log", static_cast<int>(getpid()));
+    remove(file_name);
+
+    // 在子进程中写几条暂存的消息后崩溃，文件转发器本身还会再缓存8条
+    pid_t child = fork();
+    if (child == 0)
+    {
+        Logger *crashing = new Logger(LOG_LEVEL_VERBOSE, new LoggerForwarderFile(file_name), false);
+        Logger::install_crash_handler();
+        for (int i = 0; i < 5; i++)
+            crashing->logf(LOG_LEVEL_INFO, "t{} m{}", 0, i);
+        raise(SIGSEGV);
+        _exit(0);
+    }
+
+    int status = 0;
+    NGW_CHECK(child > 0 && waitpid(child, &status, 0) == child);
+    NGW_CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+
+    vector<string> lines;
+    ifstream fin(file_name);
+    string line;
+    while (getline(fin, line))
+        if (line.size() > 0 && line[0] == '[')
+            lines.push_back(line + "\n");
+    NGW_CHECK(lines.size() == 5 && all_messages_in_order(lines, 1, 5));
+    remove(file_name);
+}
+
+NGW_TEST(logger_async_delivers_in_order)
+{
+    static const int threads = 4, per_thread = 5000;
+    vector<string> lines;
+    Logger logger(LOG_LEVEL_VERBOSE, new CaptureForwarder(&lines), true);
+    // 队列比消息总数小得多，生产者会多次等待写线程
+    logger.start_async(64, LOG_QUEUE_BLOCK);
+
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.push_back(thread([&logger, t]()
+        {
+            for (int i = 0; i < per_thread; i++)
+                logger.logf(LOG_LEVEL_INFO, "t{} m{}", t, i);
+        }));
+    for (int t = 0; t < threads; t++)
+        workers[t].join();
+    logger.stop_async();
+
+    NGW_CHECK(lines.size() == static_cast<size_t>(threads * per_thread));
+    NGW_CHECK(all_messages_in_order(lines, threads, per_thread));
+    NGW_CHECK(logger.dropped_count() == 0);
+
+    // 回到同步模式后仍然可以正常写日志
+    lines.clear();
+    logger.logf(LOG_LEVEL_INFO, "t{} m{}", 0, 0);
+    logger.flush();
+    NGW_CHECK(lines.size() == 1 && all_messages_in_order(lines, 1, 1));
+}
+
+NGW_TEST(logger_async_block_policy_waits)
+{
+    static const int count = 2000;
+    vector<string> lines;
+    atomic<bool> gate(false);
+    Logger logger(LOG_LEVEL_VERBOSE, new CaptureForwarder(&lines, &gate), true);
+    logger.start_async(8, LOG_QUEUE_BLOCK);
+
+    // 写线程被卡住时生产者只能等待，20毫秒之后放开
+    thread opener([&gate]()
+    {
+        this_thread::sleep_for(chrono::milliseconds(20));
+        gate.store(true);
+    });
+    for (int i = 0; i < count; i++)
+        logger.logf(LOG_LEVEL_INFO, "t{} m{}", 0, i);
+    opener.join();
+    logger.stop_async();
+
+    NGW_CHECK(logger.dropped_count() == 0);
+    NGW_CHECK(lines.size() == static_cast<size_t>(count));
+    NGW_CHECK(all_messages_in_order(lines, 1, count));
+}
+
+NGW_TEST(logger_async_drop_policy_counts)
+{
+    static const int count = 2000;
+    vector<string> lines;
+    atomic<bool> gate(false);
+    Logger logger(LOG_LEVEL_VERBOSE, new CaptureForwarder(&lines, &gate), true);
+    u64 dropped_metric = metrics().counter("logger.dropped")->value();
+    logger.start_async(8, LOG_QUEUE_DROP);
+
+    // 写线程卡住时队列很快就满了，之后的消息都被丢弃，生产者不会等待
+    for (int i = 0; i < count; i++)
+        logger.logf(LOG_LEVEL_INFO, "m{}", i);
+    unsigned long long dropped = logger.dropped_count();
+    gate.store(true);
+    logger.stop_async();
+
+    // 写线程最多取走一批，队列中最多还有8条
+    NGW_CHECK(dropped > 0 && dropped <= static_cast<unsigned long long>(count));
+    NGW_CHECK(count - dropped <= 64 + 8);
+    NGW_CHECK(logger.dropped_count() == dropped);
+
+    // 留下的消息一条不少地写出，丢弃的条数也被报告出来
+    unsigned long long delivered = 0, reported = 0, notice;
+    int previous = -1, index;
+    bool ordered = true;
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        notice = dropped_notice(lines[i]);
+        if (notice > 0)
+        {
+            reported += notice;
+            continue;
+        }
+        ordered = ordered && sscanf(message_body(lines[i]).c_str(), "m%d", &index) == 1 && index > previous;
+        previous = index;
+        ++delivered;
+    }
+    NGW_CHECK(ordered);
+    NGW_CHECK(delivered + dropped == static_cast<unsigned long long>(count));
+    NGW_CHECK(reported == dropped);
+
+    // 丢弃的条数同时计入指标，写线程退出前队列已经清空
+    NGW_CHECK(metrics().counter("logger.dropped")->value() - dropped_metric == dropped);
+    NGW_CHECK(metrics().gauge("logger.queue_depth")->value() == 0);
+}
+
+NGW_TEST(logger_async_flushes_on_shutdown)
+{
+    static const int count = 3000;
+    vector<string> lines;
+    atomic<bool> gate(false);
+    Logger *logger = new Logger(LOG_LEVEL_VERBOSE, new CaptureForwarder(&lines, &gate), true);
+    logger->start_async(4096, LOG_QUEUE_BLOCK);
+    for (int i = 0; i < count; i++)
+        logger->logf(LOG_LEVEL_INFO, "t{} m{}", 0, i);
+    // 析构时队列中还有消息没写出，不调用stop_async()直接析构
+    NGW_CHECK(lines.size() < static_cast<size_t>(count));
+    gate.store(true);
+    delete logger;
+
+    NGW_CHECK(lines.size() == static_cast<size_t>(count));
+    NGW_CHECK(all_messages_in_order(lines, 1, count));
+}
+
+// 多个线程同时写日志的吞吐量，转发器什么都不做，只测量Logger本身
+static double log_throughput(int threads, size_t staging_size, bool async)
+{
+    static const int total = 320000;
+    int per_thread = total / threads;
+    Logger logger(LOG_LEVEL_VERBOSE, new NullForwarder(), true);
+    logger.set_staging_size(staging_size);
+    if (async)
+        logger.start_async(4096, LOG_QUEUE_BLOCK);
+
+    BenchTimer timer;
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.push_back(thread([&logger, t, per_thread]()
+        {
+            for (int i = 0; i < per_thread; i++)
+                logger.logf(LOG_LEVEL_INFO, "worker {} finished chunk {}", t, i);
+        }));
+    for (int t = 0; t < threads; t++)
+        workers[t].join();
+    logger.stop_async();
+    logger.flush();
+    return per_thread * threads / timer.elapsed_ns() * 1000;
+}
+
+NGW_BENCHMARK(logger_throughput)
+{
+    static const int threads[] = { 1, 8, 32 };
+    char name[64];
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++)
+    {
+        snprintf(name, sizeof(name), "sync staged, %d threads", threads[i]);
+        bench_report(name, log_throughput(threads[i], 16, false), "M msgs/s");
+        snprintf(name, sizeof(name), "sync unstaged, %d threads", threads[i]);
+        bench_report(name, log_throughput(threads[i], 1, false), "M msgs/s");
+        snprintf(name, sizeof(name), "async, %d threads", threads[i]);
+        bench_report(name, log_throughput(threads[i], 1, true), "M msgs/s");
+    }
+}
+
+static string read_text_file(const char *file_name)
+{
+    ifstream fin(file_name, ios::binary);
+    return string(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+}
+
+NGW_TEST(logger_mapped_segments)
+{
+    char prefix[64], file_name[80];
+    snprintf(prefix, sizeof(prefix), "/tmp/ngworld_mapped_test_%d", static_cast<int>(getpid()));
+    {
+        // 每条消息23字节，每个分段放得下3条，写10条之后只保留最后3个分段
+        LoggerForwarderMapped mapped(prefix, 72, 3);
+        NGW_CHECK(mapped.is_open() && mapped.is_mapped());
+        char line[32];
+        for (int i = 0; i < 10; i++)
+        {
+            snprintf(line, sizeof(line), "message %02d of the test\n", i);
+            mapped.forward_log(line);
+        }
+    }
+
+    // 分段按编号循环使用: 0号是第10条，1号是第4到6条，2号是第7到9条
+    static const char *expected[] =
+    {
+        "message 09 of the test\n",
+        "message 03 of the test\nmessage 04 of the test\nmessage 05 of the test\n",
+        "message 06 of the test\nmessage 07 of the test\nmessage 08 of the test\n",
+    };
+    for (int segment = 0; segment < 3; segment++)
+    {
+        snprintf(file_name, sizeof(file_name), "%s.%d.log", prefix, segment);
+        NGW_CHECK(read_text_file(file_name) == expected[segment]);
+        remove(file_name);
+    }
+
+    // 打不开文件时消息被丢弃，但不会崩溃
+    LoggerForwarderMapped broken("/nonexistent/ngworld_mapped_test", 64, 2);
+    NGW_CHECK(!broken.is_open() && !broken.is_mapped());
+    for (int i = 0; i < 100; i++)
+        broken.forward_log("dropped message\n");
+}
+
+// 写入约100字节的消息，测量转发器本身的吞吐量
+template <typename Forwarder>
+static double forwarder_throughput(Forwarder &forwarder)
+{
+    static const int count = 1 << 20;
+    string line = "[123.456789] (II) chunk (12, -34) generated in 1.5 ms with 4096 blocks and 12 entities\n";
+    BenchTimer timer;
+    for (int i = 0; i < count; i++)
+    {
+        line[1] = static_cast<char>('0' + i % 10);
+        forwarder.forward_log(line);
+    }
+    return static_cast<double>(count) * line.size() / timer.elapsed_ns() * 1000;
+}
+
+NGW_BENCHMARK(logger_mapped_vs_file)
+{
+    char prefix[64], file_name[80];
+    snprintf(prefix, sizeof(prefix), "/tmp/ngworld_mapped_bench_%d", static_cast<int>(getpid()));
+    snprintf(file_name, sizeof(file_name), "%s.file.log", prefix);
+    {
+        LoggerForwarderFile file(file_name);
+        bench_report("ofstream forwarder", forwarder_throughput(file), "MB/s");
+    }
+    remove(file_name);
+    {
+        LoggerForwarderMapped mapped(prefix, 16 << 20, 4);
+        bench_report("mapped forwarder", forwarder_throughput(mapped), "MB/s");
+    }
+    for (int segment = 0; segment < 4; segment++)
+    {
+        snprintf(file_name, sizeof(file_name), "%s.%d.log", prefix, segment);
+        remove(file_name);
+    }
+}
+
+NGW_TEST(logger_rate_limit)
+{
+    LogCallSiteLimiter limiter;
+    u64 suppressed = 12345;
+    int passed = 0;
+    for (int i = 0; i < 1000; i++)
+        if (limiter.acquire_rate(5, suppressed))
+        {
+            NGW_CHECK(suppressed == 0);
+            ++passed;
+        }
+    NGW_CHECK(passed == 5);
+
+    // 同样的限制通过宏作用在Logger上，被抑制的条数附在下一条输出的消息末尾
+    vector<string> lines;
+    Logger logger(LOG_LEVEL_VERBOSE, new CaptureForwarder(&lines), true);
+    for (int round = 0; round < 2; round++)
+    {
+        for (int i = 0; i < 10; i++)
+            NGW_LOG_RATE_LIMITED(&logger, LOG_LEVEL_WARNING, 2, "bad packet {}", i);
+        if (round == 0)
+        {
+            NGW_CHECK(lines.size() == 2);
+            // 下一个窗口，coarse_ns()的精度只有几毫秒，多等一会
+            this_thread::sleep_for(chrono::milliseconds(1050));
+        }
+    }
+    NGW_CHECK(lines.size() == 4);
+    NGW_CHECK(lines.size() == 4 && message_body(lines[0]) == "bad packet 0" && message_body(lines[1]) == "bad packet 1");
+    NGW_CHECK(lines.size() == 4 && message_body(lines[2]) == "bad packet 0 (8 similar messages suppressed)");
+    NGW_CHECK(lines.size() == 4 && message_body(lines[3]) == "bad packet 1");
+
+    // 新的窗口又可以放行5条，第一条报告上一个窗口中被抑制的995条
+    passed = 0;
+    for (int i = 0; i < 100; i++)
+        if (limiter.acquire_rate(5, suppressed))
+        {
+            NGW_CHECK(suppressed == (passed == 0 ? 995U : 0U));
+            ++passed;
+        }
+    NGW_CHECK(passed == 5);
+}
+
+NGW_TEST(logger_sampling)
+{
+    LogCallSiteLimiter limiter;
+    u64 suppressed;
+    int passed = 0;
+    for (int i = 0; i < 100; i++)
+        if (limiter.acquire_sample(10, suppressed))
+        {
+            // 第1、11、21...条放行，除第一条外每次都报告中间被跳过的9条
+            NGW_CHECK(i % 10 == 0);
+            NGW_CHECK(suppressed == (i == 0 ? 0U : 9U));
+            ++passed;
+        }
+    NGW_CHECK(passed == 10);
+
+    LogCallSiteLimiter every;
+    passed = 0;
+    for (int i = 0; i < 100; i++)
+        if (every.acquire_sample(1, suppressed) && suppressed == 0)
+            ++passed;
+    NGW_CHECK(passed == 100);
+
+    vector<string> lines;
+    Logger logger(LOG_LEVEL_VERBOSE, new CaptureForwarder(&lines), true);
+    for (int i = 0; i < 7; i++)
+        NGW_LOG_SAMPLED(&logger, LOG_LEVEL_WARNING, 3, "chunk {} is late", i);
+    NGW_CHECK(lines.size() == 3);
+    NGW_CHECK(lines.size() == 3 && message_body(lines[0]) == "chunk 0 is late");
+    NGW_CHECK(lines.size() == 3 && message_body(lines[2]) == "chunk 6 is late (2 similar messages suppressed)");
+}
+
+// 被抑制的调用的开销
+NGW_BENCHMARK(logger_suppressed_call)
+{
+    static const int count = 10000000;
+    Logger logger(LOG_LEVEL_VERBOSE, new NullForwarder(), true);
+    BenchTimer timer;
+    for (int i = 0; i < count; i++)
+        NGW_LOG_RATE_LIMITED(&logger, LOG_LEVEL_WARNING, 1, "bad packet {}", i);
+    bench_report("NGW_LOG_RATE_LIMITED, suppressed", timer.elapsed_ns() / count, "ns/call");
+
+    timer.restart();
+    for (int i = 0; i < count; i++)
+        NGW_LOG_SAMPLED(&logger, LOG_LEVEL_WARNING, 1 << 30, "chunk {} is late", i);
+    bench_report("NGW_LOG_SAMPLED, suppressed", timer.elapsed_ns() / count, "ns/call");
+}
@@ -0,0 +1,138 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+
+// 用法:
+//   testbench                  运行全部正确性测试
+//   testbench test [name...]   运行名字中包含任意一个name的正确性测试
+//   testbench bench [name...]  运行性能测试，筛选规则同上
+//   testbench list             列出所有测试
+//   testbench stream <generator> [bytes]
+//                              把随机数生成器的原始输出写到标准输出，例如
+//                              testbench stream philox | RNG_test stdin32
+// 有测试失败时返回1
+
+struct TestCase
+{
+    const char *name;
+    TestFunction function;
+    bool benchmark;
+};
+
+static vector<TestCase> &test_cases()
+{
+    static vector<TestCase> cases;
+    return cases;
+}
+
+static int check_failures = 0;
+volatile u64 bench_sink = 0;
+
+TestRegistrar::TestRegistrar(const char *name, TestFunction function, bool benchmark)
+{
+    TestCase test = { name, function, benchmark };
+    test_cases().push_back(test);
+}
+
+void testbench_fail(const char *file, int line, const char *expression)
+{
+    printf("    %s:%d: check failed: %s\n", file, line, expression);
+    ++check_failures;
+}
+
+void bench_report(const char *name, double value, const char *unit)
+{
+    printf("    %-48s %12.3f %s\n", name, value, unit);
+}
+
+static bool name_matches(const char *name, const vector<string> &filters)
+{
+    if (filters.empty())
+        return true;
+    for (size_t i = 0; i < filters.size(); i++)
+        if (strstr(name, filters[i].c_str()) != NULL)
+            return true;
+    return false;
+}
+
+static int run_tests(bool benchmark, const vector<string> &filters)
+{
+    vector<TestCase> &cases = test_cases();
+    int failed = 0, run = 0, before;
+    for (size_t i = 0; i < cases.size(); i++)
+    {
+        if (cases[i].benchmark != benchmark || !name_matches(cases[i].name, filters))
+            continue;
+        printf("[ RUN  ] %s\n", cases[i].name);
+        fflush(stdout);
+        before = check_failures;
+        BenchTimer timer;
+        cases[i].function();
+        bool ok = check_failures == before;
+        printf("[ %s ] %s (%.0f ms)\n", ok ? " OK " : "FAIL", cases[i].name, timer.elapsed_ns() / 1e6);
+        ++run;
+        if (!ok)
+            ++failed;
+    }
+    printf("%d run, %d failed\n", run, failed);
+    return failed == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    string command = argc > 1 ? argv[1] : "test";
+    vector<string> filters;
+    for (int i = 2; i < argc; i++)
+        filters.push_back(argv[i]);
+
+    if (command == "test")
+        return run_tests(false, filters);
+    if (command == "bench")
+        return run_tests(true, filters);
+    if (command == "list")
+    {
+        vector<TestCase> &cases = test_cases();
+        for (size_t i = 0; i < cases.size(); i++)
+            printf("%s %s\n", cases[i].benchmark ? "bench" : "test ", cases[i].name);
+        return 0;
+    }
+    if (command == "stream" && argc > 2)
+    {
+        unsigned long long bytes = argc > 3 ? strtoull(argv[3], NULL, 10) : 0;
+        if (stream_random_to_stdout(argv[2], bytes))
+            return 0;
+        size_t count;
+        const char *const *names = random_generator_names(&count);
+        fprintf(stderr, "unknown or unsupported generator %s, available:", argv[2]);
+        for (size_t i = 0; i < count; i++)
+            fprintf(stderr, " %s", names[i]);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+
+    fprintf(stderr, "usage: testbench [test|bench|list] [name...]\n"
+                    "       testbench stream <generator> [bytes]\n");
+    return 1;
+}
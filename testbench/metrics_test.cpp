@@ -0,0 +1,177 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "metrics.h"
+#include "randgen.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+using namespace std;
+
+NGW_TEST(histogram_bucket_bounds)
+{
+    bool ok = true;
+    // 每个桶的下界落在自己的桶中，下一个桶的下界减一也还在这个桶中
+    for (int i = 0; i < MetricHistogram::bucket_count; i++)
+    {
+        u64 lower = MetricHistogram::bucket_lower_bound(i);
+        ok = ok && MetricHistogram::bucket_index(lower) == i;
+        if (i + 1 < MetricHistogram::bucket_count)
+        {
+            u64 next = MetricHistogram::bucket_lower_bound(i + 1);
+            ok = ok && next > lower && MetricHistogram::bucket_index(next - 1) == i;
+            // 桶的宽度不超过下界的1/16
+            ok = ok && (i < MetricHistogram::sub_bucket_count || (next - lower) * 16 <= lower);
+        }
+    }
+    NGW_CHECK(ok);
+    NGW_CHECK(MetricHistogram::bucket_index(0) == 0);
+    NGW_CHECK(MetricHistogram::bucket_index(~0ULL) == MetricHistogram::bucket_count - 1);
+
+    // 随机值落在[下界, 下一个下界)中
+    PhiloxRandGen gen(44);
+    for (int i = 0; i < 100000; i++)
+    {
+        u64 value = gen.get_u64() >> gen.get_u32_bounded(64);
+        int index = MetricHistogram::bucket_index(value);
+        ok = ok && index >= 0 && index < MetricHistogram::bucket_count &&
+            MetricHistogram::bucket_lower_bound(index) <= value &&
+            (index + 1 == MetricHistogram::bucket_count || value < MetricHistogram::bucket_lower_bound(index + 1));
+    }
+    NGW_CHECK(ok);
+}
+
+NGW_TEST(histogram_percentile_accuracy)
+{
+    static const double ps[] = { 0.001, 0.1, 0.5, 0.9, 0.99, 0.999, 1.0 };
+    PhiloxRandGen gen(45);
+    MetricHistogram histogram;
+    vector<u64> values;
+    // 跨越很多个数量级的延迟分布
+    for (int i = 0; i < 200000; i++)
+    {
+        u64 value = gen.get_u64() >> (20 + gen.get_u32_bounded(40));
+        values.push_back(value);
+        histogram.record(value);
+    }
+    sort(values.begin(), values.end());
+
+    MetricHistogramSnapshot snapshot;
+    histogram.snapshot(snapshot);
+    NGW_CHECK(snapshot.count == values.size());
+    NGW_CHECK(snapshot.max == values.back());
+    u64 sum = 0;
+    for (size_t i = 0; i < values.size(); i++)
+        sum += values[i];
+    NGW_CHECK(snapshot.sum == sum);
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(ps) / sizeof(ps[0]); i++)
+    {
+        // 与percentile()相同的定义: 第round(p * count)小的值
+        size_t rank = static_cast<size_t>(ps[i] * values.size() + 0.5);
+        u64 exact = values[rank > 0 ? rank - 1 : 0], estimate = snapshot.percentile(ps[i]);
+        // 结果是所在桶的上界，不小于真实值，相对误差不超过1/16
+        ok = ok && estimate >= exact && (estimate - exact) * 16 <= exact;
+    }
+    NGW_CHECK(ok);
+
+    MetricHistogramSnapshot empty;
+    MetricHistogram().snapshot(empty);
+    NGW_CHECK(empty.count == 0 && empty.percentile(0.5) == 0 && empty.mean() == 0);
+}
+
+NGW_TEST(counter_shards_sum)
+{
+    static const int threads = 24, per_thread = 50000;
+    MetricCounter *counter = new MetricCounter();
+    // 线程数多于分片数，有些线程共用一个分片
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.push_back(thread([counter, t]()
+        {
+            for (int i = 0; i < per_thread; i++)
+                counter->add(t % 3 + 1);
+        }));
+    for (int t = 0; t < threads; t++)
+        workers[t].join();
+
+    u64 expected = 0;
+    for (int t = 0; t < threads; t++)
+        expected += static_cast<u64>(t % 3 + 1) * per_thread;
+    NGW_CHECK(counter->value() == expected);
+    NGW_CHECK(reinterpret_cast<size_t>(counter) % 64 == 0);
+    delete counter;
+}
+
+NGW_TEST(metrics_snapshot_format)
+{
+    MetricsRegistry registry;
+    registry.histogram("c.time_ns")->record(10);
+    registry.histogram("c.time_ns")->record(20);
+    registry.histogram("c.time_ns")->record(30);
+    registry.gauge("b.depth")->set(-3);
+    registry.counter("a.bytes")->add(5);
+    registry.counter("a.bytes")->add(7);
+    registry.counter("0.first")->add();
+    // 同一个名字返回同一个指标
+    NGW_CHECK(registry.counter("a.bytes") == registry.counter("a.bytes"));
+
+    // 先计数器、再仪表、最后直方图，同类按名字排序
+    const string expected =
+        "0.first counter 1\n"
+        "a.bytes counter 12\n"
+        "b.depth gauge -3\n"
+        "c.time_ns histogram count=3 mean=20.0 p50=20 p90=30 p99=30 max=30\n";
+    string text;
+    registry.snapshot(text);
+    NGW_CHECK(text == expected);
+
+    // 写入文件的内容与快照相同
+    char file_name[64];
+    snprintf(file_name, sizeof(file_name), "/tmp/ngworld_metrics_test_%d.txt", static_cast<int>(getpid()));
+    NGW_CHECK(registry.write_snapshot(file_name));
+    ifstream fin(file_name);
+    NGW_CHECK(string(istreambuf_iterator<char>(fin), istreambuf_iterator<char>()) == expected);
+    remove(file_name);
+}
+
+NGW_TEST(metrics_tick_time)
+{
+    MetricHistogram *busy = metrics().histogram("tick.busy_ns");
+    MetricHistogramSnapshot before, after;
+    busy->snapshot(before);
+
+    // 每个tick忙1毫秒，第一次wait_next()只是起点，之后每次记录一个tick的耗时
+    FixedTimestepLoop loop(3000000, 0);
+    loop.wait_next();
+    for (int i = 0; i < 3; i++)
+    {
+        OSLayer::sleep_until(OSLayer::now_ns() + 1000000);
+        loop.wait_next();
+    }
+    busy->snapshot(after);
+    NGW_CHECK(after.count == before.count + 3);
+    NGW_CHECK(after.sum - before.sum >= 3000000);
+}
@@ -0,0 +1,187 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "noise.h"
+#include "randgen.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cstdio>
+#include <vector>
+using namespace std;
+
+static const int grid = PerlinNoise::grid_size;
+
+// 起点包括负坐标和跨越整数格点的位置，间距包括小于1和大于1的情况
+static const double origins[][3] = { { 0, 0, 0 }, { -17.25, 3.5, -0.125 }, { 1000.3, -2048.7, 77.7 } };
+static const double steps[] = { 1.0 / 16, 0.37, 1.0, 2.5 };
+
+NGW_TEST(noise_grid_matches_points)
+{
+    PhiloxRandGen rng(1);
+    PerlinNoise noise(&rng);
+    vector<double> out(grid * grid * grid);
+    for (size_t o = 0; o < sizeof(origins) / sizeof(origins[0]); o++)
+        for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); s++)
+        {
+            const double *p = origins[o], step = steps[s];
+            bool ok = true;
+
+            noise.grid_2d(p[0], p[1], step, &out[0]);
+            for (int y = 0; y < grid; y++)
+                for (int x = 0; x < grid; x++)
+                    ok = ok && out[y * grid + x] == noise.noise_2d(p[0] + x * step, p[1] + y * step);
+
+            noise.grid_3d(p[0], p[1], p[2], step, &out[0]);
+            for (int y = 0; y < grid; y++)
+                for (int z = 0; z < grid; z++)
+                    for (int x = 0; x < grid; x++)
+                        ok = ok && out[(y * grid + z) * grid + x] ==
+                                   noise.noise_3d(p[0] + x * step, p[1] + y * step, p[2] + z * step);
+            NGW_CHECK(ok);
+        }
+}
+
+NGW_TEST(noise_fbm_grid_matches_points)
+{
+    PhiloxRandGen rng(2);
+    PerlinNoise noise(&rng);
+    vector<double> out(grid * grid * grid);
+    for (size_t o = 0; o < sizeof(origins) / sizeof(origins[0]); o++)
+        for (int octaves = 1; octaves <= 6; octaves += 5)
+        {
+            const double *p = origins[o], step = 0.37;
+            bool ok = true;
+
+            noise.fbm_grid_2d(p[0], p[1], step, octaves, &out[0], 2.0, 0.5);
+            for (int y = 0; y < grid; y++)
+                for (int x = 0; x < grid; x++)
+                    ok = ok && out[y * grid + x] == noise.fbm_2d(p[0] + x * step, p[1] + y * step, octaves, 2.0, 0.5);
+
+            noise.fbm_grid_3d(p[0], p[1], p[2], step, octaves, &out[0], 1.9, 0.45);
+            for (int y = 0; y < grid; y++)
+                for (int z = 0; z < grid; z++)
+                    for (int x = 0; x < grid; x++)
+                        ok = ok && out[(y * grid + z) * grid + x] ==
+                                   noise.fbm_3d(p[0] + x * step, p[1] + y * step, p[2] + z * step, octaves, 1.9, 0.45);
+            NGW_CHECK(ok);
+        }
+}
+
+NGW_TEST(noise_properties)
+{
+    // 同一个种子得到同一个噪声场，整数格点上的值为0，值域在[-1, 1]内
+    PhiloxRandGen rng_a(3), rng_b(3), rng_c(4);
+    PerlinNoise a(&rng_a), b(&rng_b), c(&rng_c);
+    bool same = true, bounded = true, zero_on_lattice = true;
+    int differs = 0;
+    MersenneRandGen sample(5);
+    for (int i = 0; i < 10000; i++)
+    {
+        double x = sample.get_double_ranged(-500, 500), y = sample.get_double_ranged(-500, 500);
+        double z = sample.get_double_ranged(-500, 500), value = a.noise_3d(x, y, z);
+        same = same && value == b.noise_3d(x, y, z);
+        bounded = bounded && fabs(value) <= 1 && fabs(a.noise_2d(x, y)) <= 1;
+        if (value != c.noise_3d(x, y, z))
+            ++differs;
+        zero_on_lattice = zero_on_lattice && a.noise_3d(floor(x), floor(y), floor(z)) == 0;
+    }
+    NGW_CHECK(same);
+    NGW_CHECK(bounded);
+    NGW_CHECK(zero_on_lattice);
+    NGW_CHECK(differs > 9900);
+}
+
+NGW_TEST(noise_large_coordinates)
+{
+    // 噪声在每个方向上的周期是256，超过int范围的坐标也应当得到周期对应的值
+    PhiloxRandGen rng(6);
+    PerlinNoise noise(&rng);
+    static const double offsets[] = { 256.0 * 16777216, 1099511627776.0, -1099511627776.0, 4503599627370496.0 * 64 };
+    bool ok = true;
+    for (size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++)
+    {
+        double offset = offsets[o];
+        // 2^52以上的double没有小数部分，只比较整数格点附近能精确表示的点
+        double fraction = fabs(offset) < 4503599627370496.0 ? 0.375 : 0;
+        ok = ok && noise.noise_2d(offset + fraction, 7.25) == noise.noise_2d(fraction, 7.25);
+        ok = ok && noise.noise_3d(1.5, offset + fraction, -3.75) == noise.noise_3d(1.5, fraction, -3.75);
+    }
+    NGW_CHECK(ok);
+
+    // 非常大的值和非数也不会导致未定义行为，结果在值域内
+    static const double extremes[] = { 3.0e9, -3.0e9, 1.0e19, -1.0e300, HUGE_VAL, -HUGE_VAL, NAN };
+    for (size_t e = 0; e < sizeof(extremes) / sizeof(extremes[0]); e++)
+    {
+        double value = noise.noise_3d(extremes[e], 0.5, extremes[e]);
+        ok = ok && fabs(value) <= 1;
+    }
+    NGW_CHECK(ok);
+
+    vector<double> out(grid * grid * grid);
+    noise.fbm_grid_3d(3.0e9, -3.0e9, 1.0e12, 0.37, 4, &out[0]);
+    for (int i = 0; i < grid * grid * grid; i += 97)
+        ok = ok && out[i] == noise.fbm_3d(3.0e9 + (i % grid) * 0.37, -3.0e9 + (i / (grid * grid)) * 0.37,
+                                          1.0e12 + (i / grid % grid) * 0.37, 4);
+    NGW_CHECK(ok);
+}
+
+// 地形生成式的负载: 每个区块一次fbm_grid_3d，6层分形
+static const int bench_octaves = 6;
+static const int bench_chunks = 64;
+
+NGW_BENCHMARK(noise_samples_per_second)
+{
+    PhiloxRandGen rng(1);
+    PerlinNoise noise(&rng);
+    const double samples = static_cast<double>(bench_chunks) * grid * grid * grid;
+    vector<double> out(grid * grid * grid);
+    double sum = 0;
+
+    BenchTimer timer;
+    for (int c = 0; c < bench_chunks; c++)
+        for (int y = 0; y < grid; y++)
+            for (int z = 0; z < grid; z++)
+                for (int x = 0; x < grid; x++)
+                    sum += noise.fbm_3d((c * grid + x) / 64.0, y / 64.0, z / 64.0, bench_octaves);
+    bench_report("fbm_3d per point, 1 thread", samples / timer.elapsed_ns() * 1e3, "M samples/s");
+
+    timer.restart();
+    for (int c = 0; c < bench_chunks; c++)
+    {
+        noise.fbm_grid_3d(c * grid / 64.0, 0, 0, 1 / 64.0, bench_octaves, &out[0]);
+        sum += out[c];
+    }
+    bench_report("fbm_grid_3d, 1 thread", samples / timer.elapsed_ns() * 1e3, "M samples/s");
+
+    // 每个区块由一个任务计算，结果写入各自的缓存
+    ThreadPool pool;
+    vector<double> chunks(static_cast<size_t>(bench_chunks) * grid * grid * grid);
+    timer.restart();
+    pool.parallel_for(0, bench_chunks, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; c++)
+            noise.fbm_grid_3d(c * grid / 64.0, 0, 0, 1 / 64.0, bench_octaves, &chunks[c * grid * grid * grid]);
+    });
+    char label[96];
+    snprintf(label, sizeof(label), "fbm_grid_3d, %u threads", pool.thread_count() + 1);
+    bench_report(label, samples / timer.elapsed_ns() * 1e3, "M samples/s");
+    sum += chunks[12345];
+
+    bench_sink += static_cast<u64>(fabs(sum));
+}
@@ -0,0 +1,73 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "randgen.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+static const char *generator_names[] = { "mt19937", "lcg", "philox", "hardware-seeded", "rdrand" };
+
+const char *const *random_generator_names(size_t *count)
+{
+    *count = sizeof(generator_names) / sizeof(generator_names[0]);
+    return generator_names;
+}
+
+RandGen *create_random_generator(const char *name, unsigned int seed)
+{
+    if (strcmp(name, "mt19937") == 0)
+        return new MersenneRandGen(seed);
+    if (strcmp(name, "lcg") == 0)
+        return new LinearRandGen(seed);
+    if (strcmp(name, "philox") == 0)
+        return new PhiloxRandGen(seed);
+    if (strcmp(name, "hardware-seeded") == 0)
+        return new HardwareSeededRandGen();
+#ifdef NGWORLD_X86
+    if (strcmp(name, "rdrand") == 0 && IntelRandGen::is_supported())
+        return new IntelRandGen();
+#endif
+    return NULL;
+}
+
+bool stream_random_to_stdout(const char *name, unsigned long long bytes)
+{
+    RandGen *gen = create_random_generator(name, 1);
+    if (gen == NULL)
+        return false;
+
+    const size_t block_size = 4096;
+    vector<unsigned int> block(block_size);
+    unsigned long long written = 0, block_bytes = block_size * sizeof(unsigned int), count;
+    while (bytes == 0 || written < bytes)
+    {
+        gen->fill_u32(&block[0], block_size);
+        count = block_bytes;
+        if (bytes != 0 && bytes - written < count)
+            count = bytes - written;
+        if (fwrite(&block[0], 1, static_cast<size_t>(count), stdout) != count)
+            break;
+        written += count;
+    }
+    fflush(stdout);
+    delete gen;
+    return true;
+}
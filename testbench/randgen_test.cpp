@@ -0,0 +1,597 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "randgen.h"
+#include "cpu_features.h"
+#include <climits>
+#include <cstdio>
+#include <random>
+#include <vector>
+using namespace std;
+
+// 有界随机整数
+
+NGW_TEST(bounded_u32_in_range)
+{
+    static const unsigned int ranges[] = { 1, 2, 3, 6, 7, 100, 1000003, 0x80000001U, 0xFFFFFFFFU };
+    MersenneRandGen gen(1);
+    for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++)
+    {
+        bool ok = true;
+        for (int i = 0; i < 100000; i++)
+            ok = ok && gen.get_u32_bounded(ranges[r]) < ranges[r];
+        NGW_CHECK(ok);
+    }
+    NGW_CHECK(gen.get_u32_bounded(0) == 0);
+    NGW_CHECK(gen.get_u32_bounded(1) == 0);
+}
+
+NGW_TEST(bounded_u64_in_range)
+{
+    static const unsigned long long ranges[] = { 5, 0x100000000ULL, 0x100000001ULL, 0x8000000000000001ULL, ULLONG_MAX };
+    PhiloxRandGen gen(2);
+    for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++)
+    {
+        bool ok = true;
+        for (int i = 0; i < 100000; i++)
+            ok = ok && gen.get_u64_bounded(ranges[r]) < ranges[r];
+        NGW_CHECK(ok);
+    }
+    NGW_CHECK(gen.get_u64_bounded(0) == 0);
+}
+
+NGW_TEST(signed_ranged)
+{
+    MersenneRandGen gen(3);
+    bool ok = true, seen_low = false, seen_high = false;
+    int value;
+    for (int i = 0; i < 100000; i++)
+    {
+        value = gen.get_s32_ranged(-5, 5);
+        ok = ok && value >= -5 && value < 5;
+        seen_low = seen_low || value == -5;
+        seen_high = seen_high || value == 4;
+        // 参数顺序颠倒时结果相同
+        value = gen.get_s32_ranged(5, -5);
+        ok = ok && value >= -5 && value < 5;
+        // 区间长度超过INT_MAX时不能溢出
+        value = gen.get_s32_ranged(INT_MIN, INT_MAX);
+        ok = ok && value < INT_MAX;
+        long long wide = gen.get_s64_ranged(LLONG_MIN, LLONG_MAX);
+        ok = ok && wide < LLONG_MAX;
+    }
+    NGW_CHECK(ok);
+    NGW_CHECK(seen_low && seen_high);
+    NGW_CHECK(gen.get_s32_ranged(7, 7) == 7);
+}
+
+NGW_TEST(bounded_uniformity)
+{
+    // 6个桶，自由度为5，卡方统计量超过30的概率约为1e-5
+    const int buckets = 6, exps = 600000;
+    PhiloxRandGen gen(4);
+    vector<int> count(buckets, 0);
+    for (int i = 0; i < exps; i++)
+        ++count[gen.get_u32_bounded(buckets)];
+    double expected = exps * 1.0 / buckets, chi_square = 0;
+    for (int i = 0; i < buckets; i++)
+        chi_square += (count[i] - expected) * (count[i] - expected) / expected;
+    NGW_CHECK(chi_square < 30);
+
+    // 接近2^32的区间是取模偏差最明显的情况: 对range = 3 * 2^30，
+    // 取模会使[0, 2^30)的概率是其他部分的两倍，这里检验前三分之一只占约1/3
+    const unsigned int range = 0xC0000000U;
+    int low = 0;
+    for (int i = 0; i < exps; i++)
+        if (gen.get_u32_bounded(range) < 0x40000000U)
+            ++low;
+    NGW_CHECK(low > exps * 0.32 && low < exps * 0.346);
+}
+
+NGW_TEST(one_in_and_x_in_y)
+{
+    MersenneRandGen gen(5);
+    bool ok = true;
+    int hits = 0;
+    for (int i = 0; i < 10000; i++)
+    {
+        ok = ok && gen.one_in(1) && gen.x_in_y(3, 3) && !gen.x_in_y(0, 3) && !gen.x_in_y(1, 0);
+        if (gen.one_in(4))
+            ++hits;
+    }
+    NGW_CHECK(ok);
+    NGW_CHECK(hits > 2200 && hits < 2800);
+}
+
+// 世界生成式的负载: 大量很小的区间，例如每个方块选择矿物、植被的种类
+static const unsigned int worldgen_ranges[8] = { 2, 3, 5, 7, 10, 16, 100, 6 };
+static const int worldgen_draws = 1 << 22;
+
+template <typename Generator>
+static void bench_bounded(const char *name)
+{
+    // 都通过基类指针调用，与世界生成代码的用法相同，两条路径都要经过虚函数分派
+    Generator generator(1);
+    RandGen &gen = generator;
+    u64 sum = 0;
+    char label[96];
+
+    BenchTimer timer;
+    for (int i = 0; i < worldgen_draws; i++)
+        sum += gen.get_u32() % worldgen_ranges[i & 7];
+    snprintf(label, sizeof(label), "%s modulo (biased)", name);
+    bench_report(label, timer.elapsed_ns() / worldgen_draws, "ns/value");
+
+    timer.restart();
+    for (int i = 0; i < worldgen_draws; i++)
+        sum += gen.get_u32_bounded(worldgen_ranges[i & 7]);
+    snprintf(label, sizeof(label), "%s get_u32_bounded (Lemire)", name);
+    bench_report(label, timer.elapsed_ns() / worldgen_draws, "ns/value");
+
+    timer.restart();
+    for (int i = 0; i < worldgen_draws; i++)
+        sum += gen.get_s32_ranged(-static_cast<int>(worldgen_ranges[i & 7]), 8);
+    snprintf(label, sizeof(label), "%s get_s32_ranged", name);
+    bench_report(label, timer.elapsed_ns() / worldgen_draws, "ns/value");
+
+    bench_sink += sum;
+}
+
+NGW_BENCHMARK(bounded_worldgen)
+{
+    bench_bounded<MersenneRandGen>("mt19937");
+    bench_bounded<LinearRandGen>("lcg");
+    bench_bounded<PhiloxRandGen>("philox");
+}
+
+// Philox4x32-10
+
+NGW_TEST(philox_known_answers)
+{
+    // Random123发行版中kat_vectors里的philox4x32_10测试向量
+    static const unsigned int vectors[3][10] = {
+        { 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+          0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 },
+        { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+          0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd },
+        { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344, 0xa4093822, 0x299f31d0,
+          0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 },
+    };
+    for (int i = 0; i < 3; i++)
+    {
+        unsigned int output[4];
+        PhiloxRandGen::philox_block(vectors[i], vectors[i] + 4, output);
+        for (int j = 0; j < 4; j++)
+            NGW_CHECK(output[j] == vectors[i][6 + j]);
+    }
+}
+
+NGW_TEST(philox_hash_matches_stream)
+{
+    static const int coordinates[][3] = {
+        { 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { -1, -1, -1 }, { 123456, -7, 98765 },
+    };
+    static const unsigned long long seeds[] = { 0, 1, 0xDEADBEEFCAFEBABEULL };
+    for (size_t s = 0; s < sizeof(seeds) / sizeof(seeds[0]); s++)
+        for (size_t c = 0; c < sizeof(coordinates) / sizeof(coordinates[0]); c++)
+        {
+            const int *p = coordinates[c];
+            PhiloxRandGen gen(seeds[s], p[0], p[1], p[2]);
+            NGW_CHECK(PhiloxRandGen::hash(seeds[s], p[0], p[1], p[2]) == gen.get_u64());
+        }
+}
+
+NGW_TEST(philox_streams_independent_of_order)
+{
+    // 相邻坐标、相邻种子的流互不相同
+    const unsigned long long seed = 42;
+    NGW_CHECK(PhiloxRandGen::hash(seed, 0, 0, 0) != PhiloxRandGen::hash(seed, 1, 0, 0));
+    NGW_CHECK(PhiloxRandGen::hash(seed, 1, 0, 0) != PhiloxRandGen::hash(seed, 0, 1, 0));
+    NGW_CHECK(PhiloxRandGen::hash(seed, 0, 1, 0) != PhiloxRandGen::hash(seed, 0, 0, 1));
+    NGW_CHECK(PhiloxRandGen::hash(seed, 0, 0, 0) != PhiloxRandGen::hash(seed + 1, 0, 0, 0));
+
+    // 按不同顺序打开同一批区块，每个区块得到的序列相同
+    const int chunks = 16, values = 100;
+    vector<unsigned int> forward(chunks * values), backward(chunks * values);
+    for (int c = 0; c < chunks; c++)
+    {
+        PhiloxRandGen gen(seed, c, 0, -c);
+        for (int i = 0; i < values; i++)
+            forward[c * values + i] = gen.get_u32();
+    }
+    for (int c = chunks - 1; c >= 0; c--)
+    {
+        PhiloxRandGen gen(seed, c, 0, -c);
+        gen.fill_u32(&backward[c * values], values);
+    }
+    NGW_CHECK(forward == backward);
+}
+
+// 批量生成
+
+// 交替调用fill_u32()和get_u32()，长度不与生成器内部的块对齐，
+// 结果必须与逐个调用get_u32()完全相同
+template <typename Generator>
+static bool fill_matches_single(unsigned int seed)
+{
+    static const size_t lengths[] = { 0, 1, 3, 4, 5, 255, 256, 257, 623, 624, 625, 1000, 5000 };
+    Generator single(seed), batch(seed);
+    vector<unsigned int> expected, actual;
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+    {
+        for (size_t i = 0; i < lengths[l]; i++)
+            expected.push_back(single.get_u32());
+        size_t offset = actual.size();
+        actual.resize(offset + lengths[l]);
+        if (lengths[l] > 0)
+            batch.fill_u32(&actual[offset], lengths[l]);
+        expected.push_back(single.get_u32());
+        actual.push_back(batch.get_u32());
+    }
+    return expected == actual;
+}
+
+template <typename Generator>
+static bool fill_double_matches_single(unsigned int seed)
+{
+    const size_t n = 1000;
+    Generator single(seed), batch(seed);
+    vector<double> values(n);
+    batch.fill_double(&values[0], n);
+    bool ok = true;
+    for (size_t i = 0; i < n; i++)
+        ok = ok && values[i] >= 0 && values[i] < 1 && values[i] == single.get_double_co();
+    return ok;
+}
+
+NGW_TEST(fill_u32_matches_get_u32)
+{
+    NGW_CHECK(fill_matches_single<MersenneRandGen>(1));
+    NGW_CHECK(fill_matches_single<LinearRandGen>(2));
+    NGW_CHECK(fill_matches_single<PhiloxRandGen>(3));
+}
+
+NGW_TEST(fill_double_matches_get_double_co)
+{
+    NGW_CHECK(fill_double_matches_single<MersenneRandGen>(1));
+    NGW_CHECK(fill_double_matches_single<LinearRandGen>(2));
+    NGW_CHECK(fill_double_matches_single<PhiloxRandGen>(3));
+
+    // 非确定性的生成器只检查取值范围
+    HardwareSeededRandGen hardware;
+    vector<double> values(1000);
+    hardware.fill_double(&values[0], values.size());
+    bool ok = true;
+    for (size_t i = 0; i < values.size(); i++)
+        ok = ok && values[i] >= 0 && values[i] < 1;
+    NGW_CHECK(ok);
+}
+
+static const size_t fill_count = 1 << 22;
+
+static void bench_fill(RandGen &gen, const char *name)
+{
+    vector<unsigned int> buffer(4096);
+    u64 sum = 0;
+    char label[96];
+
+    BenchTimer timer;
+    for (size_t done = 0; done < fill_count; done += buffer.size())
+        for (size_t i = 0; i < buffer.size(); i++)
+            buffer[i] = gen.get_u32();
+    sum += buffer[0];
+    snprintf(label, sizeof(label), "%s get_u32 loop", name);
+    bench_report(label, timer.elapsed_ns() / fill_count, "ns/value");
+
+    timer.restart();
+    for (size_t done = 0; done < fill_count; done += buffer.size())
+        gen.fill_u32(&buffer[0], buffer.size());
+    sum += buffer[0];
+    snprintf(label, sizeof(label), "%s fill_u32", name);
+    bench_report(label, timer.elapsed_ns() / fill_count, "ns/value");
+
+    bench_sink += sum;
+}
+
+NGW_BENCHMARK(fill_u32)
+{
+    MersenneRandGen mersenne(1);
+    LinearRandGen linear(1);
+    PhiloxRandGen philox(1);
+    HardwareSeededRandGen hardware;
+    bench_fill(mersenne, "mt19937");
+    bench_fill(linear, "lcg");
+    bench_fill(philox, "philox");
+    bench_fill(hardware, "hardware-seeded");
+#ifdef NGWORLD_X86
+    if (IntelRandGen::is_supported())
+    {
+        IntelRandGen intel;
+        bench_fill(intel, "rdrand");
+    }
+#endif
+}
+
+// MT19937
+
+// 状态重新生成按CPU特性选择AVX2/SSE2/通用实现，进程内只选择一次。
+// 其他实现用NGWORLD_CPU_DISABLE=avx2或NGWORLD_CPU_DISABLE=avx2,sse2运行本测试来覆盖
+NGW_TEST(mt19937_reference_output)
+{
+    NGW_CHECK(MersenneRandGen::is_standard_mt19937());
+
+    // 与标准库的std::mt19937逐个比较，覆盖多次状态重新生成
+    static const unsigned int seeds[] = { 0, 1, 5489, 0x12345678, 0xFFFFFFFF };
+    for (size_t s = 0; s < sizeof(seeds) / sizeof(seeds[0]); s++)
+    {
+        MersenneRandGen gen(seeds[s]);
+        std::mt19937 reference(seeds[s]);
+        bool ok = true;
+        for (int i = 0; i < 624 * 20 + 7; i++)
+            ok = ok && gen.get_u32() == reference();
+        NGW_CHECK(ok);
+
+        gen.seed(seeds[s]);
+        reference.seed(seeds[s]);
+        vector<unsigned int> values(624 * 20 + 7);
+        gen.fill_u32(&values[0], values.size());
+        for (size_t i = 0; i < values.size(); i++)
+            ok = ok && values[i] == reference();
+        NGW_CHECK(ok);
+    }
+    printf("    %s\n", cpu_dispatch_report().c_str());
+}
+
+NGW_BENCHMARK(mt19937_twist)
+{
+    // 每次取624个数正好触发一次状态重新生成
+    const int rounds = 20000;
+    unsigned int buffer[624];
+    u64 sum = 0;
+
+    MersenneRandGen gen(1);
+    BenchTimer timer;
+    for (int r = 0; r < rounds; r++)
+    {
+        gen.fill_u32(buffer, 624);
+        sum += buffer[r % 624];
+    }
+    double elapsed = timer.elapsed_ns();
+    bench_report("MersenneRandGen fill_u32", elapsed / (rounds * 624.0), "ns/value");
+    bench_report("MersenneRandGen throughput", rounds * 624.0 * 4 / elapsed, "GB/s");
+
+    std::mt19937 reference(1);
+    timer.restart();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < 624; i++)
+            buffer[i] = reference();
+        sum += buffer[r % 624];
+    }
+    elapsed = timer.elapsed_ns();
+    bench_report("std::mt19937", elapsed / (rounds * 624.0), "ns/value");
+    bench_report("std::mt19937 throughput", rounds * 624.0 * 4 / elapsed, "GB/s");
+
+    printf("    %s\n", cpu_dispatch_report().c_str());
+    bench_sink += sum;
+}
+
+// 随机性检验与吞吐量，用于按实测的速度和质量为世界生成选择生成器
+
+NGW_TEST(randgen_quality_battery)
+{
+    size_t count;
+    const char *const *names = random_generator_names(&count);
+    for (size_t i = 0; i < count; i++)
+    {
+        RandGen *gen = create_random_generator(names[i], 12345);
+        if (gen == NULL)
+            continue;
+        bool even = gen->is_evenly_distributed(), pi = gen->monte_carlo_calc_pi();
+        bool chi = gen->chi_square_test(), serial = gen->serial_correlation_test();
+        bool birthday = gen->birthday_spacings_test();
+        printf("    %-16s even %s, pi %s, chi-square %s, serial %s, birthday %s\n", names[i],
+               even ? "ok" : "FAIL", pi ? "ok" : "FAIL", chi ? "ok" : "FAIL",
+               serial ? "ok" : "FAIL", birthday ? "ok" : "FAIL");
+        NGW_CHECK(even && pi && chi && serial && birthday);
+        delete gen;
+    }
+}
+
+NGW_BENCHMARK(randgen_throughput)
+{
+    const size_t block_size = 4096;
+    const unsigned long long bytes = 1ULL << 28;
+    vector<unsigned int> block(block_size);
+    size_t count;
+    const char *const *names = random_generator_names(&count);
+    char label[96];
+    for (size_t i = 0; i < count; i++)
+    {
+        RandGen *gen = create_random_generator(names[i], 1);
+        if (gen == NULL)
+            continue;
+        u64 sum = 0;
+        BenchTimer timer;
+        for (unsigned long long generated = 0; generated < bytes; generated += block_size * sizeof(unsigned int))
+        {
+            gen->fill_u32(&block[0], block_size);
+            sum += block[block_size - 1];
+        }
+        snprintf(label, sizeof(label), "%s", names[i]);
+        bench_report(label, bytes / timer.elapsed_ns(), "GB/s");
+        bench_sink += sum;
+        delete gen;
+    }
+}
+
+// 跳跃
+
+template <typename Generator>
+static bool discard_matches_stepping(unsigned int seed)
+{
+    // 包括不与624对齐的长度，以及在状态数组用到一半时跳过
+    static const unsigned long long steps[] = { 0, 1, 2, 623, 624, 625, 1000, 1248, 10007 };
+    bool ok = true;
+    for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); s++)
+        for (int consumed = 0; consumed < 400; consumed += 397)
+        {
+            Generator stepped(seed), jumped(seed);
+            for (int i = 0; i < consumed; i++)
+            {
+                stepped.get_u32();
+                jumped.get_u32();
+            }
+            for (unsigned long long i = 0; i < steps[s]; i++)
+                stepped.get_u32();
+            jumped.discard(steps[s]);
+            for (int i = 0; i < 1000; i++)
+                ok = ok && stepped.get_u32() == jumped.get_u32();
+        }
+    return ok;
+}
+
+template <typename Generator>
+static bool discard_composes(unsigned int seed, unsigned long long a, unsigned long long b)
+{
+    Generator once(seed), twice(seed);
+    once.discard(a + b);
+    twice.discard(a);
+    twice.discard(b);
+    bool ok = true;
+    for (int i = 0; i < 1000; i++)
+        ok = ok && once.get_u32() == twice.get_u32();
+    return ok;
+}
+
+NGW_TEST(discard_matches_get_u32)
+{
+    NGW_CHECK(discard_matches_stepping<LinearRandGen>(7));
+    NGW_CHECK(discard_matches_stepping<MersenneRandGen>(7));
+
+    NGW_CHECK(discard_composes<LinearRandGen>(8, 123456789ULL, 987654321ULL));
+    NGW_CHECK(discard_composes<MersenneRandGen>(8, 123456789012345ULL, 98765432109876ULL));
+
+    // 一次跳过的数较多时也与逐个生成一致
+    MersenneRandGen stepped(9), jumped(9);
+    for (int i = 0; i < 3000000; i++)
+        stepped.get_u32();
+    jumped.discard(3000000);
+    NGW_CHECK(stepped.get_u32() == jumped.get_u32());
+}
+
+NGW_TEST(jump_splits_streams)
+{
+    // LCG的jump()前进2^24个数
+    LinearRandGen linear_jumped(10), linear_discarded(10);
+    linear_jumped.jump();
+    linear_discarded.discard(1ULL << 24);
+    bool ok = true;
+    for (int i = 0; i < 1000; i++)
+        ok = ok && linear_jumped.get_u32() == linear_discarded.get_u32();
+    NGW_CHECK(ok);
+
+    // MT19937的jump()前进624*2^120个数，无法逐个验证，
+    // 检查它与discard()可交换，包括在状态数组用到一半(1000不是624的倍数)时跳跃
+    MersenneRandGen a(11), b(11), original(11);
+    a.jump();
+    a.discard(1000);
+    b.discard(1000);
+    b.jump();
+    ok = true;
+    int same_as_original = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        unsigned int value = a.get_u32();
+        ok = ok && value == b.get_u32();
+        if (value == original.get_u32())
+            ++same_as_original;
+    }
+    NGW_CHECK(ok);
+    NGW_CHECK(same_as_original < 5);
+}
+
+NGW_BENCHMARK(discard)
+{
+    const unsigned long long n = 1000000;
+    u64 sum = 0;
+
+    MersenneRandGen mersenne(1);
+    BenchTimer timer;
+    for (int i = 0; i < 10; i++)
+        mersenne.discard(n + i);
+    bench_report("MersenneRandGen discard(1e6)", timer.elapsed_ns() / 10e6, "ms");
+    timer.restart();
+    for (unsigned long long i = 0; i < n; i++)
+        sum += mersenne.get_u32();
+    bench_report("MersenneRandGen 1e6 get_u32", timer.elapsed_ns() / 1e6, "ms");
+
+    // 第一次多项式跳跃要求出特征多项式和各级跳跃多项式，单独计时
+    timer.restart();
+    mersenne.discard(1ULL << 62);
+    bench_report("MersenneRandGen first discard(2^62)", timer.elapsed_ns() / 1e6, "ms");
+    timer.restart();
+    mersenne.discard(1ULL << 62);
+    bench_report("MersenneRandGen discard(2^62)", timer.elapsed_ns() / 1e6, "ms");
+    // 最坏情况: 块数的每个高位都是1
+    timer.restart();
+    mersenne.discard(~0ULL);
+    bench_report("MersenneRandGen discard(2^64-1)", timer.elapsed_ns() / 1e6, "ms");
+    // 把序列按2^40个数的间隔分给各个线程
+    timer.restart();
+    for (int i = 0; i < 10; i++)
+        mersenne.discard(1ULL << 40);
+    bench_report("MersenneRandGen discard(2^40)", timer.elapsed_ns() / 10e6, "ms");
+
+    timer.restart();
+    mersenne.jump();
+    bench_report("MersenneRandGen first jump", timer.elapsed_ns() / 1e6, "ms");
+    timer.restart();
+    mersenne.jump();
+    bench_report("MersenneRandGen jump", timer.elapsed_ns() / 1e6, "ms");
+
+    LinearRandGen linear(1);
+    timer.restart();
+    for (int i = 0; i < 100000; i++)
+        linear.discard(n + i);
+    bench_report("LinearRandGen discard(1e6)", timer.elapsed_ns() / 100000, "ns");
+
+    bench_sink += sum + mersenne.get_u32() + linear.get_u32();
+}
+
+#ifdef NGWORLD_X86
+NGW_TEST(rdrand_never_repeats_stale_values)
+{
+    if (!IntelRandGen::is_supported())
+        return;
+    // 硬件正常时不应该用到后备生成器，相邻的数也不应该重复出现
+    IntelRandGen gen;
+    vector<unsigned int> values(10001);
+    gen.fill_u32(&values[0], values.size());
+    int repeats = 0;
+    for (size_t i = 1; i < values.size(); i++)
+        if (values[i] == values[i-1])
+            ++repeats;
+    for (int i = 0; i < 1000; i++)
+        if (gen.get_u32() == gen.get_u32())
+            ++repeats;
+    NGW_CHECK(repeats == 0);
+    NGW_CHECK(gen.failure_count() == 0);
+}
+#endif
@@ -0,0 +1,76 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "fundamental_structure.h"
+#include <cstdio>
+#include <type_traits>
+#include <vector>
+using namespace std;
+
+// 原来的Vector3D带有用户定义的析构函数，不是平凡可复制的，
+// std::vector扩容和复制时只能逐个调用构造函数
+struct LegacyVector3D
+{
+    s32 x, y, z;
+    LegacyVector3D() : x(), y(), z() { }
+    LegacyVector3D(s32 _x, s32 _y, s32 _z) : x(_x), y(_y), z(_z) { }
+    ~LegacyVector3D() { }
+};
+
+static_assert(!std::is_trivially_copyable<LegacyVector3D>::value, "the baseline must not be trivially copyable");
+
+static const size_t vector_count = 1 << 20;
+static const int vector_rounds = 20;
+
+template <typename Vector>
+static void bench_vector_copy(const char *name)
+{
+    char label[96];
+    u64 sum = 0;
+
+    // 不预留空间，逐个push_back，测量扩容时搬移元素的代价
+    BenchTimer timer;
+    for (int round = 0; round < vector_rounds; round++)
+    {
+        vector<Vector> grown;
+        for (size_t i = 0; i < vector_count; i++)
+            grown.push_back(Vector(static_cast<s32>(i), round, -static_cast<s32>(i)));
+        sum += grown[round].x;
+    }
+    snprintf(label, sizeof(label), "%s push_back growth", name);
+    bench_report(label, timer.elapsed_ns() / (static_cast<double>(vector_rounds) * vector_count), "ns/element");
+
+    vector<Vector> source(vector_count, Vector(1, 2, 3));
+    timer.restart();
+    for (int round = 0; round < vector_rounds; round++)
+    {
+        vector<Vector> copy(source);
+        sum += copy[round].y;
+    }
+    snprintf(label, sizeof(label), "%s bulk copy", name);
+    bench_report(label, timer.elapsed_ns() / (static_cast<double>(vector_rounds) * vector_count), "ns/element");
+
+    bench_sink += sum;
+}
+
+NGW_BENCHMARK(vector3d_copy)
+{
+    bench_vector_copy<LegacyVector3D>("legacy Vector3D");
+    bench_vector_copy<v3s32>("v3s32");
+}
@@ -0,0 +1,101 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * 文件名: testbench.h
+ * 作用: TestBench的测试框架
+ *
+ * NGW_TEST定义正确性测试，NGW_BENCHMARK定义性能测试，例如
+ *     NGW_TEST(bounded_u32_in_range)
+ *     {
+ *         MersenneRandGen gen(1);
+ *         NGW_CHECK(gen.get_u32_bounded(6) < 6);
+ *     }
+ * 测试在程序启动时自动注册，由main.cpp按名字筛选后依次运行。
+ * NGW_CHECK失败时记录文件和行号，测试继续执行。
+ */
+
+#ifndef _TESTBENCH_H_
+#define _TESTBENCH_H_
+
+#include <chrono>
+#include <cstddef>
+#include "fundamental_types.h"
+
+typedef void (*TestFunction)();
+
+struct TestRegistrar
+{
+    TestRegistrar(const char *name, TestFunction function, bool benchmark);
+};
+
+#define NGW_TEST(name) \
+    static void test_##name(); \
+    static TestRegistrar test_registrar_##name(#name, test_##name, false); \
+    static void test_##name()
+
+#define NGW_BENCHMARK(name) \
+    static void benchmark_##name(); \
+    static TestRegistrar benchmark_registrar_##name(#name, benchmark_##name, true); \
+    static void benchmark_##name()
+
+void testbench_fail(const char *file, int line, const char *expression);
+
+#define NGW_CHECK(expression) \
+    do \
+    { \
+        if (!(expression)) \
+            testbench_fail(__FILE__, __LINE__, #expression); \
+    } while (0)
+
+// 输出一行性能测试结果，例如bench_report("mt19937 fill_u32", 1.23, "ns/value")
+void bench_report(const char *name, double value, const char *unit);
+
+// 把结果累加到这里，防止被测的计算被编译器删除
+extern volatile u64 bench_sink;
+
+class BenchTimer
+{
+private:
+    std::chrono::steady_clock::time_point m_start;
+
+public:
+    BenchTimer() : m_start(std::chrono::steady_clock::now()) { }
+
+    void restart() { m_start = std::chrono::steady_clock::now(); }
+
+    // 经过的时间，单位纳秒
+    double elapsed_ns() const
+    {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - m_start).count();
+    }
+};
+
+// 随机数生成器，定义在randgen_stream.cpp
+
+class RandGen;
+
+// 可以按名字创建的生成器，例如"mt19937"、"philox"
+const char *const *random_generator_names(size_t *count);
+// 名字未知或当前CPU不支持时返回NULL，返回的对象由调用者delete
+RandGen *create_random_generator(const char *name, unsigned int seed);
+// 把原始输出以二进制写到标准输出，供PractRand等外部工具检验，
+// bytes为0时一直输出，直到标准输出被关闭。名字未知时返回false
+bool stream_random_to_stdout(const char *name, unsigned long long bytes);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "fundamental_utility.h"
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// 每个下标恰好被调用一次，每块都在范围内且不超过grain个元素
+static bool parallel_for_covers(ThreadPool &pool, size_t begin, size_t end, size_t grain)
+{
+    size_t size = end > begin ? end : begin;
+    vector<atomic<int> > hits(size + 1);
+    for (size_t i = 0; i < hits.size(); i++)
+        hits[i].store(0);
+    atomic<bool> chunks_ok(true);
+    size_t effective_grain = grain == 0 ? 1 : grain;
+
+    pool.parallel_for(begin, end, grain, [&](size_t chunk_begin, size_t chunk_end)
+    {
+        if (chunk_begin < begin || chunk_end > end || chunk_begin >= chunk_end ||
+            chunk_end - chunk_begin > effective_grain)
+            chunks_ok.store(false);
+        for (size_t i = chunk_begin; i < chunk_end && i < hits.size(); i++)
+            hits[i].fetch_add(1);
+    });
+
+    bool ok = chunks_ok.load();
+    for (size_t i = 0; i < hits.size(); i++)
+        ok = ok && hits[i].load() == (i >= begin && i < end ? 1 : 0);
+    return ok;
+}
+
+NGW_TEST(parallel_for_coverage)
+{
+    static const size_t ranges[][2] = { { 0, 0 }, { 5, 5 }, { 10, 3 }, { 0, 1 }, { 3, 1000 }, { 0, 100000 } };
+    static const size_t grains[] = { 0, 1, 7, 64, 1000, 1000000 };
+    static const unsigned int threads[] = { 1, 3, 8 };
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+    {
+        ThreadPool pool(threads[t]);
+        for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++)
+            for (size_t g = 0; g < sizeof(grains) / sizeof(grains[0]); g++)
+                NGW_CHECK(parallel_for_covers(pool, ranges[r][0], ranges[r][1], grains[g]));
+    }
+}
+
+NGW_TEST(parallel_for_nested)
+{
+    // 任务里再调用parallel_for，等待的工作线程也会执行其他任务，不会死锁
+    ThreadPool pool(4);
+    const size_t outer = 32, inner = 1000;
+    vector<atomic<int> > hits(outer * inner);
+    for (size_t i = 0; i < hits.size(); i++)
+        hits[i].store(0);
+    pool.parallel_for(0, outer, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t o = begin; o < end; o++)
+            pool.parallel_for(0, inner, 37, [&](size_t inner_begin, size_t inner_end)
+            {
+                for (size_t i = inner_begin; i < inner_end; i++)
+                    hits[o * inner + i].fetch_add(1);
+            });
+    });
+    bool ok = true;
+    for (size_t i = 0; i < hits.size(); i++)
+        ok = ok && hits[i].load() == 1;
+    NGW_CHECK(ok);
+}
+
+NGW_TEST(task_dependencies)
+{
+    ThreadPool pool(4);
+    for (int round = 0; round < 200; round++)
+    {
+        // 菱形依赖: load -> (terrain, light) -> mesh，按相反的顺序提交
+        atomic<int> clock(0);
+        int load_time = -1, terrain_time = -1, light_time = -1, mesh_time = -1;
+        Task load([&] { load_time = clock.fetch_add(1); });
+        Task terrain([&] { terrain_time = clock.fetch_add(1); });
+        Task light([&] { light_time = clock.fetch_add(1); });
+        Task mesh([&] { mesh_time = clock.fetch_add(1); });
+        terrain.depends_on(load);
+        light.depends_on(load);
+        mesh.depends_on(terrain);
+        mesh.depends_on(light);
+
+        pool.submit(mesh);
+        pool.submit(light);
+        pool.submit(terrain);
+        NGW_CHECK(!mesh.finished());
+        pool.submit(load);
+        pool.wait(mesh);
+
+        NGW_CHECK(load_time == 0 && mesh_time == 3);
+        NGW_CHECK(terrain_time > load_time && light_time > load_time);
+        // 前置任务的函数已经执行完，但finished()要等它们通知完后继任务才会成立，
+        // 释放之前还要分别等待
+        pool.wait(terrain);
+        pool.wait(light);
+        pool.wait(load);
+        NGW_CHECK(load.finished() && terrain.finished() && light.finished() && mesh.finished());
+    }
+}
+
+NGW_TEST(many_tasks_and_worker_start)
+{
+    const unsigned int thread_count = 3;
+    vector<atomic<int> > started(thread_count);
+    for (unsigned int i = 0; i < thread_count; i++)
+        started[i].store(0);
+    atomic<int> done(0);
+    {
+        ThreadPool pool(thread_count, [&](unsigned int index) { started[index].fetch_add(1); });
+        const int count = 10000;
+        vector<Task*> tasks;
+        for (int i = 0; i < count; i++)
+        {
+            tasks.push_back(new Task([&] { done.fetch_add(1); }));
+            pool.submit(*tasks.back());
+        }
+        for (int i = 0; i < count; i++)
+        {
+            pool.wait(*tasks[i]);
+            delete tasks[i];
+        }
+        NGW_CHECK(done.load() == count);
+    }
+    bool ok = true;
+    for (unsigned int i = 0; i < thread_count; i++)
+        ok = ok && started[i].load() == 1;
+    NGW_CHECK(ok);
+}
+
+// 计算密集的负载，每个元素的代价大致相同
+static double work_item(size_t i)
+{
+    double x = static_cast<double>(i), sum = 0;
+    for (int k = 0; k < 64; k++)
+        sum += sqrt(x + k);
+    return sum;
+}
+
+NGW_BENCHMARK(thread_pool_scaling)
+{
+    const size_t items = 1 << 20, grain = 1024;
+    vector<double> out(items);
+    char label[96];
+
+    BenchTimer timer;
+    for (size_t i = 0; i < items; i++)
+        out[i] = work_item(i);
+    double serial = timer.elapsed_ns();
+    bench_report("1 thread, no pool", serial / 1e6, "ms");
+
+    unsigned int cores = thread::hardware_concurrency();
+    if (cores == 0)
+        cores = 1;
+    // 调用parallel_for的线程也参与计算，n个线程需要n - 1个工作线程
+    for (unsigned int threads = 2; threads <= (cores > 2 ? cores : 2); threads++)
+    {
+        ThreadPool pool(threads - 1);
+        timer.restart();
+        pool.parallel_for(0, items, grain, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+                out[i] = work_item(i);
+        });
+        double elapsed = timer.elapsed_ns();
+        snprintf(label, sizeof(label), "%u threads", threads);
+        bench_report(label, elapsed / 1e6, "ms");
+        snprintf(label, sizeof(label), "%u threads speedup", threads);
+        bench_report(label, serial / elapsed, "x");
+    }
+    printf("    %u logical CPUs\n", cores);
+    bench_sink += static_cast<u64>(out[items / 2]);
+}
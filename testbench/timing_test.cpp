@@ -0,0 +1,142 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "fundamental_utility.h"
+#include <cmath>
+#include <cstdio>
+#include <vector>
+using namespace std;
+
+NGW_TEST(now_ns_monotonic)
+{
+    u64 previous = OSLayer::now_ns(), now;
+    bool ok = true;
+    for (int i = 0; i < 100000; i++)
+    {
+        now = OSLayer::now_ns();
+        ok = ok && now >= previous;
+        previous = now;
+    }
+    NGW_CHECK(ok);
+
+    // fast_ns()与now_ns()的起点相同，校准结束后两者相差很小
+    OSLayer::fast_ns();
+    OSLayer::sleep_ms(150);
+    u64 fast = OSLayer::fast_ns();
+    now = OSLayer::now_ns();
+    NGW_CHECK(fast + 1000000 > now && fast < now + 1000000);
+}
+
+NGW_TEST(sleep_until_never_early)
+{
+    static const u64 spins[] = { 0, 50000, 200000 };
+    bool ok = true;
+    for (size_t s = 0; s < sizeof(spins) / sizeof(spins[0]); s++)
+        for (int i = 0; i < 20; i++)
+        {
+            u64 deadline = OSLayer::now_ns() + 100000 + i * 37000;
+            OSLayer::sleep_until(deadline, spins[s]);
+            ok = ok && OSLayer::now_ns() >= deadline;
+        }
+    NGW_CHECK(ok);
+
+    // 截止时间已经过去时立即返回
+    u64 start = OSLayer::now_ns();
+    OSLayer::sleep_until(start - 1000000, 200000);
+    OSLayer::sleep_until(0);
+    NGW_CHECK(OSLayer::now_ns() - start < 1000000);
+}
+
+NGW_TEST(fixed_timestep_loop)
+{
+    const u64 period = 2000000;
+    FixedTimestepLoop loop(period, 0);
+    u64 start = loop.wait_next(), tick = start;
+    bool ok = true;
+    for (int i = 1; i <= 10; i++)
+    {
+        tick = loop.wait_next();
+        // 机器繁忙时可能错过tick，错过的也计入周期数
+        ok = ok && tick == start + (i + loop.missed_ticks()) * period && OSLayer::now_ns() >= tick;
+    }
+    NGW_CHECK(ok);
+
+    // 一个tick耗时超过两个周期，错过的tick不追赶，下一个tick仍在起点加整数个周期上
+    u64 missed = loop.missed_ticks();
+    OSLayer::sleep_until(tick + 2 * period + period / 2);
+    u64 next = loop.wait_next();
+    NGW_CHECK(next > tick + 2 * period);
+    NGW_CHECK((next - start) % period == 0);
+    NGW_CHECK(loop.missed_ticks() >= missed + 2);
+    NGW_CHECK(loop.tick_count() == 12);
+}
+
+// 以5ms的周期运行ticks次，统计每个tick实际开始时间与计划时间的偏差(单位微秒)
+static const u64 jitter_period = 5000000;
+static const int jitter_ticks = 200;
+
+static void report_jitter(const char *name, const vector<double> &lateness_us)
+{
+    double sum = 0, sum_sq = 0, worst = 0;
+    for (size_t i = 0; i < lateness_us.size(); i++)
+    {
+        sum += lateness_us[i];
+        sum_sq += lateness_us[i] * lateness_us[i];
+        if (fabs(lateness_us[i]) > worst)
+            worst = fabs(lateness_us[i]);
+    }
+    double mean = sum / lateness_us.size();
+    char label[96];
+    snprintf(label, sizeof(label), "%s mean", name);
+    bench_report(label, mean, "us");
+    snprintf(label, sizeof(label), "%s stddev", name);
+    bench_report(label, sqrt(sum_sq / lateness_us.size() - mean * mean), "us");
+    snprintf(label, sizeof(label), "%s max", name);
+    bench_report(label, worst, "us");
+}
+
+NGW_BENCHMARK(tick_jitter)
+{
+    vector<double> lateness(jitter_ticks);
+
+    // 原来的做法: 每个tick结束后睡眠一个周期，误差会累积，这里统计相邻tick间隔的偏差
+    u64 previous = OSLayer::now_ns(), now;
+    for (int i = 0; i < jitter_ticks; i++)
+    {
+        OSLayer::sleep_us(static_cast<int>(jitter_period / 1000));
+        now = OSLayer::now_ns();
+        lateness[i] = (static_cast<double>(now - previous) - jitter_period) / 1000;
+        previous = now;
+    }
+    report_jitter("sleep_us period deviation", lateness);
+
+    static const u64 spins[] = { 0, 200000 };
+    for (int s = 0; s < 2; s++)
+    {
+        FixedTimestepLoop loop(jitter_period, spins[s]);
+        loop.wait_next();
+        for (int i = 0; i < jitter_ticks; i++)
+        {
+            u64 tick = loop.wait_next();
+            lateness[i] = static_cast<double>(OSLayer::now_ns() - tick) / 1000;
+        }
+        report_jitter(spins[s] ? "FixedTimestepLoop spin 200us, lateness" : "FixedTimestepLoop no spin, lateness",
+                      lateness);
+    }
+}
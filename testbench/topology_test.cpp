@@ -0,0 +1,192 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "fundamental_utility.h"
+#include "randgen.h"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+static vector<int> ids(const int *values, size_t count)
+{
+    return vector<int>(values, values + count);
+}
+
+NGW_TEST(parse_id_list)
+{
+    static const int ranges[] = { 0, 1, 2, 3, 8, 10, 11 };
+    static const int single[] = { 5 };
+    static const int partial[] = { 0, 1, 2 };
+    NGW_CHECK(CPUTopology::parse_id_list("0-3,8,10-11") == ids(ranges, 7));
+    NGW_CHECK(CPUTopology::parse_id_list("5") == ids(single, 1));
+    NGW_CHECK(CPUTopology::parse_id_list("").empty());
+    // 无法解析的部分及其之后的内容被忽略
+    NGW_CHECK(CPUTopology::parse_id_list("0-2,x,7") == ids(partial, 3));
+    NGW_CHECK(CPUTopology::parse_id_list("garbage").empty());
+    // 反向的范围是空的
+    NGW_CHECK(CPUTopology::parse_id_list("3-1").empty());
+}
+
+// 两个NUMA节点，每个节点一个package、两个物理核心，每个核心两个超线程
+// Linux的常见编号: 先是每个核心的第一个超线程，再是第二个
+static CPUTopology two_node_topology()
+{
+    static const int layout[][3] =
+    {
+        // id, core_id, package_id(也是NUMA节点)
+        { 0, 0, 0 }, { 1, 1, 0 }, { 2, 0, 1 }, { 3, 1, 1 },
+        { 4, 0, 0 }, { 5, 1, 0 }, { 6, 0, 1 }, { 7, 1, 1 },
+    };
+    CPUTopology topology;
+    for (size_t i = 0; i < sizeof(layout) / sizeof(layout[0]); i++)
+    {
+        LogicalCPUInfo cpu;
+        cpu.id = layout[i][0];
+        cpu.core_id = layout[i][1];
+        cpu.package_id = layout[i][2];
+        cpu.numa_node = layout[i][2];
+        topology.cpus.push_back(cpu);
+    }
+    topology.package_count = 2;
+    topology.core_count = 4;
+    topology.numa_node_count = 2;
+    topology.cache_line_size = 64;
+    return topology;
+}
+
+NGW_TEST(spread_cpus)
+{
+    CPUTopology topology = two_node_topology();
+    static const int node0[] = { 0, 1, 4, 5 };
+    NGW_CHECK(topology.cpus_of_node(0) == ids(node0, 4));
+    NGW_CHECK(topology.cpus_of_node(2).empty());
+
+    // 节点之间轮流，每个节点先用完不同的物理核心，再用超线程，超过CPU数时从头循环
+    static const int expected[] = { 0, 2, 1, 3, 4, 6, 5, 7, 0, 2 };
+    NGW_CHECK(topology.spread_cpus(10) == ids(expected, 10));
+    NGW_CHECK(topology.spread_cpus(3) == ids(expected, 3));
+    NGW_CHECK(topology.spread_cpus(0).empty());
+
+    // 节点大小不同时，小节点用完后只从大节点中取
+    topology.cpus[1].numa_node = 1;
+    topology.cpus[5].numa_node = 1;
+    static const int uneven[] = { 0, 1, 4, 2, 3, 5, 6, 7 };
+    NGW_CHECK(topology.spread_cpus(8) == ids(uneven, 8));
+
+    NGW_CHECK(CPUTopology().spread_cpus(4).empty());
+}
+
+NGW_TEST(cpu_topology_detected)
+{
+    const CPUTopology &topology = OSLayer::cpu_topology();
+    NGW_CHECK(!topology.cpus.empty());
+    NGW_CHECK(topology.core_count >= 1 && topology.core_count <= static_cast<int>(topology.cpus.size()));
+    NGW_CHECK(topology.numa_node_count >= 1);
+    NGW_CHECK(topology.cache_line_size >= 16);
+
+    // spread_cpus()的每一项都是在线的CPU，CPU数以内不重复
+    vector<int> spread = topology.spread_cpus(static_cast<unsigned int>(topology.cpus.size()));
+    vector<int> online;
+    for (size_t i = 0; i < topology.cpus.size(); i++)
+        online.push_back(topology.cpus[i].id);
+    sort(spread.begin(), spread.end());
+    NGW_CHECK(spread == online);
+
+    for (size_t i = 0; i < topology.caches.size(); i++)
+        NGW_CHECK(topology.caches[i].level >= 1 && topology.caches[i].size > 0 &&
+                  (topology.caches[i].type == 'D' || topology.caches[i].type == 'I' ||
+                   topology.caches[i].type == 'U'));
+}
+
+#ifdef NGWORLD_OS_LINUX
+NGW_TEST(thread_affinity)
+{
+    int cpu = OSLayer::cpu_topology().cpus.back().id;
+    bool pinned = false;
+    int running_on = -1;
+    thread worker([cpu, &pinned, &running_on]()
+    {
+        pinned = OSLayer::set_thread_affinity(cpu);
+        running_on = OSLayer::current_cpu();
+    });
+    worker.join();
+    NGW_CHECK(pinned);
+    NGW_CHECK(running_on == cpu);
+    NGW_CHECK(!OSLayer::set_thread_affinity(vector<int>()));
+}
+#endif
+
+// 线程在cpu_node节点上、内存在memory_node节点上时随机跳转，返回每次访存的平均纳秒数
+// 每个缓存行指向下一个随机的缓存行，硬件预取无法预测，主要测到的是内存延迟
+static double chase_latency_ns(int cpu_node, int memory_node)
+{
+    static const size_t size = 64 << 20, steps = 1 << 21;
+    const size_t line = OSLayer::cpu_topology().cache_line_size, lines = size / line, stride = line / sizeof(size_t);
+    size_t *memory = static_cast<size_t*>(OSLayer::aligned_malloc(size, 4096));
+    if (memory == NULL)
+        return 0;
+    // 先绑定再第一次写入，页直接分配在memory_node上；cpu_node为-1时不固定线程
+    if (memory_node >= 0)
+        OSLayer::bind_memory_to_node(memory, size, memory_node);
+
+    vector<size_t> order(lines);
+    for (size_t i = 0; i < lines; i++)
+        order[i] = i;
+    PhiloxRandGen gen(48);
+    for (size_t i = lines - 1; i > 0; i--)
+        swap(order[i], order[gen.get_u32_bounded(static_cast<unsigned int>(i + 1))]);
+    for (size_t i = 0; i < lines; i++)
+        memory[order[i] * stride] = order[(i + 1) % lines] * stride;
+
+    double result = 0;
+    thread worker([cpu_node, memory, &result]()
+    {
+        if (cpu_node >= 0)
+            OSLayer::set_thread_numa_node(cpu_node);
+        size_t position = 0;
+        BenchTimer timer;
+        for (size_t i = 0; i < steps; i++)
+            position = memory[position];
+        result = timer.elapsed_ns() / steps;
+        bench_sink += position;
+    });
+    worker.join();
+    OSLayer::aligned_free(memory);
+    return result;
+}
+
+NGW_BENCHMARK(numa_locality)
+{
+    const CPUTopology &topology = OSLayer::cpu_topology();
+    char label[96];
+    // 线程固定在节点0上，内存分别在各个节点上，比较本地和远程访问的延迟
+    int nodes = min(topology.numa_node_count, 4);
+    for (int memory_node = 0; memory_node < nodes; memory_node++)
+    {
+        snprintf(label, sizeof(label), "thread on node 0, memory on node %d", memory_node);
+        bench_report(label, chase_latency_ns(0, memory_node), "ns/access");
+    }
+    // 不固定线程也不绑定内存，由调度器和first-touch决定
+    bench_report("unpinned thread, default placement", chase_latency_ns(-1, -1), "ns/access");
+    if (topology.numa_node_count < 2)
+        printf("only one NUMA node, remote access not measured\n");
+}
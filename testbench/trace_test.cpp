@@ -0,0 +1,338 @@
+/*
+ * This file is part of NGWorld.
+ * (C) Copyright 2016 DLaboratory
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testbench.h"
+#include "trace.h"
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+using namespace std;
+
+// 检查导出结果用的最小JSON解析器，只支持trace_export()可能输出的内容，
+// 但语法检查是严格的: 任何多余或缺少的逗号、引号、括号都会导致解析失败
+struct JsonValue
+{
+    enum Type { NONE, STRING, NUMBER, OBJECT, ARRAY } type;
+    string text;
+    double number;
+    map<string, JsonValue> members;
+    vector<JsonValue> elements;
+
+    JsonValue() : type(NONE), number(0) { }
+
+    const JsonValue &operator[](const string &key) const
+    {
+        static const JsonValue missing;
+        map<string, JsonValue>::const_iterator it = members.find(key);
+        return it == members.end() ? missing : it->second;
+    }
+};
+
+class JsonParser
+{
+private:
+    const char *m_p;
+
+    void skip_space()
+    {
+        while (*m_p == ' ' || *m_p == '\n' || *m_p == '\r' || *m_p == '\t')
+            ++m_p;
+    }
+
+    bool parse_string(string &out)
+    {
+        if (*m_p != '"')
+            return false;
+        ++m_p;
+        out.clear();
+        while (*m_p != '"')
+        {
+            unsigned char c = static_cast<unsigned char>(*m_p++);
+            if (c == 0 || c < 0x20)
+                return false;
+            if (c != '\\')
+            {
+                out += static_cast<char>(c);
+                continue;
+            }
+            c = static_cast<unsigned char>(*m_p++);
+            if (c == '"' || c == '\\' || c == '/')
+                out += static_cast<char>(c);
+            else if (c == 'n')
+                out += '\n';
+            else if (c == 't')
+                out += '\t';
+            else if (c == 'u')
+            {
+                char digits[5] = { 0 };
+                for (int i = 0; i < 4; i++)
+                    if (!isxdigit(static_cast<unsigned char>(digits[i] = *m_p++)))
+                        return false;
+                long code = strtol(digits, NULL, 16);
+                if (code >= 0x80)
+                    return false;
+                out += static_cast<char>(code);
+            }
+            else
+                return false;
+        }
+        ++m_p;
+        return true;
+    }
+
+public:
+    explicit JsonParser(const char *text) : m_p(text) { }
+
+    bool parse_value(JsonValue &value)
+    {
+        skip_space();
+        if (*m_p == '"')
+        {
+            value.type = JsonValue::STRING;
+            return parse_string(value.text);
+        }
+        if (*m_p == '{' || *m_p == '[')
+        {
+            bool object = *m_p == '{';
+            char close = object ? '}' : ']';
+            value.type = object ? JsonValue::OBJECT : JsonValue::ARRAY;
+            ++m_p;
+            skip_space();
+            if (*m_p == close)
+            {
+                ++m_p;
+                return true;
+            }
+            for (;;)
+            {
+                JsonValue element;
+                if (object)
+                {
+                    string key;
+                    skip_space();
+                    if (!parse_string(key))
+                        return false;
+                    skip_space();
+                    if (*m_p++ != ':' || !parse_value(element) || value.members.count(key) > 0)
+                        return false;
+                    value.members[key] = element;
+                }
+                else
+                {
+                    if (!parse_value(element))
+                        return false;
+                    value.elements.push_back(element);
+                }
+                skip_space();
+                if (*m_p == close)
+                {
+                    ++m_p;
+                    return true;
+                }
+                if (*m_p++ != ',')
+                    return false;
+            }
+        }
+        char *end;
+        value.type = JsonValue::NUMBER;
+        value.number = strtod(m_p, &end);
+        if (end == m_p || !(*m_p == '-' || isdigit(static_cast<unsigned char>(*m_p))))
+            return false;
+        m_p = end;
+        return true;
+    }
+
+    // 整个文本恰好是一个值
+    bool parse_document(JsonValue &value)
+    {
+        if (!parse_value(value))
+            return false;
+        skip_space();
+        return *m_p == 0;
+    }
+};
+
+// 导出并解析，返回traceEvents数组
+static bool export_and_parse(JsonValue &document)
+{
+    char file_name[64];
+    snprintf(file_name, sizeof(file_name), "/tmp/ngworld_trace_test_%d.json", static_cast<int>(getpid()));
+    if (!trace_export(file_name))
+        return false;
+    ifstream fin(file_name);
+    string text((istreambuf_iterator<char>(fin)), istreambuf_iterator<char>());
+    remove(file_name);
+    JsonParser parser(text.c_str());
+    return parser.parse_document(document) && document.type == JsonValue::OBJECT &&
+        document["traceEvents"].type == JsonValue::ARRAY;
+}
+
+// 按线程名找到线程编号，找不到时返回-1
+static double find_thread(const JsonValue &events, const string &name)
+{
+    for (size_t i = 0; i < events.elements.size(); i++)
+    {
+        const JsonValue &event = events.elements[i];
+        if (event["ph"].text == "M" && event["name"].text == "thread_name" && event["args"]["name"].text == name)
+            return event["tid"].number;
+    }
+    return -1;
+}
+
+// 一个线程的所有完整事件
+static vector<const JsonValue*> thread_events(const JsonValue &events, double tid)
+{
+    vector<const JsonValue*> result;
+    for (size_t i = 0; i < events.elements.size(); i++)
+        if (events.elements[i]["ph"].text == "X" && events.elements[i]["tid"].number == tid)
+            result.push_back(&events.elements[i]);
+    return result;
+}
+
+// 在新线程中记录count个事件，第i个事件持续i纳秒，便于检查导出了哪些事件
+static void record_numbered(const string &thread_name, u64 count)
+{
+    thread worker([&thread_name, count]()
+    {
+        trace_set_thread_name(thread_name);
+        u64 base = OSLayer::fast_ns();
+        for (u64 i = 0; i < count; i++)
+            trace_record("numbered", base, base + i);
+    });
+    worker.join();
+}
+
+NGW_TEST(trace_export_json)
+{
+    trace_stop();
+    trace_clear();
+    trace_start();
+
+    // 名字中的引号、反斜杠和控制字符需要转义
+    thread worker([]()
+    {
+        trace_set_thread_name("trace \"test\" \\ thread\t1");
+        u64 base = OSLayer::fast_ns();
+        trace_record("quote\"d \\name\n", base, base + 1234567);
+        {
+            NGW_TRACE_SCOPE("scope");
+        }
+    });
+    worker.join();
+    trace_stop();
+
+    JsonValue document;
+    NGW_CHECK(export_and_parse(document));
+    const JsonValue &events = document["traceEvents"];
+    double tid = find_thread(events, "trace \"test\" \\ thread\t1");
+    NGW_CHECK(tid > 0);
+
+    vector<const JsonValue*> mine = thread_events(events, tid);
+    NGW_CHECK(mine.size() == 2);
+    if (mine.size() == 2)
+    {
+        NGW_CHECK((*mine[0])["name"].text == "quote\"d \\name\n");
+        NGW_CHECK((*mine[0])["pid"].number == 1);
+        NGW_CHECK((*mine[0])["ts"].type == JsonValue::NUMBER && (*mine[0])["ts"].number >= 0);
+        // 时间单位是微秒，保留三位小数
+        NGW_CHECK(fabs((*mine[0])["dur"].number - 1234.567) < 1e-9);
+        NGW_CHECK((*mine[1])["name"].text == "scope");
+    }
+}
+
+NGW_TEST(trace_ring_wraparound)
+{
+    trace_stop();
+    trace_clear();
+    trace_start();
+    // 超出容量的部分覆盖最旧的事件，写满时最旧的一个也可能正在被覆盖，
+    // 只导出最后trace_buffer_capacity - 1个
+    record_numbered("trace wraparound", trace_buffer_capacity + 1000);
+    record_numbered("trace partial", 10);
+    trace_stop();
+
+    JsonValue document;
+    NGW_CHECK(export_and_parse(document));
+    const JsonValue &events = document["traceEvents"];
+
+    vector<const JsonValue*> wrapped = thread_events(events, find_thread(events, "trace wraparound"));
+    NGW_CHECK(wrapped.size() == trace_buffer_capacity - 1);
+    bool ordered = true;
+    for (size_t i = 0; i < wrapped.size(); i++)
+        ordered = ordered && fabs((*wrapped[i])["dur"].number - (1001 + i) / 1000.0) < 1e-9;
+    NGW_CHECK(ordered);
+
+    vector<const JsonValue*> partial = thread_events(events, find_thread(events, "trace partial"));
+    NGW_CHECK(partial.size() == 10);
+
+    // 清除之后不再导出旧的事件
+    trace_clear();
+    JsonValue cleared;
+    NGW_CHECK(export_and_parse(cleared));
+    NGW_CHECK(thread_events(cleared["traceEvents"], find_thread(cleared["traceEvents"], "trace partial")).empty());
+}
+
+NGW_TEST(trace_export_while_recording)
+{
+    trace_stop();
+    trace_clear();
+    trace_start();
+
+    // 导出时另一个线程不断覆盖自己的缓存，被覆盖的事件应当被丢弃，
+    // 留下的事件仍然是连续的一段，不会出现重复或者写了一半的事件
+    atomic<bool> running(true);
+    atomic<bool> named(false);
+    thread writer([&running, &named]()
+    {
+        trace_set_thread_name("trace busy writer");
+        named.store(true);
+        u64 base = OSLayer::fast_ns(), i = 0;
+        while (running.load(memory_order_relaxed))
+        {
+            trace_record("busy", base, base + i);
+            ++i;
+        }
+    });
+    while (!named.load())
+        this_thread::yield();
+    this_thread::sleep_for(chrono::milliseconds(5));
+
+    bool ok = true;
+    for (int round = 0; round < 3; round++)
+    {
+        JsonValue document;
+        ok = ok && export_and_parse(document);
+        vector<const JsonValue*> busy = thread_events(document["traceEvents"],
+                                                      find_thread(document["traceEvents"], "trace busy writer"));
+        ok = ok && busy.size() < trace_buffer_capacity;
+        for (size_t i = 1; i < busy.size(); i++)
+            ok = ok && fabs((*busy[i])["dur"].number - (*busy[i - 1])["dur"].number - 0.001) < 1e-6;
+    }
+    running.store(false);
+    writer.join();
+    trace_stop();
+    NGW_CHECK(ok);
+}